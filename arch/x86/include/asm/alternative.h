@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/alternative.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Boot-time patching of instructions keyed on CPU features
+ *
+ */
+
+#ifndef ASM_ALTERNATIVE_H
+#define ASM_ALTERNATIVE_H
+
+#include <stdint.h>
+#include <asm/cpufeature.h>
+
+#define ALT_STR_1(x) #x
+#define ALT_STR(x) ALT_STR_1(x)
+
+/* One patch site, the offsets are relative to the field holding them so no relocation is needed */
+typedef struct
+{
+    int32_t instr_offset;       // Original instructions
+    int32_t repl_offset;        // Replacement in .altinstr_replacement
+    uint16_t feature;           // X86_FEATURE_*
+    uint8_t instr_len;          // Padded with NOPs to at least repl_len
+    uint8_t repl_len;
+} __attribute__((packed)) alt_instr_t;
+
+/*
+ * Assembles oldinstr in place and newinstr out of line, and records the site in .altinstructions.
+ * apply_alternatives() copies newinstr over oldinstr when the processor has feature. newinstr may
+ * only hold position-independent code, or a single call or jmp with a 32-bit displacement.
+ */
+#define ALTERNATIVE(oldinstr, newinstr, feature) \
+    "661:\n\t" oldinstr "\n662:\n\t" \
+    ".skip -(((664f - 663f) - (662b - 661b)) > 0) * ((664f - 663f) - (662b - 661b)), 0x90\n" \
+    "665:\n" \
+    ".pushsection .altinstructions, \"a\"\n" \
+    "\t.long 661b - .\n" \
+    "\t.long 663f - .\n" \
+    "\t.word " ALT_STR(feature) "\n" \
+    "\t.byte 665b - 661b\n" \
+    "\t.byte 664f - 663f\n" \
+    ".popsection\n" \
+    ".pushsection .altinstr_replacement, \"ax\"\n" \
+    "663:\n\t" newinstr "\n664:\n" \
+    ".popsection\n"
+
+/*
+ * A branch patched into a fall-through, for feature tests on hot paths. Reads 0 until
+ * apply_alternatives() has run, only use it for code that is correct either way or runs later.
+ * A macro because the feature must reach the assembler as a constant, even at -O0
+ */
+#define static_cpu_has(feature) \
+    ({ \
+        __label__ alt_no; \
+        int alt_has = 1; \
+        asm goto(ALTERNATIVE("jmp %l[alt_no]", "", feature) : : : : alt_no); \
+        if (0) \
+        { \
+alt_no: \
+            alt_has = 0; \
+        } \
+        alt_has; \
+    })
+
+/* Patches every site whose feature is present, runs on the BSP after cpu_detect() and before smp_init() */
+void apply_alternatives();
+
+#endif /* ASM_ALTERNATIVE_H */
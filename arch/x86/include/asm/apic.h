@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/apic.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Local APIC in xAPIC and x2APIC mode
+ *
+ */
+
+#ifndef ASM_APIC_H
+#define ASM_APIC_H
+
+#include <stdint.h>
+#include <asm/alternative.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+#include <asm/msr.h>
+
+/* Register offsets in the xAPIC MMIO page */
+#define APIC_ID 0x20
+#define APIC_VERSION 0x30
+#define APIC_TPR 0x80
+#define APIC_EOI 0xB0
+#define APIC_SVR 0xF0
+#define APIC_ESR 0x280
+#define APIC_ICR_LOW 0x300
+#define APIC_ICR_HIGH 0x310
+#define APIC_LVT_TIMER 0x320
+#define APIC_LVT_LINT0 0x350
+#define APIC_LVT_LINT1 0x360
+#define APIC_LVT_ERROR 0x370
+#define APIC_TIMER_INITIAL 0x380
+#define APIC_TIMER_CURRENT 0x390
+#define APIC_TIMER_DIVIDE 0x3E0
+
+#define APIC_BASE_ENABLE (1UL << 11)
+#define APIC_BASE_X2APIC (1UL << 10)
+#define APIC_SVR_ENABLE (1 << 8)
+#define APIC_LVT_MASKED (1 << 16)
+#define APIC_TIMER_ONESHOT (0 << 17)
+#define APIC_TIMER_TSC_DEADLINE (2 << 17)
+#define APIC_ICR_PENDING (1 << 12)
+#define APIC_ICR_ASSERT (1 << 14)
+
+extern int x2apic_mode;
+extern volatile uint32_t *apic_mmio;
+
+/* Ticks of the LAPIC timer per millisecond, at divide by 16 */
+extern uint32_t apic_timer_khz;
+
+/* apic_init() picks x2APIC mode whenever the processor has it, so the hot paths test the patched feature */
+static inline uint32_t apic_read(uint32_t reg)
+{
+    if (static_cpu_has(X86_FEATURE_X2APIC))
+    {
+        return rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    }
+    return apic_mmio[reg / 4];
+}
+
+static inline void apic_write(uint32_t reg, uint32_t value)
+{
+    if (static_cpu_has(X86_FEATURE_X2APIC))
+    {
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+        return;
+    }
+    apic_mmio[reg / 4] = value;
+}
+
+static inline void apic_eoi()
+{
+    apic_write(APIC_EOI, 0);
+}
+
+/* Returns the APIC ID of the calling processor, the x2APIC ID in x2APIC mode */
+static inline uint32_t apic_id()
+{
+    uint32_t id = apic_read(APIC_ID);
+    return x2apic_mode ? id : id >> 24;
+}
+
+void apic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/*
+ * Masks the legacy PIC, enables the LAPIC of the BSP and registers its timer as the clock event device,
+ * in TSC-deadline mode when available. Needs tsc_init() and paging
+ */
+void apic_init();
+
+/* Enables the LAPIC of an AP in the mode the BSP chose */
+void apic_init_ap();
+
+#endif /* ASM_APIC_H */
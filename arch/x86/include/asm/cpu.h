@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/cpu.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Wrapper functions of CPU identification and control instructions
+ *
+ */
+
+#ifndef ASM_CPU_H
+#define ASM_CPU_H
+
+#include <stdint.h>
+#include <asm/alternative.h>
+
+#define CACHE_LINE_SIZE 64
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+/*
+ * Returns the initial Local APIC ID of the calling processor. The 32-bit x2APIC ID of leaf 0xB
+ * when there is one, CPUID 0x1 only has room for 8 bits
+ */
+static inline uint32_t cpu_apic_id()
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0xB)
+    {
+        cpuid(0xB, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx)
+        {
+            return edx;
+        }
+    }
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return ebx >> 24;
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint64_t read_cr0()
+{
+    uint64_t value;
+    asm volatile("mov %0, cr0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint64_t value)
+{
+    asm volatile("mov cr0, %0" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr2()
+{
+    uint64_t value;
+    asm volatile("mov %0, cr2" : "=r"(value));
+    return value;
+}
+
+static inline uint64_t read_cr3()
+{
+    uint64_t value;
+    asm volatile("mov %0, cr3" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint64_t value)
+{
+    asm volatile("mov cr3, %0" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4()
+{
+    uint64_t value;
+    asm volatile("mov %0, cr4" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value)
+{
+    asm volatile("mov cr4, %0" : : "r"(value) : "memory");
+}
+
+/* Extended control registers, CR4.OSXSAVE must be set */
+static inline uint64_t xgetbv(uint32_t index)
+{
+    uint32_t low, high;
+    asm volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(index));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void xsetbv(uint32_t index, uint64_t value)
+{
+    asm volatile("xsetbv" : : "c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint16_t read_cs()
+{
+    uint16_t value;
+    asm volatile("mov %0, cs" : "=r"(value));
+    return value;
+}
+
+static inline void invlpg(uintptr_t virt)
+{
+    asm volatile("invlpg [%0]" : : "r"(virt) : "memory");
+}
+
+static inline uint64_t rdtsc()
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* Not executed ahead of earlier loads, for timestamps that must not go backwards between processors */
+static inline uint64_t rdtsc_ordered()
+{
+    uint32_t low, high;
+    asm volatile(ALTERNATIVE("lfence; rdtsc", "rdtscp", X86_FEATURE_RDTSCP)
+        : "=a"(low), "=d"(high) : : "rcx", "memory");
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void pause()
+{
+    asm volatile("pause" : : : "memory");
+}
+
+#define RFLAGS_IF (1UL << 9)
+
+static inline void irq_enable()
+{
+    asm volatile("sti" : : : "memory");
+}
+
+static inline void irq_disable()
+{
+    asm volatile("cli" : : : "memory");
+}
+
+/* Enables interrupts and halts, an interrupt arriving in between still ends the halt */
+static inline void safe_halt()
+{
+    asm volatile("sti; hlt" : : : "memory");
+}
+
+/* Disables interrupts on the calling processor, returns the previous RFLAGS */
+static inline uint64_t irq_save()
+{
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags)
+{
+    asm volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+/* Switches to a fresh stack and calls fn on it, never returns */
+__attribute__((noreturn)) static inline void call_on_stack(uintptr_t stack_top, void (*fn)())
+{
+    asm volatile("mov rsp, %0; xor ebp, ebp; call %1; ud2" : : "r"(stack_top), "r"(fn) : "memory");
+    __builtin_unreachable();
+}
+
+#endif /* ASM_CPU_H */
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/cpufeature.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Detection of CPU features
+ *
+ */
+
+#ifndef ASM_CPUFEATURE_H
+#define ASM_CPUFEATURE_H
+
+#include <stdint.h>
+
+/*
+ * Each feature is encoded as 32 * word + bit. Words:
+ * 0: CPUID 0x1 EDX, 1: CPUID 0x1 ECX, 2: CPUID 0x80000001 EDX, 3: CPUID 0x80000007 EDX,
+ * 4: CPUID 0xD.1 EAX, 5: CPUID 0x7.0 EBX, 6: CPUID 0x7.0 EDX, 7: synthetic, set by cpu_detect()
+ */
+#define CPUID_WORDS 8
+
+#define X86_FEATURE_APIC        (0 * 32 + 9)    // CPUID 0x1 EDX: Local APIC
+#define X86_FEATURE_MTRR        (0 * 32 + 12)   // CPUID 0x1 EDX: Memory type range registers
+#define X86_FEATURE_PGE         (0 * 32 + 13)   // CPUID 0x1 EDX: Global pages
+#define X86_FEATURE_PAT         (0 * 32 + 16)   // CPUID 0x1 EDX: Page attribute table
+#define X86_FEATURE_FXSR        (0 * 32 + 24)   // CPUID 0x1 EDX: FXSAVE and FXRSTOR
+#define X86_FEATURE_SSE         (0 * 32 + 25)   // CPUID 0x1 EDX: SSE
+#define X86_FEATURE_SSE2        (0 * 32 + 26)   // CPUID 0x1 EDX: SSE2
+#define X86_FEATURE_X2APIC      (1 * 32 + 21)   // CPUID 0x1 ECX: x2APIC MSR interface
+#define X86_FEATURE_TSC_DEADLINE (1 * 32 + 24)  // CPUID 0x1 ECX: LAPIC timer TSC-deadline mode
+#define X86_FEATURE_XSAVE       (1 * 32 + 26)   // CPUID 0x1 ECX: XSAVE, XRSTOR, XSETBV and XCR0
+#define X86_FEATURE_AVX         (1 * 32 + 28)   // CPUID 0x1 ECX: AVX
+#define X86_FEATURE_NX          (2 * 32 + 20)   // CPUID 0x80000001 EDX: Execute-disable
+#define X86_FEATURE_PDPE1GB     (2 * 32 + 26)   // CPUID 0x80000001 EDX: 1 GiB pages
+#define X86_FEATURE_RDTSCP      (2 * 32 + 27)   // CPUID 0x80000001 EDX: RDTSCP
+#define X86_FEATURE_INVARIANT_TSC (3 * 32 + 8)  // CPUID 0x80000007 EDX: TSC rate unaffected by P/C-states
+#define X86_FEATURE_XSAVEOPT    (4 * 32 + 0)    // CPUID 0xD.1 EAX: XSAVEOPT
+#define X86_FEATURE_ERMS        (5 * 32 + 9)    // CPUID 0x7.0 EBX: Enhanced REP MOVSB/STOSB
+#define X86_FEATURE_FSRM        (6 * 32 + 4)    // CPUID 0x7.0 EDX: Fast short REP MOVSB
+#define X86_FEATURE_REP_MOVSB   (7 * 32 + 0)    // Synthetic: ERMS or FSRM, REP MOVSB beats quadword copies
+
+extern uint32_t cpu_features[CPUID_WORDS];
+
+static inline int cpu_has(unsigned int feature)
+{
+    return (cpu_features[feature / 32] >> (feature % 32)) & 1;
+}
+
+void cpu_detect();
+
+#endif /* ASM_CPUFEATURE_H */
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/fpu.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * FPU, SSE and AVX state of kernel threads
+ *
+ */
+
+#ifndef ASM_FPU_H
+#define ASM_FPU_H
+
+#include <stdint.h>
+
+#define CR0_MP (1UL << 1)           // WAIT honours TS
+#define CR0_EM (1UL << 2)           // x87 emulation, must be clear
+#define CR0_TS (1UL << 3)           // Task switched, the next FPU instruction raises #NM
+#define CR0_NE (1UL << 5)           // Native x87 error reporting
+
+#define CR4_OSFXSR (1UL << 9)
+#define CR4_OSXMMEXCPT (1UL << 10)
+#define CR4_OSXSAVE (1UL << 18)
+
+/* State components in XCR0 */
+#define XFEATURE_X87 (1UL << 0)
+#define XFEATURE_SSE (1UL << 1)
+#define XFEATURE_AVX (1UL << 2)
+#define XFEATURE_AVX512 (7UL << 5)  // Opmask, ZMM0-15 upper halves and ZMM16-31, all or nothing
+
+#define MXCSR_DEFAULT 0x1F80        // All exceptions masked, round to nearest
+
+struct thread;
+
+extern uint64_t fpu_xfeatures;      // Enabled state components, XCR0 with XSAVE
+extern uint32_t fpu_state_size;     // Bytes of a saved state area
+
+/* Picks the save format and the enabled state components, then sets up the BSP. Runs after cpu_detect() */
+void fpu_init();
+
+/* Enables the FPU, SSE and XSAVE on the calling processor */
+void fpu_init_cpu();
+
+/* Called by schedule() before the stack switch, only threads inside a section are saved */
+void fpu_switch(struct thread *prev, struct thread *next);
+
+/* Frees the state area of a dead thread */
+void fpu_release(struct thread *thread);
+
+/*
+ * Kernel code is built without SIMD and never touches the vector registers. A translation unit
+ * built with SIMD enabled (named *.simd.c) brackets its vector code in a section:
+ *     kernel_fpu_begin();
+ *     ...
+ *     kernel_fpu_end();
+ * A thread inside a section can be preempted or block, its registers are saved on the switch.
+ * Sections nest, and may not be entered from interrupt handlers or timer callbacks.
+ */
+void kernel_fpu_begin();
+void kernel_fpu_end();
+
+/* Returns 1 if the caller may enter a section, 0 in interrupt context */
+int kernel_fpu_usable();
+
+/* Returns 1 if every component in mask is enabled, e.g. XFEATURE_AVX before running AVX code */
+static inline int fpu_xfeature_enabled(uint64_t mask)
+{
+    return (fpu_xfeatures & mask) == mask;
+}
+
+#endif /* ASM_FPU_H */
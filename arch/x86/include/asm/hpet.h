@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/hpet.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * High Precision Event Timer
+ *
+ */
+
+#ifndef ASM_HPET_H
+#define ASM_HPET_H
+
+#include <stdint.h>
+
+#define HPET_DEFAULT_BASE 0xFED00000UL
+
+extern uint64_t hpet_period_fs;     // Counter period in femtoseconds, 0 without an HPET
+
+static inline int hpet_available()
+{
+    return hpet_period_fs != 0;
+}
+
+uint64_t hpet_read_counter();
+
+/* Maps and starts the HPET at phys and registers it as a clocksource, -ENODEV if none is there */
+int hpet_init(uintptr_t phys);
+
+#endif /* ASM_HPET_H */
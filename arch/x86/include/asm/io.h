@@ -45,6 +45,30 @@ static inline uint8_t inb(uint16_t port)
     return ret;
 }
 
+static inline void outw(uint16_t port, uint16_t data)
+{
+    asm volatile("out %w1, %w0" : : "a"(data), "Nd"(port) : "memory");
+}
+
+static inline uint16_t inw(uint16_t port)
+{
+    uint16_t ret;
+    asm volatile("in %w0, %w1" : "=a"(ret) : "Nd"(port): "memory");
+    return ret;
+}
+
+static inline void outl(uint16_t port, uint32_t data)
+{
+    asm volatile("out %w1, %k0" : : "a"(data), "Nd"(port) : "memory");
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+    uint32_t ret;
+    asm volatile("in %k0, %w1" : "=a"(ret) : "Nd"(port): "memory");
+    return ret;
+}
+
 static inline void hlt()
 {
     asm volatile("hlt");
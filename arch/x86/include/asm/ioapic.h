@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/ioapic.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * I/O APIC routing of external interrupts
+ *
+ */
+
+#ifndef ASM_IOAPIC_H
+#define ASM_IOAPIC_H
+
+#include <stdint.h>
+
+#define IOAPIC_DEFAULT_BASE 0xFEC00000UL
+#define MAX_IOAPICS 8
+#define ISA_IRQS 16
+
+/* Redirection entry flags */
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+#define IOAPIC_LEVEL (1 << 15)
+#define IOAPIC_MASKED (1 << 16)
+
+/* Maps the I/O APIC at phys serving GSIs from gsi_base on, with every input masked. -ENODEV if none */
+int ioapic_init(uintptr_t phys, uint32_t gsi_base);
+
+/* Records that ISA IRQ irq arrives on gsi with polarity and trigger flags, from an ACPI override */
+void ioapic_set_isa_override(uint8_t irq, uint32_t gsi, uint32_t flags);
+
+/* Delivers gsi as vector to the processor with apic_id. -EINVAL if no I/O APIC serves it */
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t apic_id, uint32_t flags);
+
+/* Same for a legacy ISA IRQ, following its override */
+int ioapic_route_isa(uint8_t irq, uint8_t vector, uint32_t apic_id);
+
+void ioapic_mask(uint32_t gsi);
+
+#endif /* ASM_IOAPIC_H */
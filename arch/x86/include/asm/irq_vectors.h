@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/irq_vectors.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Interrupt vector assignments
+ *
+ */
+
+#ifndef ASM_IRQ_VECTORS_H
+#define ASM_IRQ_VECTORS_H
+
+#define EXCEPTION_VECTORS 32
+
+#define ISA_IRQ_VECTOR(irq) (0x20 + (irq))  // Legacy ISA IRQs 0 ~ 15
+#define IRQ_DYNAMIC_START 0x30              // Handed out by irq_request()
+#define IRQ_DYNAMIC_END 0xEF
+#define LOCAL_TIMER_VECTOR 0xF0
+#define RESCHEDULE_VECTOR 0xF1
+#define TLB_SHOOTDOWN_VECTOR 0xF2
+#define APIC_ERROR_VECTOR 0xFE
+#define SPURIOUS_APIC_VECTOR 0xFF
+
+#endif /* ASM_IRQ_VECTORS_H */
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/memtype.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Memory types of mappings through the PAT and MTRRs
+ *
+ */
+
+#ifndef ASM_MEMTYPE_H
+#define ASM_MEMTYPE_H
+
+#include <stdint.h>
+
+/* Values as in the PAT and the MTRRs */
+enum memtype
+{
+    MEMTYPE_UC = 0,             // Uncacheable, strongly ordered
+    MEMTYPE_WC = 1,             // Write-combining, for framebuffers
+    MEMTYPE_WT = 4,             // Write-through
+    MEMTYPE_WP = 5,             // Write-protected
+    MEMTYPE_WB = 6,             // Write-back, normal memory
+    MEMTYPE_UC_MINUS = 7        // Uncacheable unless an MTRR says WC
+};
+
+/* Programs the PAT of the calling processor, before it loads the kernel page tables */
+void pat_init();
+
+/* PWT, PCD and PTE_PAT_4K selecting type for a 4 KiB entry, the nearest available one without a PAT */
+uint64_t memtype_flags(enum memtype type);
+
+/* Type the MTRRs give phys, MEMTYPE_UC if they are disabled */
+enum memtype mtrr_type(uintptr_t phys);
+
+const char *memtype_name(enum memtype type);
+
+#endif /* ASM_MEMTYPE_H */
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/page.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Definitions of page size and physical address translation
+ *
+ */
+
+#ifndef ASM_PAGE_H
+#define ASM_PAGE_H
+
+#include <stdint.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & PAGE_MASK)
+
+#define PAGE_OFFSET 0xFFFF800000000000UL    // Base of the direct map of all physical memory
+
+/*
+ * Physical memory is reached through BOOTBOOT's identity map until paging_init()
+ * switches to the kernel page tables, then through the direct map at PAGE_OFFSET
+ */
+extern uintptr_t direct_map_offset;
+
+static inline void *phys_to_virt(uintptr_t phys)
+{
+    return (void *)(phys + direct_map_offset);
+}
+
+/* Only valid for addresses returned by phys_to_virt() */
+static inline uintptr_t virt_to_phys(void *virt)
+{
+    return (uintptr_t)virt - direct_map_offset;
+}
+
+#endif /* ASM_PAGE_H */
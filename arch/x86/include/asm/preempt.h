@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/preempt.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Per-CPU preemption counter
+ *
+ */
+
+#ifndef ASM_PREEMPT_H
+#define ASM_PREEMPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/smp.h>
+
+/* A single GS-relative instruction, the thread cannot migrate halfway through it */
+static inline void preempt_count_inc()
+{
+    asm volatile("inc dword ptr gs:[%c0]" : : "i"(offsetof(cpu_t, preempt_count)) : "memory", "cc");
+}
+
+/* Returns 1 if the counter dropped to 0 */
+static inline int preempt_count_dec_and_test()
+{
+    uint8_t zero;
+    asm volatile("dec dword ptr gs:[%c1]; setz %0" : "=r"(zero) : "i"(offsetof(cpu_t, preempt_count)) : "memory", "cc");
+    return zero;
+}
+
+static inline uint32_t preempt_count()
+{
+    uint32_t count;
+    asm volatile("mov %0, dword ptr gs:[%c1]" : "=r"(count) : "i"(offsetof(cpu_t, preempt_count)));
+    return count;
+}
+
+#endif /* ASM_PREEMPT_H */
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/string.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * x86 variants of the memory routines
+ *
+ */
+
+#ifndef ASM_STRING_H
+#define ASM_STRING_H
+
+#include <stddef.h>
+
+/* Fast with ERMS, and for short copies as well with FSRM. memcpy() and memset() inline these when patched */
+void *memcpy_movsb(void *dst, const void *src, size_t n);
+void *memset_stosb(void *dst, int c, size_t n);
+
+/* Quadwords then the tail, for processors where REP MOVSB/STOSB are slow */
+void *memcpy_movsq(void *dst, const void *src, size_t n);
+void *memset_stosq(void *dst, int c, size_t n);
+
+#endif /* ASM_STRING_H */
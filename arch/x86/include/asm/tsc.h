@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/asm/tsc.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Time Stamp Counter frequency and conversions
+ *
+ */
+
+#ifndef ASM_TSC_H
+#define ASM_TSC_H
+
+#include <stdint.h>
+
+#define TSC_SHIFT 32
+
+extern uint64_t tsc_khz;
+extern uint64_t tsc_mult;       // ns = cycles * tsc_mult >> TSC_SHIFT
+extern uint64_t tsc_epoch;      // TSC at ktime 0
+
+/*
+ * Takes the TSC frequency from CPUID when it is enumerated, otherwise measures it against the HPET or
+ * the PIT. Registers the TSC as clocksource, preferred unless it is not invariant. Runs on the BSP
+ * after hpet_init()
+ */
+void tsc_init();
+
+static inline uint64_t tsc_to_ns(uint64_t cycles)
+{
+    return ((unsigned __int128)cycles * tsc_mult) >> TSC_SHIFT;
+}
+
+static inline uint64_t ns_to_tsc(uint64_t ns)
+{
+    return ns / 1000000 * tsc_khz + ns % 1000000 * tsc_khz / 1000000;
+}
+
+#endif /* ASM_TSC_H */
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/kernel/acpi.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ACPI static table lookup
+ *
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct
+{
+    uint64_t base;
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__((packed)) acpi_mcfg_entry_t;
+
+typedef struct
+{
+    acpi_sdt_header_t header;
+    uint64_t reserved;
+    acpi_mcfg_entry_t entries[];
+} __attribute__((packed)) acpi_mcfg_t;
+
+/*
+ * Finds the root table from what the loader passed, or by scanning the BIOS area for the RSDP, and
+ * reads the NUMA layout from SRAT and SLIT. Works on the loader's identity map as well
+ */
+void acpi_init();
+
+/* Returns the index'th table with signature whose checksum holds, NULL if there is none */
+acpi_sdt_header_t *acpi_find_table(const char *signature, unsigned int index);
+
+/* Physical address of the first HPET, 0 without an HPET table */
+uintptr_t acpi_hpet_address();
+
+/* Sets up the I/O APICs and ISA overrides the MADT lists, returns how many I/O APICs it found */
+int acpi_madt_init();
+
+#endif/* ACPI_H */
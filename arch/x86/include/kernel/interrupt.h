@@ -50,13 +50,37 @@ typedef struct
 	uint64_t base;
 } __attribute__((packed)) idtr64_t;
 
-__attribute__((aligned(0x10))) static idt64_entry_t idt[256];
+/* Saved by the entry stubs in entry.S, lowest address first */
+typedef struct
+{
+	uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+	uint64_t rdi, rsi, rbp, rbx, rdx, rcx, rax;
+	uint64_t vector;
+	uint64_t error_code;    // 0 for vectors without one
+	uint64_t rip, cs, rflags, rsp, ss;
+} interrupt_frame_t;
 
-static idtr64_t idtr;
+typedef void (*irq_handler_t)(interrupt_frame_t *frame, void *arg);
+
+extern idt64_entry_t idt[256];
+extern idtr64_t idtr;
 
 void interrupt_init();
 
-void idt64_set_descriptor(uint8_t vector, void *isr, uint8_t flags);
+/* Loads the IDT on the calling processor */
+void interrupt_load();
+
+void idt64_set_desc(uint8_t vector, void *isr, uint8_t flags);
+
+/* Installs a handler for a fixed vector, -EBUSY if it already has one */
+int irq_register(uint8_t vector, irq_handler_t handler, void *arg);
+
+/* Installs a handler on a free vector and returns the vector, -ENOSPC if none is left */
+int irq_request(irq_handler_t handler, void *arg);
+
+void irq_free(uint8_t vector);
 
+/* Entered from entry.S with interrupts disabled */
+void interrupt_dispatch(interrupt_frame_t *frame);
 
 #endif/* INTERRUPT_H */
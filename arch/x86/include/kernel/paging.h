@@ -31,6 +31,10 @@
 #ifndef PAGING_H
 #define PAGING_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/memtype.h>
+
 #define PT_INDEX(VA) ((VA >> 12) & 0x1ff)
 #define PD_INDEX(VA) ((VA >> 21) & 0x1ff)
 #define PDPT_INDEX(VA) ((VA >> 30) & 0x1ff)
@@ -54,7 +58,7 @@ enum pt_ent_flags
 
 typedef struct
 {
-    enum pt_ent_flags flags : 12;
+    unsigned int flags      : 12;
     long phy_addr           : 40;
     int                     : 7;    // Ignored
     int prot_key            : 4;
@@ -63,7 +67,7 @@ typedef struct
 
 typedef struct  // PDE references to a Page Table
 {
-    enum pt_ent_flags flags : 12;
+    unsigned int flags      : 12;
     long phy_addr           : 38;
     int                     : 13;   // Ignored
     int xd                  : 1;    // Execute-disable bit
@@ -71,7 +75,7 @@ typedef struct  // PDE references to a Page Table
 
 typedef struct  // PDE references to a 2MB Page
 {
-    enum pt_ent_flags flags : 13;
+    unsigned int flags      : 13;
     int reserved            : 8;
     int phy_addr            : 31;
     int                     : 7;    // Ignored
@@ -87,7 +91,7 @@ typedef union
 
 typedef struct  // PDPTE references to a Page Directory
 {
-    enum pt_ent_flags flags : 12;
+    unsigned int flags      : 12;
     long phy_addr           : 40;
     int                     : 11;   // Ignored
     int xd                  : 1;    // Execute-disable bit
@@ -95,7 +99,7 @@ typedef struct  // PDPTE references to a Page Directory
 
 typedef struct  // PDE references to a 1GB Page
 {
-    enum pt_ent_flags flags : 13;
+    unsigned int flags      : 13;
     int reserved            : 17;
     int phy_addr            : 22;
     int                     : 7;    // Ignored
@@ -111,7 +115,7 @@ typedef union
 
 typedef struct
 {
-    enum pt_ent_flags flags : 12;
+    unsigned int flags      : 12;
     long phy_addr           : 40;
     int                     : 11;   // Ignored
     int xd                  : 1;    // Execute-disable bit
@@ -119,7 +123,7 @@ typedef struct
 
 typedef struct
 {
-    enum pt_ent_flags flags : 12;
+    unsigned int flags      : 12;
     long phy_addr           : 40;
     int                     : 11;   // Ignored
     int xd                  : 1;    // Execute-disable bit
@@ -131,4 +135,57 @@ typedef struct
     long phy_addr                   : 52;
 } cr3_t;
 
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000UL
+#define PTE_XD (1UL << 63)                  // Execute-disable, ignored if the CPU has no NX
+#define PTE_PAT_4K 0x80UL                   // PAT bit of 4 KiB entries, PAT is its place in huge ones
+
+#define PAGE_SIZE_4K 0x1000UL
+#define PAGE_SIZE_2M 0x200000UL
+#define PAGE_SIZE_1G 0x40000000UL
+
+/* Bits paging_protect() may change. The address and memory type of a mapping are kept */
+#define PTE_PROT_MASK (RW | US | G | PTE_XD)
+#define PTE_MEMTYPE_MASK (PWT | PCD | PTE_PAT_4K)
+
+void paging_init();
+
+/* Loads the kernel page tables on an application processor */
+void paging_init_ap();
+
+/*
+ * Maps [virt, virt + size) to [phys, phys + size) with the largest pages the alignment allows.
+ * flags use the 4 KiB entry layout (pt_ent_flags, PTE_PAT_4K, PTE_XD) and are converted for huge
+ * pages, P is implied. Returns 0 or -errno
+ *
+ * Changes to present entries are flushed from every processor's TLB before these return. Once the
+ * APs are up, don't call them holding a lock another processor may spin on with interrupts disabled
+ */
+int paging_map(uintptr_t virt, uintptr_t phys, size_t size, uint64_t flags);
+int paging_unmap(uintptr_t virt, size_t size);
+int paging_protect(uintptr_t virt, size_t size, uint64_t flags);
+int paging_translate(uintptr_t virt, uintptr_t *phys);
+
+/* Changes the memory type of every page in the range, splitting huge pages that straddle its ends */
+int paging_set_memtype(uintptr_t virt, size_t size, enum memtype type);
+
+/* Maps a device region with the given memory type and returns its virtual address, NULL on failure */
+void *ioremap_cache(uintptr_t phys, size_t size, enum memtype type);
+
+/* Uncached, for registers */
+static inline void *ioremap(uintptr_t phys, size_t size)
+{
+    return ioremap_cache(phys, size, MEMTYPE_UC);
+}
+
+static inline void *ioremap_uc(uintptr_t phys, size_t size)
+{
+    return ioremap_cache(phys, size, MEMTYPE_UC);
+}
+
+/* Write-combining, for framebuffers and other memory written in bulk */
+static inline void *ioremap_wc(uintptr_t phys, size_t size)
+{
+    return ioremap_cache(phys, size, MEMTYPE_WC);
+}
+
 #endif/* PAGING_H */
\ No newline at end of file
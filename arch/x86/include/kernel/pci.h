@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/kernel/pci.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * PCI configuration space access and device enumeration
+ *
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/interrupt.h>
+
+#define PCI_MAX_DEVICES 64
+#define PCI_BARS 6
+
+/* Configuration space header, type 0 */
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_STATUS 0x06
+#define PCI_REVISION 0x08
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR(n) (0x10 + 4 * (n))
+#define PCI_SUBSYSTEM_ID 0x2E
+#define PCI_CAPABILITY_LIST 0x34
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_EXT_CAPABILITY_LIST 0x100  // Extended configuration space, only through ECAM
+
+#define PCI_STATUS_CAP_LIST 0x0010
+
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+#define PCI_BAR_IO 0x01
+#define PCI_BAR_MEM_64 0x04
+#define PCI_BAR_PREFETCH 0x08
+#define PCI_HEADER_MULTIFUNC 0x80
+
+/* Capability IDs */
+#define PCI_CAP_ID_MSI 0x05
+#define PCI_CAP_ID_VENDOR 0x09
+#define PCI_CAP_ID_EXP 0x10
+#define PCI_CAP_ID_MSIX 0x11
+
+typedef struct
+{
+    uintptr_t base;             // Physical address or I/O port
+    uint64_t size;
+    uint8_t io;
+    uint8_t prefetch;
+    uint8_t is64;               // Takes the next BAR as its high half
+} pci_bar_t;
+
+typedef struct
+{
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t class;
+    uint8_t subclass;
+    uint8_t prog_if;
+    volatile uint8_t *config;   // ECAM window of the function, NULL if reached through ports
+    pci_bar_t bars[PCI_BARS];
+    volatile uint32_t *msix_table;
+    uint16_t msix_cap;
+    uint16_t msix_count;
+} pci_device_t;
+
+uint32_t pci_read32(pci_device_t *dev, uint16_t offset);
+uint16_t pci_read16(pci_device_t *dev, uint16_t offset);
+uint8_t pci_read8(pci_device_t *dev, uint16_t offset);
+void pci_write32(pci_device_t *dev, uint16_t offset, uint32_t value);
+void pci_write16(pci_device_t *dev, uint16_t offset, uint16_t value);
+
+void pci_write8(pci_device_t *dev, uint16_t offset, uint8_t value);
+
+/* Enumerates through ECAM if ACPI has an MCFG table, else through ports, and sizes the BARs */
+void pci_init();
+
+/* Returns the next function after from (NULL to start) matching vendor and device, 0xFFFF matches any */
+pci_device_t *pci_find(uint16_t vendor, uint16_t device, pci_device_t *from);
+
+/* Sets bits in the command register, e.g. to let the function decode its BARs and master the bus */
+void pci_enable(pci_device_t *dev, uint16_t command);
+
+/* Maps memory BAR n uncached, NULL if it is absent or an I/O BAR */
+void *pci_bar_map(pci_device_t *dev, unsigned int n);
+
+/* Returns the offset of the first capability with id, 0 if there is none */
+uint16_t pci_find_capability(pci_device_t *dev, uint8_t id);
+uint16_t pci_find_ext_capability(pci_device_t *dev, uint16_t id);
+
+/* Maps the MSI-X table with every entry masked and switches from INTx to MSI-X, returns the entry count */
+int pci_msix_enable(pci_device_t *dev);
+
+/*
+ * Allocates a vector for handler and points entry at the processor with apic_id, so each queue
+ * can interrupt the core that serves it. Returns the vector or -errno
+ */
+int pci_msix_request(pci_device_t *dev, unsigned int entry, uint32_t apic_id, irq_handler_t handler, void *arg);
+
+/* Masks entry and frees its vector */
+void pci_msix_free(pci_device_t *dev, unsigned int entry);
+
+void pci_msix_mask(pci_device_t *dev, unsigned int entry, int masked);
+
+#endif/* PCI_H */
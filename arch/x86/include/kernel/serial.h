@@ -31,6 +31,9 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define PORT_COM1 0x3F8
 #define PORT_COM2 0x2F8
 #define PORT_COM3 0x3E8
@@ -40,9 +43,31 @@
 #define PORT_COM7 0x5E8
 #define PORT_COM8 0x4E8
  
-uint8_t serial_recv(uint16_t port);
+#define SERIAL_DEFAULT_BAUD 115200
+#define SERIAL_TX_SIZE 8192     // Bytes queued for sending, a power of two
+#define SERIAL_RX_SIZE 1024
+#define UART_FIFO_SIZE 16
+
+/*
+ * Programs the baud rate, 8N1 and the FIFOs, and routes the port's ISA IRQ to the calling processor.
+ * From then on writes queue and return at once and received bytes are buffered. Ports never initialized
+ * are polled. Returns 0 or -ENODEV if no UART answers, needs the I/O APIC set up
+ */
+int serial_init(uint16_t port, uint32_t baud);
+
+/* Blocks until a byte arrives */
+uint8_t serial_recv_byte(uint16_t port);
+
+void serial_send_byte(uint16_t port, uint8_t data);
+
+/* Queues what fits and returns its length, whatever does not fit is left to the caller */
+size_t serial_write(uint16_t port, const char *buffer, size_t length);
+
+/* Takes up to length buffered bytes without waiting */
+size_t serial_read(uint16_t port, char *buffer, size_t length);
 
-void serial_send(uint16_t port, uint8_t data);
+/* Sends everything queued by polling, for when interrupts will not come any more, e.g. in panic() */
+void serial_flush(uint16_t port);
 
 int serial_recv_str(uint16_t port, char *buffer);
 
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/kernel/smp.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Symmetric multiprocessing and per-CPU data
+ *
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/page.h>
+
+#define MAX_CPUS 256
+#define KERNEL_STACK_ORDER 2
+#define KERNEL_STACK_SIZE (PAGE_SIZE << KERNEL_STACK_ORDER)
+
+struct thread;
+struct runqueue;
+
+/* Per-CPU data block, reached through the GS base of its processor */
+typedef struct cpu
+{
+    struct cpu *self;       // Must stay first, this_cpu() loads it from GS:0
+    unsigned int id;        // Dense index, 0 ~ cpu_count() - 1
+    uint32_t apic_id;
+    unsigned int package;       // Set by topology_init()
+    unsigned int core;          // Within the package
+    unsigned int thread;        // Within the core
+    unsigned int node;          // NUMA node
+    uintptr_t stack_top;
+    struct thread *current;     // Thread running on this processor
+    struct thread *idle;        // Runs when nothing else can, never queued
+    struct runqueue *rq;
+    uint32_t preempt_count;     // Preemption is allowed only at 0
+    uint32_t need_resched;      // Set when current should give up the processor
+    uint32_t irq_depth;         // Nesting of interrupt_dispatch()
+    unsigned int steal_next;    // Next victim to steal from
+    uint64_t nr_switches;
+} __attribute__((aligned(CACHE_LINE_SIZE))) cpu_t;
+
+extern cpu_t *cpus[MAX_CPUS];
+extern unsigned int smp_cpu_count;
+
+static inline cpu_t *this_cpu()
+{
+    cpu_t *cpu;
+    asm volatile("mov %0, qword ptr gs:[0]" : "=r"(cpu));
+    return cpu;
+}
+
+/* Returns the index of the calling processor, 0 ~ cpu_count() - 1 */
+static inline unsigned int cpu_id()
+{
+    unsigned int id;
+    asm volatile("mov %0, dword ptr gs:[%c1]" : "=r"(id) : "i"(offsetof(cpu_t, id)));
+    return id;
+}
+
+static inline unsigned int cpu_count()
+{
+    return smp_cpu_count;
+}
+
+/* Sets up the per-CPU block of the BSP, must run before anything calls cpu_id() */
+void smp_early_init();
+
+/* Allocates per-CPU blocks and stacks, brings the APs up and parks them on a barrier */
+void smp_init();
+
+/* Non-zero once smp_init() has every processor online and taking interrupts */
+int smp_ready();
+
+/* Lifts the barrier, every AP calls entry on its own stack */
+void smp_start(void (*entry)());
+
+/* Makes a processor call schedule() on its way out of the interrupt */
+void smp_send_reschedule(unsigned int cpu);
+
+/* Where the APs enter the kernel from _start */
+__attribute__((noreturn)) void smp_ap_entry();
+
+#endif/* SMP_H */
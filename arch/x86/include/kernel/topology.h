@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/include/kernel/topology.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * CPU topology and NUMA nodes
+ *
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/smp.h>
+
+#define MAX_NUMA_NODES 8
+#define MAX_NUMA_MEMBLKS 32
+#define LOCAL_DISTANCE 10               // SLIT units, a node to itself
+#define REMOTE_DISTANCE 20
+
+/* A physical range local to node, from SRAT */
+typedef struct
+{
+    uintptr_t start;
+    uintptr_t end;
+    unsigned int node;
+} numa_memblk_t;
+
+extern numa_memblk_t numa_memblks[MAX_NUMA_MEMBLKS];
+extern unsigned int numa_memblk_count;
+
+/*
+ * Filled in while the ACPI tables are parsed. Proximity domains are folded into dense node
+ * numbers in the order they are first seen, -ENOSPC past MAX_NUMA_NODES
+ */
+int numa_pxm_to_node(uint32_t pxm);
+void numa_add_memblk(uint32_t pxm, uintptr_t start, uint64_t length);
+void numa_set_apic_node(uint32_t apic_id, uint32_t pxm);
+void numa_set_distance(uint32_t from_pxm, uint32_t to_pxm, uint8_t distance);
+
+/* At least 1, every processor and all memory is on node 0 without SRAT */
+unsigned int numa_node_count();
+
+uint8_t numa_distance(unsigned int from, unsigned int to);
+
+/* Node of the memory at phys, 0 if SRAT does not cover it */
+unsigned int numa_node_of_phys(uintptr_t phys);
+
+/* Fills in the package, core, thread and node of every processor, after smp_init() */
+void topology_init();
+
+static inline unsigned int cpu_node(unsigned int cpu)
+{
+    return cpus[cpu]->node;
+}
+
+/* SMT siblings share a core */
+static inline int cpu_is_sibling(unsigned int a, unsigned int b)
+{
+    return cpus[a]->package == cpus[b]->package && cpus[a]->core == cpus[b]->core;
+}
+
+#endif/* TOPOLOGY_H */
@@ -0,0 +1,461 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/acpi.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * ACPI static table lookup
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/ioapic.h>
+#include <asm/page.h>
+#include <boot/bootboot.h>
+#include <kernel/acpi.h>
+#include <kernel/kprintf.h>
+#include <kernel/topology.h>
+
+extern BOOTBOOT bootboot;
+
+typedef struct
+{
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+    uint32_t length;            // From here on ACPI 2.0
+    uint64_t xsdt;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_subtable_t;
+
+#define MADT_LOCAL_APIC 0
+#define MADT_IO_APIC 1
+#define MADT_INT_OVERRIDE 2
+#define MADT_LOCAL_X2APIC 9
+
+#define MADT_ENABLED 1
+#define MADT_ONLINE_CAPABLE 2
+
+/* MPS INTI flags of an override */
+#define MPS_POLARITY_MASK 0x3
+#define MPS_POLARITY_LOW 0x3
+#define MPS_TRIGGER_MASK 0xC
+#define MPS_TRIGGER_LEVEL 0xC
+
+typedef struct
+{
+    acpi_sdt_header_t header;
+    uint32_t local_apic;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct
+{
+    acpi_subtable_t sub;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_local_apic_t;
+
+typedef struct
+{
+    acpi_subtable_t sub;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_io_apic_t;
+
+typedef struct
+{
+    acpi_subtable_t sub;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_int_override_t;
+
+typedef struct
+{
+    acpi_subtable_t sub;
+    uint16_t reserved;
+    uint32_t apic_id;
+    uint32_t flags;
+    uint32_t uid;
+} __attribute__((packed)) madt_local_x2apic_t;
+
+typedef struct
+{
+    acpi_sdt_header_t header;
+    uint32_t block_id;
+    uint8_t space_id;           // Generic address structure of the registers
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+    uint8_t number;
+    uint16_t min_tick;
+    uint8_t attributes;
+} __attribute__((packed)) acpi_hpet_t;
+
+#define SRAT_CPU_AFFINITY 0
+#define SRAT_MEMORY_AFFINITY 1
+#define SRAT_X2APIC_AFFINITY 2
+
+#define SRAT_ENABLED 1
+
+typedef struct
+{
+    acpi_sdt_header_t header;
+    uint32_t reserved1;
+    uint64_t reserved2;
+} __attribute__((packed)) acpi_srat_t;
+
+typedef struct
+{
+    acpi_subtable_t sub;
+    uint8_t pxm_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t pxm_high[3];
+    uint32_t clock_domain;
+} __attribute__((packed)) srat_cpu_affinity_t;
+
+typedef struct
+{
+    acpi_subtable_t sub;
+    uint32_t pxm;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t length;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed)) srat_memory_affinity_t;
+
+typedef struct
+{
+    acpi_subtable_t sub;
+    uint16_t reserved1;
+    uint32_t pxm;
+    uint32_t apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed)) srat_x2apic_affinity_t;
+
+typedef struct
+{
+    acpi_sdt_header_t header;
+    uint64_t localities;
+    uint8_t entries[];          // localities * localities distances
+} __attribute__((packed)) acpi_slit_t;
+
+/* Kept physical, the loader's identity map is gone after paging_init() */
+static uintptr_t root_phys;             // XSDT, or the RSDT of ACPI 1.0
+static int root_is_xsdt;
+
+static int checksum_ok(const void *table, size_t length)
+{
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        sum += ((const uint8_t *)table)[i];
+    }
+    return sum == 0;
+}
+
+static int signature_is(const char *a, const char *b, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (a[i] != b[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int use_rsdp(const acpi_rsdp_t *rsdp)
+{
+    if (!signature_is(rsdp->signature, "RSD PTR ", 8) || !checksum_ok(rsdp, 20))
+    {
+        return 0;
+    }
+    if (rsdp->revision >= 2 && rsdp->xsdt && checksum_ok(rsdp, rsdp->length))
+    {
+        root_phys = rsdp->xsdt;
+        root_is_xsdt = 1;
+    }
+    else
+    {
+        root_phys = rsdp->rsdt;
+        root_is_xsdt = 0;
+    }
+    return 1;
+}
+
+/* The RSDP sits on a 16 byte boundary in the first KiB of the EBDA or in 0xE0000 ~ 0xFFFFF */
+static int scan_rsdp(uintptr_t start, size_t length)
+{
+    for (uintptr_t p = start & ~15UL; p < start + length; p += 16)
+    {
+        if (use_rsdp(phys_to_virt(p)))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Calls fn on each subtable after the fixed part of table, which is offset bytes long */
+static void for_each_subtable(acpi_sdt_header_t *table, size_t offset, void (*fn)(acpi_subtable_t *sub))
+{
+    uint8_t *p = (uint8_t *)table + offset;
+    uint8_t *end = (uint8_t *)table + table->length;
+    while (p + sizeof(acpi_subtable_t) <= end)
+    {
+        acpi_subtable_t *sub = (acpi_subtable_t *)p;
+        if (sub->length < sizeof(acpi_subtable_t) || p + sub->length > end)
+        {
+            break;
+        }
+        fn(sub);
+        p += sub->length;
+    }
+}
+
+static void srat_entry(acpi_subtable_t *sub)
+{
+    switch (sub->type)
+    {
+    case SRAT_CPU_AFFINITY:
+    {
+        srat_cpu_affinity_t *cpu = (srat_cpu_affinity_t *)sub;
+        if (cpu->flags & SRAT_ENABLED)
+        {
+            uint32_t pxm = cpu->pxm_low | cpu->pxm_high[0] << 8 | cpu->pxm_high[1] << 16 |
+                (uint32_t)cpu->pxm_high[2] << 24;
+            numa_set_apic_node(cpu->apic_id, pxm);
+        }
+        break;
+    }
+
+    case SRAT_MEMORY_AFFINITY:
+    {
+        srat_memory_affinity_t *memory = (srat_memory_affinity_t *)sub;
+        if (memory->flags & SRAT_ENABLED)
+        {
+            numa_add_memblk(memory->pxm, memory->base, memory->length);
+        }
+        break;
+    }
+
+    case SRAT_X2APIC_AFFINITY:
+    {
+        srat_x2apic_affinity_t *cpu = (srat_x2apic_affinity_t *)sub;
+        if (cpu->flags & SRAT_ENABLED)
+        {
+            numa_set_apic_node(cpu->apic_id, cpu->pxm);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+static void numa_init()
+{
+    acpi_sdt_header_t *srat = acpi_find_table("SRAT", 0);
+    if (!srat)
+    {
+        return;
+    }
+    for_each_subtable(srat, sizeof(acpi_srat_t), srat_entry);
+
+    acpi_slit_t *slit = (acpi_slit_t *)acpi_find_table("SLIT", 0);
+    if (!slit || sizeof(acpi_slit_t) + slit->localities * slit->localities > slit->header.length)
+    {
+        return;
+    }
+    for (uint64_t from = 0; from < slit->localities; from++)
+    {
+        for (uint64_t to = 0; to < slit->localities; to++)
+        {
+            numa_set_distance(from, to, slit->entries[from * slit->localities + to]);
+        }
+    }
+}
+
+static unsigned int madt_cpus;
+
+static void madt_count_cpu(acpi_subtable_t *sub)
+{
+    if (sub->type == MADT_LOCAL_APIC)
+    {
+        madt_cpus += !!(((madt_local_apic_t *)sub)->flags & (MADT_ENABLED | MADT_ONLINE_CAPABLE));
+    }
+    else if (sub->type == MADT_LOCAL_X2APIC)
+    {
+        madt_cpus += !!(((madt_local_x2apic_t *)sub)->flags & (MADT_ENABLED | MADT_ONLINE_CAPABLE));
+    }
+}
+
+void acpi_init()
+{
+    // The loader passes the RSDT or XSDT itself, some loaders the RSDP
+    uintptr_t ptr = bootboot.arch.x86_64.acpi_ptr;
+    if (ptr)
+    {
+        acpi_sdt_header_t *table = phys_to_virt(ptr);
+        if (signature_is(table->signature, "XSDT", 4) || signature_is(table->signature, "RSDT", 4))
+        {
+            root_phys = ptr;
+            root_is_xsdt = table->signature[0] == 'X';
+        }
+        else
+        {
+            use_rsdp(phys_to_virt(ptr));
+        }
+    }
+    if (!root_phys)
+    {
+        uintptr_t ebda = (uintptr_t)*(uint16_t *)phys_to_virt(0x40E) << 4;
+        if (!(ebda && scan_rsdp(ebda, 1024)))
+        {
+            scan_rsdp(0xE0000, 0x20000);
+        }
+    }
+    acpi_sdt_header_t *root = root_phys ? phys_to_virt(root_phys) : NULL;
+    if (!root || !checksum_ok(root, root->length))
+    {
+        root_phys = 0;
+        kprintf("ACPI: no tables\n");
+        return;
+    }
+
+    acpi_sdt_header_t *madt = acpi_find_table("APIC", 0);
+    if (madt)
+    {
+        for_each_subtable(madt, sizeof(acpi_madt_t), madt_count_cpu);
+    }
+    numa_init();
+    kprintf("ACPI: %.4s rev %u from %.6s, %u processors, %u NUMA nodes\n", root->signature, root->revision,
+        root->oem_id, madt_cpus, numa_node_count());
+}
+
+acpi_sdt_header_t *acpi_find_table(const char *signature, unsigned int index)
+{
+    if (!root_phys)
+    {
+        return NULL;
+    }
+    acpi_sdt_header_t *root = phys_to_virt(root_phys);
+    size_t entry_size = root_is_xsdt ? 8 : 4;
+    size_t count = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    const uint8_t *entries = (const uint8_t *)(root + 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        // XSDT entries are 8 bytes at 4 byte alignment
+        uint64_t phys = root_is_xsdt ? *(const uint64_t *)(entries + i * 8) : *(const uint32_t *)(entries + i * 4);
+        acpi_sdt_header_t *table = phys_to_virt(phys);
+        if (signature_is(table->signature, signature, 4) && checksum_ok(table, table->length) && index-- == 0)
+        {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+uintptr_t acpi_hpet_address()
+{
+    acpi_hpet_t *hpet = (acpi_hpet_t *)acpi_find_table("HPET", 0);
+    return hpet && hpet->space_id == 0 ? hpet->address : 0;    // Only memory space makes sense
+}
+
+static int madt_ioapics;
+
+static void madt_entry(acpi_subtable_t *sub)
+{
+    switch (sub->type)
+    {
+    case MADT_IO_APIC:
+    {
+        madt_io_apic_t *ioapic = (madt_io_apic_t *)sub;
+        if (ioapic_init(ioapic->address, ioapic->gsi_base) == 0)
+        {
+            madt_ioapics++;
+        }
+        break;
+    }
+
+    case MADT_INT_OVERRIDE:
+    {
+        // Conforming polarity and trigger mean ISA's, active high and edge
+        madt_int_override_t *override = (madt_int_override_t *)sub;
+        uint32_t flags = 0;
+        if ((override->flags & MPS_POLARITY_MASK) == MPS_POLARITY_LOW)
+        {
+            flags |= IOAPIC_ACTIVE_LOW;
+        }
+        if ((override->flags & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL)
+        {
+            flags |= IOAPIC_LEVEL;
+        }
+        if (override->bus == 0)
+        {
+            ioapic_set_isa_override(override->source, override->gsi, flags);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+int acpi_madt_init()
+{
+    acpi_sdt_header_t *madt = acpi_find_table("APIC", 0);
+    if (!madt)
+    {
+        return 0;
+    }
+    madt_ioapics = 0;
+    for_each_subtable(madt, sizeof(acpi_madt_t), madt_entry);
+    return madt_ioapics;
+}
@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/alternative.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Boot-time patching of instructions keyed on CPU features
+ *
+ */
+
+#include <stdint.h>
+#include <asm/alternative.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+#include <kernel/kprintf.h>
+
+#define OPCODE_CALL_REL32 0xE8
+#define OPCODE_JMP_REL32 0xE9
+#define MAX_NOP_LEN 8
+
+extern alt_instr_t __alt_instructions[];       // Provided by linker.ld
+extern alt_instr_t __alt_instructions_end[];
+
+/* The recommended multi-byte NOPs, one instruction per length */
+static const uint8_t nops[MAX_NOP_LEN + 1][MAX_NOP_LEN] = {
+    [1] = {0x90},
+    [2] = {0x66, 0x90},
+    [3] = {0x0F, 0x1F, 0x00},
+    [4] = {0x0F, 0x1F, 0x40, 0x00},
+    [5] = {0x0F, 0x1F, 0x44, 0x00, 0x00},
+    [6] = {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+    [7] = {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+    [8] = {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+
+/* Byte loops on purpose, memcpy() is itself a patch site */
+static void text_copy(uint8_t *dst, const uint8_t *src, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; i++)
+    {
+        dst[i] = src[i];
+    }
+}
+
+static void add_nops(uint8_t *p, unsigned int len)
+{
+    while (len)
+    {
+        unsigned int n = len < MAX_NOP_LEN ? len : MAX_NOP_LEN;
+        text_copy(p, nops[n], n);
+        p += n;
+        len -= n;
+    }
+}
+
+/*
+ * The kernel image is still mapped writable by the loader and the APs are parked outside any patch
+ * site. Each AP runs a serializing WRMSR and CR3 load before it can reach one.
+ */
+void apply_alternatives()
+{
+    unsigned int total = 0;
+    unsigned int patched = 0;
+
+    for (alt_instr_t *alt = __alt_instructions; alt < __alt_instructions_end; alt++)
+    {
+        total++;
+        if (!cpu_has(alt->feature))
+        {
+            continue;
+        }
+
+        uint8_t *instr = (uint8_t *)&alt->instr_offset + alt->instr_offset;
+        uint8_t *repl = (uint8_t *)&alt->repl_offset + alt->repl_offset;
+        text_copy(instr, repl, alt->repl_len);
+
+        // A relative branch moved out of .altinstr_replacement must still reach its target
+        if (alt->repl_len == 5 && (repl[0] == OPCODE_CALL_REL32 || repl[0] == OPCODE_JMP_REL32))
+        {
+            int32_t *disp = (int32_t *)(instr + 1);
+            *disp += (int32_t)(repl - instr);
+        }
+        add_nops(instr + alt->repl_len, alt->instr_len - alt->repl_len);
+        patched++;
+    }
+
+    // Serializes, nothing fetched before the writes may still be executed
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+
+    kprintf("Alternatives: %u of %u sites patched\n", patched, total);
+}
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/apic.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Local APIC in xAPIC and x2APIC mode
+ *
+ */
+
+#include <stdint.h>
+#include <asm/apic.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+#include <asm/io.h>
+#include <asm/irq_vectors.h>
+#include <asm/msr.h>
+#include <asm/page.h>
+#include <asm/tsc.h>
+#include <kernel/clockevent.h>
+#include <kernel/interrupt.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/smp.h>
+#include <kernel/time.h>
+#include <kernel/timer.h>
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+
+#define APIC_TIMER_DIVIDE_16 0x3
+#define CALIBRATE_MS 10
+#define ONESHOT_MAX_NS (1000 * NSEC_PER_SEC)
+
+int x2apic_mode;
+volatile uint32_t *apic_mmio;
+uint32_t apic_timer_khz;
+
+static int tsc_deadline_mode;
+
+/* Moves the PIC off the exception vectors, in case it still raises a spurious IRQ, and masks it */
+static void pic_disable()
+{
+    outb(PIC1_COMMAND, 0x11);               // ICW1: init, expect ICW4
+    outb(PIC2_COMMAND, 0x11);
+    outb(PIC1_DATA, ISA_IRQ_VECTOR(0));     // ICW2: vector base
+    outb(PIC2_DATA, ISA_IRQ_VECTOR(8));
+    outb(PIC1_DATA, 0x04);                  // ICW3: slave on IRQ2
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);                  // ICW4: 8086 mode
+    outb(PIC2_DATA, 0x01);
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+void apic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    if (static_cpu_has(X86_FEATURE_X2APIC))
+    {
+        // A single MSR write, no need to wait for the delivery status
+        wrmsr(MSR_X2APIC_BASE + (APIC_ICR_LOW >> 4), ((uint64_t)apic_id << 32) | APIC_ICR_ASSERT | vector);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    while (apic_read(APIC_ICR_LOW) & APIC_ICR_PENDING)
+    {
+        pause();
+    }
+    apic_write(APIC_ICR_HIGH, apic_id << 24);
+    apic_write(APIC_ICR_LOW, APIC_ICR_ASSERT | vector);
+    irq_restore(flags);
+}
+
+static void apic_timer_interrupt(interrupt_frame_t *frame, void *arg)
+{
+    (void)frame;
+    (void)arg;
+    timer_interrupt();
+}
+
+/*
+ * The deadline is an absolute TSC value. It is taken relative to a ktime and TSC pair read now, so it
+ * follows ktime whichever clocksource drives it, and a TSC running at another rate only errs by the delta
+ */
+static void tsc_deadline_set_next(uint64_t expires)
+{
+    uint64_t now = ktime_get_ns();
+    uint64_t tsc = rdtsc();
+    wrmsr(MSR_TSC_DEADLINE, tsc + (expires > now ? ns_to_tsc(expires - now) : 0) + 1);
+}
+
+static void tsc_deadline_stop()
+{
+    wrmsr(MSR_TSC_DEADLINE, 0);
+}
+
+static void apic_oneshot_set_next(uint64_t expires)
+{
+    uint64_t now = ktime_get_ns();
+    uint64_t delta = expires > now ? expires - now : 0;
+    if (delta > ONESHOT_MAX_NS)
+    {
+        delta = ONESHOT_MAX_NS;
+    }
+    // Firing early past the 32-bit count is fine, the timer code reprograms what is left
+    uint64_t count = delta * apic_timer_khz / NSEC_PER_MSEC + 1;
+    apic_write(APIC_TIMER_INITIAL, count > 0xFFFFFFFF ? 0xFFFFFFFF : count);
+}
+
+static void apic_oneshot_stop()
+{
+    apic_write(APIC_TIMER_INITIAL, 0);
+}
+
+static const clock_event_t tsc_deadline_clockevent = {
+    .name = "lapic-deadline",
+    .set_next = tsc_deadline_set_next,
+    .stop = tsc_deadline_stop,
+};
+
+static const clock_event_t apic_oneshot_clockevent = {
+    .name = "lapic-oneshot",
+    .set_next = apic_oneshot_set_next,
+    .stop = apic_oneshot_stop,
+};
+
+static void apic_error_interrupt(interrupt_frame_t *frame, void *arg)
+{
+    (void)frame;
+    (void)arg;
+    apic_write(APIC_ESR, 0);    // Latches the errors into the register
+    kprintf("APIC error %X on cpu %u\n", apic_read(APIC_ESR), cpu_id());
+}
+
+static void spurious_interrupt(interrupt_frame_t *frame, void *arg)
+{
+    (void)frame;
+    (void)arg;
+}
+
+/* Counts LAPIC timer ticks over a TSC-measured interval */
+static void apic_timer_calibrate()
+{
+    apic_write(APIC_TIMER_DIVIDE, APIC_TIMER_DIVIDE_16);
+    apic_write(APIC_LVT_TIMER, APIC_LVT_MASKED | LOCAL_TIMER_VECTOR);
+
+    uint64_t flags = irq_save();
+    uint64_t start = rdtsc();
+    apic_write(APIC_TIMER_INITIAL, 0xFFFFFFFF);
+    while (rdtsc() - start < tsc_khz * CALIBRATE_MS)
+    {
+        pause();
+    }
+    uint32_t elapsed = 0xFFFFFFFF - apic_read(APIC_TIMER_CURRENT);
+    irq_restore(flags);
+
+    apic_write(APIC_TIMER_INITIAL, 0);
+    apic_timer_khz = elapsed / CALIBRATE_MS;
+}
+
+/* Switches the LVT timer to the clock event mode, unarmed */
+static void apic_timer_mode()
+{
+    if (tsc_deadline_mode)
+    {
+        apic_write(APIC_LVT_TIMER, APIC_TIMER_TSC_DEADLINE | LOCAL_TIMER_VECTOR);
+        // Orders the LVT write before any write of the deadline MSR
+        asm volatile("mfence" : : : "memory");
+    }
+    else
+    {
+        apic_write(APIC_LVT_TIMER, APIC_TIMER_ONESHOT | LOCAL_TIMER_VECTOR);
+    }
+}
+
+/* Per-processor part shared by the BSP and the APs */
+static void apic_enable()
+{
+    uint64_t base = rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE;
+    if (x2apic_mode)
+    {
+        base |= APIC_BASE_X2APIC;
+    }
+    wrmsr(MSR_APIC_BASE, base);
+
+    apic_write(APIC_TPR, 0);
+    apic_write(APIC_LVT_LINT0, APIC_LVT_MASKED);
+    apic_write(APIC_LVT_LINT1, APIC_LVT_MASKED);
+    apic_write(APIC_LVT_TIMER, APIC_LVT_MASKED | LOCAL_TIMER_VECTOR);
+    apic_write(APIC_LVT_ERROR, APIC_ERROR_VECTOR);
+    apic_write(APIC_SVR, APIC_SVR_ENABLE | SPURIOUS_APIC_VECTOR);
+    apic_write(APIC_ESR, 0);
+    apic_write(APIC_TIMER_DIVIDE, APIC_TIMER_DIVIDE_16);
+
+    this_cpu()->apic_id = apic_id();
+}
+
+void apic_init()
+{
+    if (!cpu_has(X86_FEATURE_APIC))
+    {
+        panic("No Local APIC\n");
+    }
+
+    pic_disable();
+
+    x2apic_mode = cpu_has(X86_FEATURE_X2APIC);
+    if (!x2apic_mode)
+    {
+        uintptr_t phys = rdmsr(MSR_APIC_BASE) & 0x000FFFFFFFFFF000UL;
+        apic_mmio = ioremap(phys, PAGE_SIZE);
+        if (!apic_mmio)
+        {
+            panic("Cannot map the Local APIC\n");
+        }
+    }
+
+    irq_register(LOCAL_TIMER_VECTOR, apic_timer_interrupt, NULL);
+    irq_register(APIC_ERROR_VECTOR, apic_error_interrupt, NULL);
+    irq_register(SPURIOUS_APIC_VECTOR, spurious_interrupt, NULL);
+
+    apic_enable();
+    apic_timer_calibrate();
+
+    tsc_deadline_mode = cpu_has(X86_FEATURE_TSC_DEADLINE);
+    const clock_event_t *clockevent = tsc_deadline_mode ? &tsc_deadline_clockevent : &apic_oneshot_clockevent;
+    apic_timer_mode();
+    clockevent_register(clockevent);
+    kprintf("APIC: %s mode, timer %u kHz, clock event %s\n", x2apic_mode ? "x2APIC" : "xAPIC",
+        apic_timer_khz * 16, clockevent->name);
+}
+
+void apic_init_ap()
+{
+    apic_enable();
+    apic_timer_mode();
+}
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/cpufeature.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Detection of CPU features
+ *
+ */
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+
+uint32_t cpu_features[CPUID_WORDS];
+
+void cpu_detect()
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0x0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_basic = eax;
+
+    cpuid(0x1, 0, &eax, &ebx, &ecx, &edx);
+    cpu_features[0] = edx;
+    cpu_features[1] = ecx;
+
+    if (max_basic >= 0x7)
+    {
+        cpuid(0x7, 0, &eax, &ebx, &ecx, &edx);
+        cpu_features[5] = ebx;
+        cpu_features[6] = edx;
+    }
+    if (max_basic >= 0xD)
+    {
+        cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        cpu_features[4] = eax;
+    }
+
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_extended = eax;
+    if (max_extended >= 0x80000001)
+    {
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        cpu_features[2] = edx;
+    }
+    if (max_extended >= 0x80000007)
+    {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        cpu_features[3] = edx;
+    }
+
+    if (cpu_has(X86_FEATURE_ERMS) || cpu_has(X86_FEATURE_FSRM))
+    {
+        cpu_features[7] |= 1U << (X86_FEATURE_REP_MOVSB % 32);
+    }
+}
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/fpu.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * FPU, SSE and AVX state of kernel threads
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+#include <asm/fpu.h>
+#include <asm/page.h>
+#include <kernel/buddy.h>
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+#include <kernel/sched.h>
+
+#define FXSAVE_SIZE 512
+#define XSAVE_HEADER_SIZE 64        // Follows the legacy area, XRSTOR faults on non-zero reserved bytes
+
+typedef enum
+{
+    FPU_FXSAVE,
+    FPU_XSAVE,
+    FPU_XSAVEOPT                    // Skips components unmodified since the last XRSTOR from the same area
+} fpu_mode_t;
+
+uint64_t fpu_xfeatures;
+uint32_t fpu_state_size;
+
+static fpu_mode_t fpu_mode;
+static unsigned int fpu_state_order;
+
+/*
+ * Starting state of every section: FCW 0x37F and MXCSR 0x1F80, every other component in its init
+ * configuration (XSTATE_BV is 0). Restoring it rather than running FNINIT also restarts the XSAVEOPT
+ * tracking, which would otherwise still refer to an area restored before the section.
+ */
+static uint8_t fpu_init_state[FXSAVE_SIZE + XSAVE_HEADER_SIZE] __attribute__((aligned(64))) = {
+    [0] = 0x7F, [1] = 0x03,
+    [24] = 0x80, [25] = 0x1F,
+};
+
+static void fpu_save(void *state)
+{
+    switch (fpu_mode)
+    {
+    case FPU_XSAVEOPT:
+        asm volatile("xsaveopt64 [%0]" : : "r"(state), "a"(UINT32_MAX), "d"(UINT32_MAX) : "memory");
+        break;
+
+    case FPU_XSAVE:
+        asm volatile("xsave64 [%0]" : : "r"(state), "a"(UINT32_MAX), "d"(UINT32_MAX) : "memory");
+        break;
+
+    case FPU_FXSAVE:
+        asm volatile("fxsave64 [%0]" : : "r"(state) : "memory");
+        break;
+    }
+}
+
+static void fpu_restore(const void *state)
+{
+    if (fpu_mode == FPU_FXSAVE)
+    {
+        asm volatile("fxrstor64 [%0]" : : "r"(state) : "memory");
+    }
+    else
+    {
+        asm volatile("xrstor64 [%0]" : : "r"(state), "a"(UINT32_MAX), "d"(UINT32_MAX) : "memory");
+    }
+}
+
+/* Page aligned, which covers the 64 bytes XSAVE needs */
+static void *fpu_state_alloc()
+{
+    uintptr_t phys = page_alloc(fpu_state_order);
+    if (!phys)
+    {
+        return NULL;
+    }
+    uint8_t *state = phys_to_virt(phys);
+    for (size_t i = FXSAVE_SIZE; i < FXSAVE_SIZE + XSAVE_HEADER_SIZE; i++)
+    {
+        state[i] = 0;
+    }
+    return state;
+}
+
+void fpu_init_cpu()
+{
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (fpu_mode != FPU_FXSAVE)
+    {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+
+    if (fpu_mode != FPU_FXSAVE)
+    {
+        xsetbv(0, fpu_xfeatures);
+    }
+    fpu_restore(fpu_init_state);
+}
+
+void fpu_init()
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    fpu_mode = FPU_FXSAVE;
+    fpu_xfeatures = XFEATURE_X87 | XFEATURE_SSE;
+    fpu_state_size = FXSAVE_SIZE;
+
+    if (cpu_has(X86_FEATURE_XSAVE))
+    {
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        uint64_t supported = ((uint64_t)edx << 32) | eax;
+        uint64_t wanted = XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX;
+        if ((supported & XFEATURE_AVX512) == XFEATURE_AVX512)
+        {
+            wanted |= XFEATURE_AVX512;
+        }
+        fpu_xfeatures = supported & wanted;
+        fpu_mode = cpu_has(X86_FEATURE_XSAVEOPT) ? FPU_XSAVEOPT : FPU_XSAVE;
+    }
+    fpu_init_cpu();
+
+    if (fpu_mode != FPU_FXSAVE)
+    {
+        // EBX reflects the components enabled in XCR0 right now
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_state_size = ebx;
+    }
+    fpu_state_order = 0;
+    while ((PAGE_SIZE << fpu_state_order) < fpu_state_size)
+    {
+        fpu_state_order++;
+    }
+
+    static const char *const modes[] = {"fxsave", "xsave", "xsaveopt"};
+    kprintf("FPU: %s, xfeatures %#lx, %u bytes of state per thread\n", modes[fpu_mode], fpu_xfeatures,
+        fpu_state_size);
+}
+
+void fpu_switch(thread_t *prev, thread_t *next)
+{
+    if (prev->fpu_depth && prev->fpu_state)
+    {
+        fpu_save(prev->fpu_state);
+    }
+    if (next->fpu_depth)
+    {
+        fpu_restore(next->fpu_state);
+    }
+}
+
+void fpu_release(thread_t *thread)
+{
+    if (thread->fpu_state)
+    {
+        page_free(virt_to_phys(thread->fpu_state), fpu_state_order);
+    }
+}
+
+int kernel_fpu_usable()
+{
+    return !this_cpu()->irq_depth;
+}
+
+void kernel_fpu_begin()
+{
+    if (!kernel_fpu_usable())
+    {
+        panic("kernel_fpu_begin() in interrupt context\n");
+    }
+
+    thread_t *thread = current_thread();
+    if (!thread)
+    {
+        // Boot context, nothing else runs on this processor yet
+        fpu_restore(fpu_init_state);
+        return;
+    }
+    if (thread->fpu_depth)
+    {
+        thread->fpu_depth++;
+        return;
+    }
+
+    if (!thread->fpu_state)
+    {
+        thread->fpu_state = fpu_state_alloc();
+        if (!thread->fpu_state)
+        {
+            // Nowhere to save the registers, the section must not be preempted
+            preempt_disable();
+        }
+    }
+    thread->fpu_depth = 1;
+    asm volatile("" : : : "memory");    // Saved from here on if preempted
+    fpu_restore(fpu_init_state);
+}
+
+void kernel_fpu_end()
+{
+    thread_t *thread = current_thread();
+    if (!thread)
+    {
+        return;
+    }
+    asm volatile("" : : : "memory");
+    if (--thread->fpu_depth == 0 && !thread->fpu_state)
+    {
+        preempt_enable();
+    }
+}
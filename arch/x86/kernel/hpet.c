@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/hpet.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * High Precision Event Timer
+ *
+ */
+
+#include <stdint.h>
+#include <asm/hpet.h>
+#include <kernel/clocksource.h>
+#include <kernel/errno.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/time.h>
+
+#define HPET_CAPABILITIES 0x000
+#define HPET_CONFIG 0x010
+#define HPET_COUNTER 0x0F0
+
+#define HPET_CAP_COUNTER_64 (1UL << 13)
+#define HPET_CONFIG_ENABLE (1UL << 0)
+#define HPET_MAX_PERIOD_FS 100000000UL     // The specification caps the period at 100 ns
+#define FS_PER_NS 1000000UL
+
+uint64_t hpet_period_fs;
+static volatile uint64_t *hpet_regs;
+
+static inline uint64_t hpet_reg_read(unsigned int reg)
+{
+    return hpet_regs[reg / 8];
+}
+
+static inline void hpet_reg_write(unsigned int reg, uint64_t value)
+{
+    hpet_regs[reg / 8] = value;
+}
+
+uint64_t hpet_read_counter()
+{
+    return hpet_reg_read(HPET_COUNTER);
+}
+
+/* An uncached MMIO read per call, so it only wins when the TSC cannot be trusted */
+static clocksource_t hpet_clocksource = {
+    .name = "hpet",
+    .read = hpet_read_counter,
+    .shift = 32,
+    .rating = 250,
+};
+
+int hpet_init(uintptr_t phys)
+{
+    hpet_regs = ioremap(phys, PAGE_SIZE_4K);
+    if (!hpet_regs)
+    {
+        return -ENODEV;
+    }
+
+    uint64_t caps = hpet_reg_read(HPET_CAPABILITIES);
+    uint64_t period = caps >> 32;
+    if (caps == ~0UL || !period || period > HPET_MAX_PERIOD_FS)
+    {
+        hpet_regs = NULL;
+        return -ENODEV;
+    }
+
+    hpet_reg_write(HPET_CONFIG, hpet_reg_read(HPET_CONFIG) | HPET_CONFIG_ENABLE);
+    hpet_period_fs = period;
+
+    hpet_clocksource.mask = caps & HPET_CAP_COUNTER_64 ? ~0UL : 0xFFFFFFFFUL;
+    hpet_clocksource.mult = (period << hpet_clocksource.shift) / FS_PER_NS;
+    kprintf("HPET: %lu kHz, %u-bit counter\n", NSEC_PER_SEC * FS_PER_NS / period / 1000,
+        caps & HPET_CAP_COUNTER_64 ? 64 : 32);
+    clocksource_register(&hpet_clocksource);
+    return 0;
+}
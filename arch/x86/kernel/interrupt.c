@@ -28,42 +28,166 @@
  *
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <asm/apic.h>
+#include <asm/cpu.h>
+#include <asm/irq_vectors.h>
+#include <kernel/errno.h>
 #include <kernel/interrupt.h>
 #include <kernel/kprintf.h>
-#include <kernel/tty.h>
+#include <kernel/panic.h>
+#include <kernel/sched.h>
+#include <kernel/spinlock.h>
+
+#define ISR_STUB_SIZE 16
+#define GATE_INTERRUPT 0x8E     // Present, DPL 0, 64-bit interrupt gate
+
+__attribute__((aligned(0x10))) idt64_entry_t idt[256];
+idtr64_t idtr;
+
+static DEFINE_SPINLOCK(idt_lock);   // Shared by every core, serialises descriptor and handler updates
+static uint16_t kernel_cs;
+
+static struct
+{
+    irq_handler_t handler;
+    void *arg;
+} irq_table[256];
+
+extern char isr_stubs[];    // entry.S
+
+static const char *const exception_names[EXCEPTION_VECTORS] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound range exceeded",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor segment overrun",
+    "Invalid TSS", "Segment not present", "Stack fault", "General protection fault", "Page fault",
+    "Reserved", "x87 floating-point error", "Alignment check", "Machine check", "SIMD floating-point error",
+    "Virtualization exception", "Control protection exception", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Hypervisor injection exception", "VMM communication exception",
+    "Security exception", "Reserved",
+};
 
 void idt64_set_desc(uint8_t vector, void *isr, uint8_t flags)
 {
     idt64_entry_t *descriptor = &idt[vector];
 
+    uint64_t irq_flags = spin_lock_irqsave(&idt_lock);
     descriptor->isr_low = (uint64_t)isr & 0xFFFF;
-    descriptor->kernel_cs = 0x08;
+    descriptor->kernel_cs = kernel_cs;
     descriptor->ist = 0;
     descriptor->attributes = flags;
     descriptor->isr_mid = ((uint64_t)isr >> 16) & 0xFFFF;
     descriptor->isr_high = ((uint64_t)isr >> 32) & 0xFFFFFFFF;
     descriptor->reserved = 0;
+    spin_unlock_irqrestore(&idt_lock, irq_flags);
+}
+
+int irq_register(uint8_t vector, irq_handler_t handler, void *arg)
+{
+    int ret = 0;
+    uint64_t flags = spin_lock_irqsave(&idt_lock);
+    if (irq_table[vector].handler)
+    {
+        ret = -EBUSY;
+    }
+    else
+    {
+        irq_table[vector].arg = arg;
+        __atomic_store_n(&irq_table[vector].handler, handler, __ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&idt_lock, flags);
+    return ret;
 }
 
-struct interrupt_frame;
+int irq_request(irq_handler_t handler, void *arg)
+{
+    for (int vector = IRQ_DYNAMIC_START; vector <= IRQ_DYNAMIC_END; vector++)
+    {
+        if (!__atomic_load_n(&irq_table[vector].handler, __ATOMIC_RELAXED) && !irq_register(vector, handler, arg))
+        {
+            return vector;
+        }
+    }
+    return -ENOSPC;
+}
 
-__attribute__((interrupt)) void exception_handler(struct interrupt_frame *frame, unsigned long int errorcode)
+void irq_free(uint8_t vector)
 {
-    kprintf("An Exception occurs.\n");
-    kprintf("Error Code %0lX\n", errorcode);
-    asm volatile("cli;hlt");
+    uint64_t flags = spin_lock_irqsave(&idt_lock);
+    __atomic_store_n(&irq_table[vector].handler, NULL, __ATOMIC_RELEASE);
+    irq_table[vector].arg = NULL;
+    spin_unlock_irqrestore(&idt_lock, flags);
+}
+
+__attribute__((noreturn)) static void exception_fatal(interrupt_frame_t *frame)
+{
+    kprintf("%s (vector %lu) on cpu %u\n", exception_names[frame->vector], frame->vector, cpu_id());
+    kprintf("Error code %lX  RIP %lX  CS %lX  RFLAGS %lX  RSP %lX\n",
+        frame->error_code, frame->rip, frame->cs, frame->rflags, frame->rsp);
+    if (frame->vector == 14)
+    {
+        kprintf("CR2 %lX\n", read_cr2());
+    }
+    kprintf("RAX %lX  RBX %lX  RCX %lX  RDX %lX\n", frame->rax, frame->rbx, frame->rcx, frame->rdx);
+    kprintf("RSI %lX  RDI %lX  RBP %lX  R8 %lX\n", frame->rsi, frame->rdi, frame->rbp, frame->r8);
+    panic("Unhandled exception\n");
+}
+
+void interrupt_dispatch(interrupt_frame_t *frame)
+{
+    uint8_t vector = frame->vector;
+    irq_handler_t handler = __atomic_load_n(&irq_table[vector].handler, __ATOMIC_ACQUIRE);
+    cpu_t *cpu = this_cpu();
+
+    if (vector < EXCEPTION_VECTORS)
+    {
+        if (!handler)
+        {
+            exception_fatal(frame);
+        }
+        cpu->irq_depth++;
+        handler(frame, irq_table[vector].arg);
+        cpu->irq_depth--;
+        return;
+    }
+
+    cpu->irq_depth++;
+    if (handler)
+    {
+        handler(frame, irq_table[vector].arg);
+    }
+    else
+    {
+        kprintf("Unexpected interrupt %u on cpu %u\n", vector, cpu_id());
+    }
+    if (vector != SPURIOUS_APIC_VECTOR)
+    {
+        apic_eoi();
+    }
+    cpu->irq_depth--;
+
+    // Preempt only what ran with interrupts enabled, which cannot be holding a lock
+    if ((frame->rflags & RFLAGS_IF) && cpu->need_resched && cpu->current && !cpu->preempt_count)
+    {
+        schedule();
+    }
 }
 
 void interrupt_init()
 {
     idtr.base = (uintptr_t)&idt[0];
     idtr.limit = (uint16_t)sizeof(idt64_entry_t) * 256 - 1;
+    kernel_cs = read_cs();
 
-    for (uint8_t vector = 0; vector < 32; vector++)
+    for (int vector = 0; vector < 256; vector++)
     {
-        idt64_set_desc(vector, *exception_handler, 0x8F);
+        idt64_set_desc(vector, isr_stubs + vector * ISR_STUB_SIZE, GATE_INTERRUPT);
     }
 
+    interrupt_load();
+}
+
+void interrupt_load()
+{
     asm volatile("lidt %0" : : "m"(idtr)); // load the new IDT
-}
\ No newline at end of file
+}
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/ioapic.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * I/O APIC routing of external interrupts
+ *
+ */
+
+#include <stdint.h>
+#include <asm/ioapic.h>
+#include <kernel/errno.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/spinlock.h>
+
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+
+#define IOAPIC_REG_ID 0x00
+#define IOAPIC_REG_VERSION 0x01
+#define IOAPIC_REG_REDTBL(n) (0x10 + 2 * (n))
+
+typedef struct
+{
+    volatile uint32_t *mmio;
+    uint32_t gsi_base;
+    uint32_t count;             // Redirection entries
+} ioapic_t;
+
+static ioapic_t ioapics[MAX_IOAPICS];
+static unsigned int ioapic_count;
+static DEFINE_SPINLOCK(ioapic_lock);   // Register access goes through a select/window pair
+
+/* ISA IRQs are identity mapped, edge triggered and active high unless ACPI says otherwise */
+static struct
+{
+    uint32_t gsi;
+    uint32_t flags;
+} isa_irqs[ISA_IRQS] = {
+    {0, 0}, {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0}, {6, 0}, {7, 0},
+    {8, 0}, {9, 0}, {10, 0}, {11, 0}, {12, 0}, {13, 0}, {14, 0}, {15, 0},
+};
+
+static uint32_t ioapic_read(ioapic_t *ioapic, uint32_t reg)
+{
+    ioapic->mmio[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->mmio[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t *ioapic, uint32_t reg, uint32_t value)
+{
+    ioapic->mmio[IOAPIC_REGSEL / 4] = reg;
+    ioapic->mmio[IOAPIC_WINDOW / 4] = value;
+}
+
+static ioapic_t *ioapic_for(uint32_t gsi)
+{
+    for (unsigned int i = 0; i < ioapic_count; i++)
+    {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].count)
+        {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+int ioapic_init(uintptr_t phys, uint32_t gsi_base)
+{
+    if (ioapic_count == MAX_IOAPICS)
+    {
+        return -ENOSPC;
+    }
+    volatile uint32_t *mmio = ioremap(phys, PAGE_SIZE_4K);
+    if (!mmio)
+    {
+        return -ENODEV;
+    }
+
+    ioapic_t *ioapic = &ioapics[ioapic_count];
+    ioapic->mmio = mmio;
+    ioapic->gsi_base = gsi_base;
+    uint32_t version = ioapic_read(ioapic, IOAPIC_REG_VERSION);
+    if (version == 0xFFFFFFFF)
+    {
+        return -ENODEV;         // Nothing decodes the address
+    }
+    ioapic->count = ((version >> 16) & 0xFF) + 1;
+
+    for (uint32_t i = 0; i < ioapic->count; i++)
+    {
+        ioapic_write(ioapic, IOAPIC_REG_REDTBL(i), IOAPIC_MASKED);
+        ioapic_write(ioapic, IOAPIC_REG_REDTBL(i) + 1, 0);
+    }
+    ioapic_count++;
+
+    kprintf("I/O APIC: id %u, GSI %u ~ %u\n", ioapic_read(ioapic, IOAPIC_REG_ID) >> 24, gsi_base,
+        gsi_base + ioapic->count - 1);
+    return 0;
+}
+
+void ioapic_set_isa_override(uint8_t irq, uint32_t gsi, uint32_t flags)
+{
+    if (irq < ISA_IRQS)
+    {
+        isa_irqs[irq].gsi = gsi;
+        isa_irqs[irq].flags = flags;
+    }
+}
+
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t apic_id, uint32_t flags)
+{
+    ioapic_t *ioapic = ioapic_for(gsi);
+    if (!ioapic)
+    {
+        return -EINVAL;
+    }
+
+    // Fixed delivery, physical destination. The low half goes last, it unmasks the input
+    uint32_t pin = gsi - ioapic->gsi_base;
+    uint64_t irq = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(ioapic, IOAPIC_REG_REDTBL(pin) + 1, apic_id << 24);
+    ioapic_write(ioapic, IOAPIC_REG_REDTBL(pin), vector | (flags & (IOAPIC_ACTIVE_LOW | IOAPIC_LEVEL)));
+    spin_unlock_irqrestore(&ioapic_lock, irq);
+    return 0;
+}
+
+int ioapic_route_isa(uint8_t irq, uint8_t vector, uint32_t apic_id)
+{
+    if (irq >= ISA_IRQS)
+    {
+        return -EINVAL;
+    }
+    return ioapic_route(isa_irqs[irq].gsi, vector, apic_id, isa_irqs[irq].flags);
+}
+
+void ioapic_mask(uint32_t gsi)
+{
+    ioapic_t *ioapic = ioapic_for(gsi);
+    if (!ioapic)
+    {
+        return;
+    }
+    uint32_t pin = gsi - ioapic->gsi_base;
+    uint64_t irq = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(ioapic, IOAPIC_REG_REDTBL(pin), ioapic_read(ioapic, IOAPIC_REG_REDTBL(pin)) | IOAPIC_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, irq);
+}
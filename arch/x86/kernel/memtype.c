@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/memtype.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Memory types of mappings through the PAT and MTRRs
+ *
+ */
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+#include <asm/memtype.h>
+#include <asm/msr.h>
+#include <kernel/paging.h>
+
+#define PAT_ENTRY(index, type) ((uint64_t)(type) << ((index) * 8))
+
+/*
+ * Entry 1 becomes WC and entry 7 WT, the rest keep their power-on types so entries the loader set up
+ * with PCD or PWT still mean UC- and UC
+ */
+#define PAT_VALUE (PAT_ENTRY(0, MEMTYPE_WB) | PAT_ENTRY(1, MEMTYPE_WC) | PAT_ENTRY(2, MEMTYPE_UC_MINUS) | \
+    PAT_ENTRY(3, MEMTYPE_UC) | PAT_ENTRY(4, MEMTYPE_WB) | PAT_ENTRY(5, MEMTYPE_WP) |                       \
+    PAT_ENTRY(6, MEMTYPE_UC_MINUS) | PAT_ENTRY(7, MEMTYPE_WT))
+
+#define MTRRCAP_VCNT 0xFF
+#define MTRR_DEF_TYPE_E (1 << 11)
+#define MTRR_DEF_TYPE_FE (1 << 10)
+#define MTRR_PHYSMASK_V (1 << 11)
+#define MTRR_FIXED_END 0x100000         // Fixed range MTRRs cover the first MiB
+
+void pat_init()
+{
+    if (cpu_has(X86_FEATURE_PAT))
+    {
+        wrmsr(MSR_PAT, PAT_VALUE);
+    }
+}
+
+uint64_t memtype_flags(enum memtype type)
+{
+    int pat = cpu_has(X86_FEATURE_PAT);
+    switch (type)
+    {
+    case MEMTYPE_WB:
+        return 0;
+
+    case MEMTYPE_WC:
+        return pat ? PWT : PCD;                 // UC- lets a WC MTRR through
+
+    case MEMTYPE_UC_MINUS:
+        return PCD;
+
+    case MEMTYPE_WT:
+        return pat ? PTE_PAT_4K | PCD | PWT : PWT;
+
+    case MEMTYPE_WP:
+        return pat ? PTE_PAT_4K | PWT : PCD | PWT;
+
+    default:
+    case MEMTYPE_UC:
+        return PCD | PWT;
+    }
+}
+
+enum memtype mtrr_type(uintptr_t phys)
+{
+    if (!cpu_has(X86_FEATURE_MTRR))
+    {
+        return MEMTYPE_UC;
+    }
+    uint64_t def = rdmsr(MSR_MTRR_DEF_TYPE);
+    if (!(def & MTRR_DEF_TYPE_E))
+    {
+        return MEMTYPE_UC;
+    }
+    if (phys < MTRR_FIXED_END && (def & MTRR_DEF_TYPE_FE))
+    {
+        return MEMTYPE_UC;              // Firmware areas, not worth decoding the fixed ranges
+    }
+
+    // Overlapping ranges resolve to UC if any is UC, else WT over WB, other mixes are undefined
+    int matched = 0;
+    enum memtype type = MEMTYPE_WB;
+    unsigned int count = rdmsr(MSR_MTRRCAP) & MTRRCAP_VCNT;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        uint64_t mask = rdmsr(MSR_MTRR_PHYSMASK(i));
+        if (!(mask & MTRR_PHYSMASK_V))
+        {
+            continue;
+        }
+        uint64_t base = rdmsr(MSR_MTRR_PHYSBASE(i));
+        mask &= PTE_ADDR_MASK;
+        if ((phys & mask) != (base & mask & PTE_ADDR_MASK))
+        {
+            continue;
+        }
+        enum memtype range = base & 0xFF;
+        if (range == MEMTYPE_UC)
+        {
+            return MEMTYPE_UC;
+        }
+        if (!matched || range == MEMTYPE_WT)
+        {
+            type = range;
+        }
+        matched = 1;
+    }
+    return matched ? type : (enum memtype)(def & 0xFF);
+}
+
+const char *memtype_name(enum memtype type)
+{
+    switch (type)
+    {
+    case MEMTYPE_UC:
+        return "UC";
+
+    case MEMTYPE_WC:
+        return "WC";
+
+    case MEMTYPE_WT:
+        return "WT";
+
+    case MEMTYPE_WP:
+        return "WP";
+
+    case MEMTYPE_WB:
+        return "WB";
+
+    case MEMTYPE_UC_MINUS:
+        return "UC-";
+
+    default:
+        return "?";
+    }
+}
@@ -0,0 +1,514 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/paging.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Management of kernel page tables and the direct map of physical memory
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/apic.h>
+#include <asm/cpufeature.h>
+#include <asm/irq_vectors.h>
+#include <asm/msr.h>
+#include <asm/page.h>
+#include <boot/bootboot.h>
+#include <kernel/buddy.h>
+#include <kernel/errno.h>
+#include <kernel/interrupt.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+
+#define EFER_NXE (1UL << 11)
+#define CR4_PGE (1UL << 7)
+
+#define IOREMAP_BASE 0xFFFFC00000000000UL   // Window for device mappings
+#define IOREMAP_END 0xFFFFC10000000000UL
+
+#define TLB_FLUSH_ALL_THRESHOLD (64 * PAGE_SIZE_4K)
+
+extern BOOTBOOT bootboot;   // Infomation provided by BOOTBOOT Loader
+
+uintptr_t direct_map_offset;
+
+static uintptr_t kernel_pml4;   // Physical address of the kernel PML4
+static uint64_t xd_mask;        // PTE_XD if the CPU supports it
+static DEFINE_SPINLOCK(paging_lock);
+static uintptr_t ioremap_next = IOREMAP_BASE;
+
+/* The range being shot down, one request at a time under shootdown_lock */
+static DEFINE_SPINLOCK(shootdown_lock);
+static uintptr_t shootdown_virt;
+static size_t shootdown_size;
+static uint64_t shootdown_seq;                  // Bumped once the range above is set
+static uint32_t shootdown_pending;              // Processors yet to flush it
+static uint64_t shootdown_done[MAX_CPUS];       // Last request each processor flushed
+
+static inline unsigned int pt_index(uintptr_t virt, int level)
+{
+    return (virt >> (PAGE_SHIFT + 9 * (level - 1))) & 0x1FF;
+}
+
+/* Size of the region mapped by one entry of a level 1 (PT) ~ 4 (PML4) table */
+static inline uintptr_t level_size(int level)
+{
+    return 1UL << (PAGE_SHIFT + 9 * (level - 1));
+}
+
+static inline uint64_t *table_virt(uint64_t entry)
+{
+    return phys_to_virt(entry & PTE_ADDR_MASK);
+}
+
+static uintptr_t table_alloc()
+{
+    uintptr_t phys = page_alloc(0);
+    if (phys)
+    {
+        uint64_t *table = phys_to_virt(phys);
+        for (int i = 0; i < 512; i++)
+        {
+            table[i] = 0;
+        }
+    }
+    return phys;
+}
+
+static void tlb_flush_all()
+{
+    uint64_t cr4 = read_cr4();
+    if (cr4 & CR4_PGE)
+    {
+        // Toggling PGE drops global entries as well
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    }
+    else
+    {
+        write_cr3(read_cr3());
+    }
+}
+
+static void tlb_flush_range(uintptr_t virt, size_t size)
+{
+    if (size > TLB_FLUSH_ALL_THRESHOLD)
+    {
+        tlb_flush_all();
+        return;
+    }
+    for (uintptr_t addr = virt; addr < virt + size; addr += PAGE_SIZE_4K)
+    {
+        invlpg(addr);
+    }
+}
+
+/* Flushes the current shootdown request on the calling processor unless it already has */
+static void shootdown_flush()
+{
+    uint64_t seq = __atomic_load_n(&shootdown_seq, __ATOMIC_ACQUIRE);
+    unsigned int id = cpu_id();
+    if (shootdown_done[id] == seq)
+    {
+        return;
+    }
+    shootdown_done[id] = seq;
+    tlb_flush_range(shootdown_virt, shootdown_size);
+    __atomic_sub_fetch(&shootdown_pending, 1, __ATOMIC_RELEASE);
+}
+
+static void shootdown_interrupt(interrupt_frame_t *frame, void *arg)
+{
+    (void)frame;
+    (void)arg;
+    shootdown_flush();
+}
+
+/*
+ * Makes every other processor drop its translations for the range and waits until they have.
+ * Waiting for shootdown_lock keeps answering the request in flight, so two processors shooting
+ * down at once with interrupts disabled don't wait on each other
+ */
+static void tlb_shootdown(uintptr_t virt, size_t size)
+{
+    if (cpu_count() == 1 || !smp_ready())
+    {
+        return;
+    }
+
+    uint64_t irq = irq_save();
+    while (!spin_trylock(&shootdown_lock))
+    {
+        if (__atomic_load_n(&shootdown_pending, __ATOMIC_ACQUIRE))
+        {
+            shootdown_flush();
+        }
+        pause();
+    }
+
+    unsigned int self = cpu_id();
+    uint64_t seq = shootdown_seq + 1;
+    shootdown_virt = virt;
+    shootdown_size = size;
+    shootdown_done[self] = seq;
+    __atomic_store_n(&shootdown_pending, cpu_count() - 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&shootdown_seq, seq, __ATOMIC_RELEASE);
+    for (unsigned int id = 0; id < cpu_count(); id++)
+    {
+        if (id != self)
+        {
+            apic_send_ipi(cpus[id]->apic_id, TLB_SHOOTDOWN_VECTOR);
+        }
+    }
+    while (__atomic_load_n(&shootdown_pending, __ATOMIC_ACQUIRE))
+    {
+        pause();
+    }
+
+    spin_unlock(&shootdown_lock);
+    irq_restore(irq);
+}
+
+/* Replaces a huge page at level with a table of smaller pages mapping the same range */
+static int split(uint64_t *entry, int level, uintptr_t virt)
+{
+    uintptr_t phys = table_alloc();
+    if (!phys)
+    {
+        return -ENOMEM;
+    }
+
+    uint64_t *table = phys_to_virt(phys);
+    uintptr_t base = *entry & PTE_ADDR_MASK & ~(level_size(level) - 1);
+    uint64_t attrs = *entry & ~PTE_ADDR_MASK & ~(uint64_t)PS;
+    if (level - 1 > 1)
+    {
+        attrs |= PS | (*entry & PAT);
+    }
+    else if (*entry & PAT)
+    {
+        attrs |= PTE_PAT_4K;
+    }
+    for (int i = 0; i < 512; i++)
+    {
+        table[i] = (base + i * level_size(level - 1)) | attrs;
+    }
+
+    *entry = phys | P | RW | (*entry & US);
+    tlb_flush_range(virt & ~(level_size(level) - 1), level_size(level));
+    return 0;
+}
+
+/* Returns the entry at level for virt, creating tables and splitting huge pages on the way if alloc */
+static uint64_t *walk(uintptr_t virt, int level, int alloc, uint64_t table_flags)
+{
+    uint64_t *table = phys_to_virt(kernel_pml4);
+    for (int current = 4; current > level; current--)
+    {
+        uint64_t *entry = &table[pt_index(virt, current)];
+        if (!(*entry & P))
+        {
+            uintptr_t phys = alloc ? table_alloc() : 0;
+            if (!phys)
+            {
+                return NULL;
+            }
+            *entry = phys | P | RW | table_flags;
+        }
+        else if (*entry & PS)
+        {
+            if (!alloc || split(entry, current, virt) < 0)
+            {
+                return NULL;
+            }
+        }
+        *entry |= table_flags;
+        table = table_virt(*entry);
+    }
+    return &table[pt_index(virt, level)];
+}
+
+int paging_map(uintptr_t virt, uintptr_t phys, size_t size, uint64_t flags)
+{
+    if ((virt | phys | size) & ~PAGE_MASK)
+    {
+        return -EINVAL;
+    }
+    flags &= (0xFFF | PTE_XD) & ~(uint64_t)P;
+    flags &= ~PTE_XD | xd_mask;
+
+    int ret = 0;
+    uintptr_t flush_start = virt;
+    uintptr_t flush_end = virt;     // Range where present entries were replaced
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    while (size)
+    {
+        int level = 1;
+        if (cpu_has(X86_FEATURE_PDPE1GB) && !((virt | phys) & (PAGE_SIZE_1G - 1)) && size >= PAGE_SIZE_1G)
+        {
+            level = 3;
+        }
+        else if (!((virt | phys) & (PAGE_SIZE_2M - 1)) && size >= PAGE_SIZE_2M)
+        {
+            level = 2;
+        }
+
+        uint64_t *entry;
+        for (;;)
+        {
+            entry = walk(virt, level, 1, flags & US);
+            if (!entry || level == 1 || !(*entry & P) || (*entry & PS))
+            {
+                break;
+            }
+            level--;    // A page table already hangs here, map inside it
+        }
+        if (!entry)
+        {
+            ret = -ENOMEM;
+            break;
+        }
+
+        uint64_t old = *entry;
+        uint64_t leaf = flags;
+        if (level > 1)
+        {
+            leaf = (leaf & ~PTE_PAT_4K) | PS | (leaf & PTE_PAT_4K ? PAT : 0);
+        }
+        *entry = phys | leaf | P;
+        if (old & P)
+        {
+            tlb_flush_range(virt, level_size(level));
+            flush_end = virt + level_size(level);
+        }
+        else if (flush_end == flush_start)
+        {
+            flush_start = flush_end = virt + level_size(level);
+        }
+
+        virt += level_size(level);
+        phys += level_size(level);
+        size -= level_size(level);
+    }
+    spin_unlock_irqrestore(&paging_lock, irq);
+    if (flush_end != flush_start)
+    {
+        tlb_shootdown(flush_start, flush_end - flush_start);
+    }
+    return ret;
+}
+
+/* Bits of a 4 KiB entry moved to where a huge page entry keeps them */
+static inline uint64_t huge_flags(uint64_t flags)
+{
+    return (flags & ~PTE_PAT_4K) | (flags & PTE_PAT_4K ? PAT : 0);
+}
+
+/*
+ * Unmaps, or replaces the bits in clear with set (4 KiB entry layout) in every page of the range,
+ * splitting huge pages that straddle its ends
+ */
+static int paging_update(uintptr_t virt, size_t size, uint64_t set, uint64_t clear, int unmap)
+{
+    if ((virt | size) & ~PAGE_MASK)
+    {
+        return -EINVAL;
+    }
+
+    int ret = 0;
+    uintptr_t start = virt;
+    size_t total = size;
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    while (size)
+    {
+        uint64_t *table = phys_to_virt(kernel_pml4);
+        uint64_t *entry;
+        int level = 4;
+        for (;;)
+        {
+            entry = &table[pt_index(virt, level)];
+            if (!(*entry & P) || level == 1 || (*entry & PS))
+            {
+                break;
+            }
+            table = table_virt(*entry);
+            level--;
+        }
+
+        uintptr_t span = level_size(level);
+        uintptr_t step = span - (virt & (span - 1));
+        if (*entry & P)
+        {
+            if (step != span || step > size)
+            {
+                if ((ret = split(entry, level, virt)) < 0)
+                {
+                    break;
+                }
+                continue;
+            }
+            if (unmap)
+            {
+                *entry = 0;
+            }
+            else if (level > 1)
+            {
+                *entry = (*entry & ~huge_flags(clear)) | huge_flags(set);
+            }
+            else
+            {
+                *entry = (*entry & ~clear) | set;
+            }
+        }
+        if (step >= size)
+        {
+            break;
+        }
+        virt += step;
+        size -= step;
+    }
+    tlb_flush_range(start, total);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    tlb_shootdown(start, total);
+    return ret;
+}
+
+int paging_unmap(uintptr_t virt, size_t size)
+{
+    return paging_update(virt, size, 0, 0, 1);
+}
+
+int paging_protect(uintptr_t virt, size_t size, uint64_t flags)
+{
+    return paging_update(virt, size, flags & PTE_PROT_MASK & (~PTE_XD | xd_mask), PTE_PROT_MASK, 0);
+}
+
+int paging_set_memtype(uintptr_t virt, size_t size, enum memtype type)
+{
+    return paging_update(virt, size, memtype_flags(type), PTE_MEMTYPE_MASK, 0);
+}
+
+int paging_translate(uintptr_t virt, uintptr_t *phys)
+{
+    uint64_t *table = phys_to_virt(kernel_pml4);
+    for (int level = 4; level >= 1; level--)
+    {
+        uint64_t entry = table[pt_index(virt, level)];
+        if (!(entry & P))
+        {
+            return -EFAULT;
+        }
+        if (level == 1 || (entry & PS))
+        {
+            uintptr_t span = level_size(level);
+            *phys = (entry & PTE_ADDR_MASK & ~(span - 1)) | (virt & (span - 1));
+            return 0;
+        }
+        table = table_virt(entry);
+    }
+    return -EFAULT;
+}
+
+void *ioremap_cache(uintptr_t phys, size_t size, enum memtype type)
+{
+    uintptr_t offset = phys & ~PAGE_MASK;
+    size = PAGE_ALIGN(size + offset);
+
+    uintptr_t virt = __atomic_fetch_add(&ioremap_next, size, __ATOMIC_RELAXED);
+    if (virt + size > IOREMAP_END)
+    {
+        return NULL;
+    }
+    if (paging_map(virt, phys - offset, size, RW | memtype_flags(type) | G | PTE_XD) < 0)
+    {
+        return NULL;
+    }
+    return (void *)(virt + offset);
+}
+
+static void paging_enable_features()
+{
+    pat_init();
+    if (cpu_has(X86_FEATURE_NX))
+    {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+        xd_mask = PTE_XD;
+    }
+    if (cpu_has(X86_FEATURE_PGE))
+    {
+        write_cr4(read_cr4() | CR4_PGE);
+    }
+}
+
+void paging_init_ap()
+{
+    paging_enable_features();
+    write_cr3(kernel_pml4);
+}
+
+void paging_init()
+{
+    paging_enable_features();
+
+    kernel_pml4 = table_alloc();
+    if (!kernel_pml4)
+    {
+        panic("Out of memory allocating the kernel PML4\n");
+    }
+
+    // The kernel, framebuffer and core stacks stay on the loader's tables at the top of the address space
+    uint64_t *boot_pml4 = phys_to_virt(read_cr3() & PTE_ADDR_MASK);
+    uint64_t *pml4 = phys_to_virt(kernel_pml4);
+    for (int i = 256; i < 512; i++)
+    {
+        pml4[i] = boot_pml4[i];
+    }
+
+    // Map everything up to the end of RAM, at least the first 4 GiB where firmware tables and devices live
+    uint64_t top = 0x100000000UL;
+    MMapEnt *mmap_end = (MMapEnt *)((uint8_t *)&bootboot + bootboot.size);
+    for (MMapEnt *ent = &bootboot.mmap; ent < mmap_end; ent++)
+    {
+        if (MMapEnt_Type(ent) != MMAP_MMIO && MMapEnt_Ptr(ent) + MMapEnt_Size(ent) > top)
+        {
+            top = MMapEnt_Ptr(ent) + MMapEnt_Size(ent);
+        }
+    }
+    top = (top + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+    if (paging_map(PAGE_OFFSET, 0, top, RW | G | PTE_XD) < 0)
+    {
+        panic("Out of memory building the direct map\n");
+    }
+
+    write_cr3(kernel_pml4);
+    direct_map_offset = PAGE_OFFSET;
+    irq_register(TLB_SHOOTDOWN_VECTOR, shootdown_interrupt, NULL);
+
+    kprintf("Direct map: %lu MiB with %s pages\n", top >> 20, cpu_has(X86_FEATURE_PDPE1GB) ? "1 GiB" : "2 MiB");
+}
@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/pci.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * PCI configuration space access and device enumeration
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/io.h>
+#include <asm/irq_vectors.h>
+#include <kernel/acpi.h>
+#include <kernel/errno.h>
+#include <kernel/interrupt.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/pci.h>
+#include <kernel/spinlock.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+/* MSI-X capability */
+#define PCI_MSIX_FLAGS 2
+#define PCI_MSIX_TABLE 4
+#define PCI_MSIX_FLAGS_ENABLE 0x8000
+#define PCI_MSIX_FLAGS_MASKALL 0x4000
+#define PCI_MSIX_FLAGS_QSIZE 0x07FF
+#define PCI_MSIX_BIR 0x7
+
+/* MSI-X table entry, in dwords */
+#define MSIX_ENTRY_DWORDS 4
+#define MSIX_ADDR_LO 0
+#define MSIX_ADDR_HI 1
+#define MSIX_DATA 2
+#define MSIX_CTRL 3
+#define MSIX_CTRL_MASKED 1
+
+#define MSI_ADDRESS_BASE 0xFEE00000U    // Fixed delivery, physical destination in bits 12 ~ 19
+
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static unsigned int pci_device_count;
+static DEFINE_SPINLOCK(pci_config_lock);   // Port accesses go through an address/data pair
+
+/* Segment 0 of the MCFG table, the only one enumerated */
+static volatile uint8_t *ecam;
+static uint8_t ecam_start_bus, ecam_end_bus;
+
+static volatile uint8_t *ecam_function(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    if (!ecam || bus < ecam_start_bus || bus > ecam_end_bus)
+    {
+        return NULL;
+    }
+    return ecam + (((uintptr_t)(bus - ecam_start_bus) << 20) | (slot << 15) | (func << 12));
+}
+
+/* Configuration mechanism #1, reaches the first 256 bytes of each function */
+static uint32_t config_address(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset)
+{
+    return 0x80000000U | (bus << 16) | (slot << 11) | (func << 8) | (offset & 0xFC);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset)
+{
+    volatile uint8_t *config = ecam_function(bus, slot, func);
+    if (config)
+    {
+        return *(volatile uint32_t *)(config + (offset & ~3));
+    }
+    if (offset >= 256)
+    {
+        return 0xFFFFFFFF;
+    }
+    uint64_t irq = spin_lock_irqsave(&pci_config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, func, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_config_lock, irq);
+    return value;
+}
+
+uint32_t pci_read32(pci_device_t *dev, uint16_t offset)
+{
+    if (dev->config)
+    {
+        return *(volatile uint32_t *)(dev->config + (offset & ~3));
+    }
+    return config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+uint16_t pci_read16(pci_device_t *dev, uint16_t offset)
+{
+    return pci_read32(dev, offset) >> ((offset & 2) * 8);
+}
+
+uint8_t pci_read8(pci_device_t *dev, uint16_t offset)
+{
+    return pci_read32(dev, offset) >> ((offset & 3) * 8);
+}
+
+/* Writes of 1, 2 or 4 bytes. Narrow ones must not write back neighbouring write-1-to-clear bits */
+static void config_write(pci_device_t *dev, uint16_t offset, uint32_t value, int size)
+{
+    if (dev->config)
+    {
+        volatile uint8_t *reg = dev->config + offset;
+        if (size == 4)
+        {
+            *(volatile uint32_t *)reg = value;
+        }
+        else if (size == 2)
+        {
+            *(volatile uint16_t *)reg = value;
+        }
+        else
+        {
+            *reg = value;
+        }
+        return;
+    }
+    if (offset >= 256)
+    {
+        return;
+    }
+
+    uint64_t irq = spin_lock_irqsave(&pci_config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(dev->bus, dev->slot, dev->func, offset));
+    uint16_t port = PCI_CONFIG_DATA + (offset & 3);
+    if (size == 4)
+    {
+        outl(port, value);
+    }
+    else if (size == 2)
+    {
+        outw(port, value);
+    }
+    else
+    {
+        outb(port, value);
+    }
+    spin_unlock_irqrestore(&pci_config_lock, irq);
+}
+
+void pci_write32(pci_device_t *dev, uint16_t offset, uint32_t value)
+{
+    config_write(dev, offset, value, 4);
+}
+
+void pci_write16(pci_device_t *dev, uint16_t offset, uint16_t value)
+{
+    config_write(dev, offset, value, 2);
+}
+
+void pci_write8(pci_device_t *dev, uint16_t offset, uint8_t value)
+{
+    config_write(dev, offset, value, 1);
+}
+
+/* Writing all ones to a BAR reads back its size as the cleared low bits */
+static void pci_size_bars(pci_device_t *dev)
+{
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+    pci_write16(dev, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (unsigned int n = 0; n < PCI_BARS; n++)
+    {
+        pci_bar_t *bar = &dev->bars[n];
+        uint32_t orig = pci_read32(dev, PCI_BAR(n));
+        pci_write32(dev, PCI_BAR(n), 0xFFFFFFFF);
+        uint32_t mask = pci_read32(dev, PCI_BAR(n));
+        pci_write32(dev, PCI_BAR(n), orig);
+        if (!mask)
+        {
+            continue;
+        }
+
+        if (orig & PCI_BAR_IO)
+        {
+            bar->io = 1;
+            bar->base = orig & ~3U;
+            bar->size = (uint16_t)(~(mask & ~3U) + 1);
+            continue;
+        }
+
+        uint64_t mask64 = 0xFFFFFFFF00000000UL | (mask & ~0xFU);
+        bar->base = orig & ~0xFU;
+        bar->prefetch = !!(orig & PCI_BAR_PREFETCH);
+        if ((orig & 0x6) == PCI_BAR_MEM_64 && n + 1 < PCI_BARS)
+        {
+            uint32_t orig_high = pci_read32(dev, PCI_BAR(n + 1));
+            pci_write32(dev, PCI_BAR(n + 1), 0xFFFFFFFF);
+            uint32_t mask_high = pci_read32(dev, PCI_BAR(n + 1));
+            pci_write32(dev, PCI_BAR(n + 1), orig_high);
+            mask64 = ((uint64_t)mask_high << 32) | (mask & ~0xFU);
+            bar->base |= (uint64_t)orig_high << 32;
+            bar->is64 = 1;
+            n++;
+        }
+        bar->size = ~mask64 + 1;
+    }
+    pci_write16(dev, PCI_COMMAND, command);
+}
+
+static void pci_add(uint8_t bus, uint8_t slot, uint8_t func)
+{
+    if (pci_device_count == PCI_MAX_DEVICES)
+    {
+        return;
+    }
+    pci_device_t *dev = &pci_devices[pci_device_count++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->config = ecam_function(bus, slot, func);
+    uint32_t id = pci_read32(dev, PCI_VENDOR_ID);
+    dev->vendor = id & 0xFFFF;
+    dev->device = id >> 16;
+    uint32_t class = pci_read32(dev, PCI_REVISION);
+    dev->class = class >> 24;
+    dev->subclass = class >> 16;
+    dev->prog_if = class >> 8;
+    if ((pci_read8(dev, PCI_HEADER_TYPE) & ~PCI_HEADER_MULTIFUNC) == 0)
+    {
+        pci_size_bars(dev);
+    }
+    kprintf("PCI: %02x:%02x.%u %04x:%04x class %02x%02x\n", bus, slot, func, dev->vendor, dev->device,
+        dev->class, dev->subclass);
+}
+
+static void pci_ecam_init()
+{
+    acpi_mcfg_t *mcfg = (acpi_mcfg_t *)acpi_find_table("MCFG", 0);
+    if (!mcfg)
+    {
+        return;
+    }
+    size_t count = (mcfg->header.length - sizeof(acpi_mcfg_t)) / sizeof(acpi_mcfg_entry_t);
+    for (size_t i = 0; i < count; i++)
+    {
+        acpi_mcfg_entry_t *entry = &mcfg->entries[i];
+        if (entry->segment != 0 || entry->end_bus < entry->start_bus)
+        {
+            continue;
+        }
+        // The table gives the address of bus 0, the window begins at its first bus
+        uintptr_t base = entry->base + ((uintptr_t)entry->start_bus << 20);
+        size_t size = (size_t)(entry->end_bus - entry->start_bus + 1) << 20;
+        ecam = ioremap(base, size);
+        if (ecam)
+        {
+            ecam_start_bus = entry->start_bus;
+            ecam_end_bus = entry->end_bus;
+            kprintf("PCI: ECAM at %#lx, buses %u ~ %u\n", base, ecam_start_bus, ecam_end_bus);
+        }
+        return;
+    }
+}
+
+void pci_init()
+{
+    pci_ecam_init();
+    for (unsigned int bus = 0; bus < 256; bus++)
+    {
+        for (uint8_t slot = 0; slot < 32; slot++)
+        {
+            if ((config_read(bus, slot, 0, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF)
+            {
+                continue;
+            }
+            uint8_t header = config_read(bus, slot, 0, PCI_HEADER_TYPE) >> 16;
+            uint8_t funcs = header & PCI_HEADER_MULTIFUNC ? 8 : 1;
+            for (uint8_t func = 0; func < funcs; func++)
+            {
+                if ((config_read(bus, slot, func, PCI_VENDOR_ID) & 0xFFFF) != 0xFFFF)
+                {
+                    pci_add(bus, slot, func);
+                }
+            }
+        }
+    }
+}
+
+pci_device_t *pci_find(uint16_t vendor, uint16_t device, pci_device_t *from)
+{
+    size_t i = from ? (size_t)(from - pci_devices) + 1 : 0;
+    for (; i < pci_device_count; i++)
+    {
+        if ((vendor == 0xFFFF || pci_devices[i].vendor == vendor) &&
+            (device == 0xFFFF || pci_devices[i].device == device))
+        {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+void pci_enable(pci_device_t *dev, uint16_t command)
+{
+    pci_write16(dev, PCI_COMMAND, pci_read16(dev, PCI_COMMAND) | command);
+}
+
+void *pci_bar_map(pci_device_t *dev, unsigned int n)
+{
+    if (n >= PCI_BARS || !dev->bars[n].size || dev->bars[n].io)
+    {
+        return NULL;
+    }
+    return ioremap(dev->bars[n].base, dev->bars[n].size);
+}
+
+uint16_t pci_find_capability(pci_device_t *dev, uint8_t id)
+{
+    if (!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST))
+    {
+        return 0;
+    }
+    uint8_t offset = pci_read8(dev, PCI_CAPABILITY_LIST) & ~3;
+    // Bounded in case a broken list loops
+    for (int i = 0; offset && i < 48; i++)
+    {
+        if (pci_read8(dev, offset) == id)
+        {
+            return offset;
+        }
+        offset = pci_read8(dev, offset + 1) & ~3;
+    }
+    return 0;
+}
+
+uint16_t pci_find_ext_capability(pci_device_t *dev, uint16_t id)
+{
+    if (!dev->config)
+    {
+        return 0;
+    }
+    uint16_t offset = PCI_EXT_CAPABILITY_LIST;
+    for (int i = 0; offset >= PCI_EXT_CAPABILITY_LIST && i < 960; i++)
+    {
+        uint32_t header = pci_read32(dev, offset);
+        if (!header || header == 0xFFFFFFFF)
+        {
+            return 0;
+        }
+        if ((header & 0xFFFF) == id)
+        {
+            return offset;
+        }
+        offset = (header >> 20) & ~3;
+    }
+    return 0;
+}
+
+int pci_msix_enable(pci_device_t *dev)
+{
+    if (dev->msix_table)
+    {
+        return dev->msix_count;
+    }
+    uint16_t cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+    if (!cap)
+    {
+        return -ENODEV;
+    }
+    uint16_t flags = pci_read16(dev, cap + PCI_MSIX_FLAGS);
+    uint32_t table = pci_read32(dev, cap + PCI_MSIX_TABLE);
+    uint16_t count = (flags & PCI_MSIX_FLAGS_QSIZE) + 1;
+    pci_bar_t *bar = &dev->bars[table & PCI_MSIX_BIR];
+    if ((table & PCI_MSIX_BIR) >= PCI_BARS || !bar->size || bar->io)
+    {
+        return -ENODEV;
+    }
+    volatile uint32_t *entries = ioremap(bar->base + (table & ~PCI_MSIX_BIR), count * MSIX_ENTRY_DWORDS * 4);
+    if (!entries)
+    {
+        return -ENOMEM;
+    }
+
+    // Enabled with the function masked, so no entry fires while they are masked one by one
+    pci_enable(dev, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER | PCI_COMMAND_INTX_DISABLE);
+    pci_write16(dev, cap + PCI_MSIX_FLAGS, flags | PCI_MSIX_FLAGS_ENABLE | PCI_MSIX_FLAGS_MASKALL);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        entries[i * MSIX_ENTRY_DWORDS + MSIX_CTRL] |= MSIX_CTRL_MASKED;
+    }
+    pci_write16(dev, cap + PCI_MSIX_FLAGS, (flags | PCI_MSIX_FLAGS_ENABLE) & ~PCI_MSIX_FLAGS_MASKALL);
+
+    dev->msix_cap = cap;
+    dev->msix_count = count;
+    dev->msix_table = entries;
+    return count;
+}
+
+void pci_msix_mask(pci_device_t *dev, unsigned int entry, int masked)
+{
+    if (entry >= dev->msix_count)
+    {
+        return;
+    }
+    volatile uint32_t *ctrl = &dev->msix_table[entry * MSIX_ENTRY_DWORDS + MSIX_CTRL];
+    *ctrl = masked ? *ctrl | MSIX_CTRL_MASKED : *ctrl & ~MSIX_CTRL_MASKED;
+}
+
+int pci_msix_request(pci_device_t *dev, unsigned int entry, uint32_t apic_id, irq_handler_t handler, void *arg)
+{
+    if (entry >= dev->msix_count || apic_id > 0xFF)
+    {
+        return -EINVAL;         // Destinations above 255 need interrupt remapping
+    }
+    int vector = irq_request(handler, arg);
+    if (vector < 0)
+    {
+        return vector;
+    }
+
+    volatile uint32_t *msix = &dev->msix_table[entry * MSIX_ENTRY_DWORDS];
+    pci_msix_mask(dev, entry, 1);
+    msix[MSIX_ADDR_LO] = MSI_ADDRESS_BASE | (apic_id << 12);
+    msix[MSIX_ADDR_HI] = 0;
+    msix[MSIX_DATA] = vector;   // Fixed delivery, edge triggered
+    pci_msix_mask(dev, entry, 0);
+    return vector;
+}
+
+void pci_msix_free(pci_device_t *dev, unsigned int entry)
+{
+    if (entry >= dev->msix_count)
+    {
+        return;
+    }
+    pci_msix_mask(dev, entry, 1);
+    uint8_t vector = dev->msix_table[entry * MSIX_ENTRY_DWORDS + MSIX_DATA] & 0xFF;
+    if (vector >= IRQ_DYNAMIC_START && vector <= IRQ_DYNAMIC_END)
+    {
+        irq_free(vector);
+    }
+}
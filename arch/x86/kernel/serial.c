@@ -28,9 +28,17 @@
  *
  */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <asm/apic.h>
+#include <asm/cpu.h>
 #include <asm/io.h>
+#include <asm/ioapic.h>
+#include <asm/irq_vectors.h>
+#include <kernel/errno.h>
+#include <kernel/interrupt.h>
 #include <kernel/serial.h>
+#include <kernel/spinlock.h>
 
 #define PORT_OFFSET_DR 0            // Data Register (when DLAB=0)
 #define PORT_OFFSET_IER 1           // Interrupt Enable Register (when DLAB=0)
@@ -44,25 +52,308 @@
 #define PORT_OFFSET_MSR 6           // Modem Status Register
 #define PORT_OFFSET_SR 7            // Scratch Register
 
-uint8_t serial_recv_byte(uint16_t port)
+#define IER_RDA 0x01                // Received data available
+#define IER_THRE 0x02               // Transmitter holding register empty
+#define IER_RLS 0x04                // Receiver line status
+
+#define IIR_NONE 0x01               // No interrupt pending
+#define IIR_ID(iir) (((iir) >> 1) & 0x7)
+#define IIR_MSR 0
+#define IIR_THRE 1
+#define IIR_RDA 2
+#define IIR_RLS 3
+#define IIR_TIMEOUT 6               // Bytes sit in the receive FIFO below the trigger level
+
+#define FCR_ENABLE 0x01
+#define FCR_CLEAR_RX 0x02
+#define FCR_CLEAR_TX 0x04
+#define FCR_TRIGGER_14 0xC0         // Interrupt once 14 bytes were received
+
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+
+#define MCR_DTR 0x01
+#define MCR_RTS 0x02
+#define MCR_OUT2 0x08               // Gates the interrupt line on PC UARTs
+#define MCR_LOOPBACK 0x10
+
+#define LSR_DR 0x01                 // Data ready
+#define LSR_THRE 0x20
+
+#define UART_CLOCK 115200           // Baud rate at divisor 1
+
+typedef struct
+{
+    uint16_t port;
+    uint8_t irq;
+    int active;                     // Interrupt driven, set once serial_init() succeeded
+    spinlock_t lock;
+    uint8_t ier;
+    uint64_t tx_head, tx_tail;
+    uint64_t rx_head, rx_tail;
+    uint64_t rx_dropped;            // Bytes lost to a full receive buffer
+    char tx[SERIAL_TX_SIZE];
+    char rx[SERIAL_RX_SIZE];
+} uart_t;
+
+static uart_t uarts[] = {
+    {.port = PORT_COM1, .irq = 4, .lock = SPINLOCK_INIT("com1")},
+    {.port = PORT_COM2, .irq = 3, .lock = SPINLOCK_INIT("com2")},
+    {.port = PORT_COM3, .irq = 4, .lock = SPINLOCK_INIT("com3")},
+    {.port = PORT_COM4, .irq = 3, .lock = SPINLOCK_INIT("com4")},
+};
+
+static uart_t *uart_get(uint16_t port)
+{
+    for (size_t i = 0; i < sizeof(uarts) / sizeof(uarts[0]); i++)
+    {
+        if (uarts[i].port == port)
+        {
+            return &uarts[i];
+        }
+    }
+    return NULL;
+}
+
+static inline uart_t *uart_active(uint16_t port)
+{
+    uart_t *uart = uart_get(port);
+    return uart && __atomic_load_n(&uart->active, __ATOMIC_ACQUIRE) ? uart : NULL;
+}
+
+static void uart_set_ier(uart_t *uart, uint8_t ier)
+{
+    if (uart->ier != ier)
+    {
+        uart->ier = ier;
+        outb(uart->port + PORT_OFFSET_IER, ier);
+    }
+}
+
+/* Refills the transmit FIFO once it ran empty, THRE interrupts stay on while bytes are queued */
+static void uart_transmit(uart_t *uart)
+{
+    if (inb(uart->port + PORT_OFFSET_LSR) & LSR_THRE)
+    {
+        for (int i = 0; i < UART_FIFO_SIZE && uart->tx_tail != uart->tx_head; i++)
+        {
+            outb(uart->port + PORT_OFFSET_DR, uart->tx[uart->tx_tail++ & (SERIAL_TX_SIZE - 1)]);
+        }
+    }
+    if (uart->tx_tail != uart->tx_head)
+    {
+        uart_set_ier(uart, uart->ier | IER_THRE);
+    }
+    else
+    {
+        uart_set_ier(uart, uart->ier & ~IER_THRE);
+    }
+}
+
+static void uart_receive(uart_t *uart)
+{
+    while (inb(uart->port + PORT_OFFSET_LSR) & LSR_DR)
+    {
+        char c = inb(uart->port + PORT_OFFSET_DR);
+        if (uart->rx_head - uart->rx_tail == SERIAL_RX_SIZE)
+        {
+            uart->rx_dropped++;
+            continue;
+        }
+        uart->rx[uart->rx_head++ & (SERIAL_RX_SIZE - 1)] = c;
+    }
+}
+
+static void serial_interrupt(interrupt_frame_t *frame, void *arg)
 {
-    while ((inb(port + PORT_OFFSET_LSR) & 1) == 0); // Wait for the receive buffer has readable data
+    (void)frame;
+    uart_t *uart = arg;
+
+    spin_lock(&uart->lock);
+    for (;;)
+    {
+        uint8_t iir = inb(uart->port + PORT_OFFSET_IIR);
+        if (iir & IIR_NONE)
+        {
+            break;
+        }
+        switch (IIR_ID(iir))
+        {
+        case IIR_RLS:
+            inb(uart->port + PORT_OFFSET_LSR);
+            break;
+
+        case IIR_RDA:
+        case IIR_TIMEOUT:
+            uart_receive(uart);
+            break;
+
+        case IIR_THRE:
+            uart_transmit(uart);
+            break;
+
+        case IIR_MSR:
+        default:
+            inb(uart->port + PORT_OFFSET_MSR);
+            break;
+        }
+    }
+    spin_unlock(&uart->lock);
+}
+
+int serial_init(uint16_t port, uint32_t baud)
+{
+    uart_t *uart = uart_get(port);
+    if (!uart)
+    {
+        return -ENODEV;
+    }
+    uint16_t divisor = baud && baud <= UART_CLOCK ? UART_CLOCK / baud : 1;
+
+    outb(port + PORT_OFFSET_IER, 0);
+    outb(port + PORT_OFFSET_LCR, LCR_DLAB);
+    outb(port + PORT_OFFSET_BAUD_LOW, divisor & 0xFF);
+    outb(port + PORT_OFFSET_BAUD_HIGH, divisor >> 8);
+    outb(port + PORT_OFFSET_LCR, LCR_8N1);
+    outb(port + PORT_OFFSET_FCR, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX | FCR_TRIGGER_14);
+
+    // A byte sent in loopback must come back, otherwise nothing sits at the port
+    outb(port + PORT_OFFSET_MCR, MCR_LOOPBACK | MCR_RTS | MCR_DTR);
+    outb(port + PORT_OFFSET_DR, 0xAE);
+    for (int i = 0; i < 1000 && !(inb(port + PORT_OFFSET_LSR) & LSR_DR); i++)
+    {
+        pause();
+    }
+    if (inb(port + PORT_OFFSET_DR) != 0xAE)
+    {
+        outb(port + PORT_OFFSET_MCR, MCR_RTS | MCR_DTR);
+        return -ENODEV;
+    }
+    outb(port + PORT_OFFSET_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+
+    if (irq_register(ISA_IRQ_VECTOR(uart->irq), serial_interrupt, uart) < 0 ||
+        ioapic_route_isa(uart->irq, ISA_IRQ_VECTOR(uart->irq), apic_id()) < 0)
+    {
+        return 0;               // Still works, polled
+    }
+
+    uint64_t flags = spin_lock_irqsave(&uart->lock);
+    uart->ier = 0;
+    uart_set_ier(uart, IER_RDA | IER_RLS);
+    __atomic_store_n(&uart->active, 1, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return 0;
+}
+
+static uint8_t serial_poll_recv(uint16_t port)
+{
+    while ((inb(port + PORT_OFFSET_LSR) & LSR_DR) == 0); // Wait for the receive buffer has readable data
     return inb(port + PORT_OFFSET_DR);
 }
 
-void serial_send_byte(uint16_t port, uint8_t data)
+static void serial_poll_send(uint16_t port, uint8_t data)
 {
-    while ((inb(port + PORT_OFFSET_LSR) & 0x20) == 0); // Wait for the transmit buffer is empty
+    while ((inb(port + PORT_OFFSET_LSR) & LSR_THRE) == 0); // Wait for the transmit buffer is empty
     outb(port + PORT_OFFSET_DR, data);
 }
 
+uint8_t serial_recv_byte(uint16_t port)
+{
+    if (!uart_active(port))
+    {
+        return serial_poll_recv(port);
+    }
+    char c;
+    while (!serial_read(port, &c, 1))
+    {
+        pause();
+    }
+    return c;
+}
+
+void serial_send_byte(uint16_t port, uint8_t data)
+{
+    if (!uart_active(port))
+    {
+        serial_poll_send(port, data);
+        return;
+    }
+    while (!serial_write(port, (const char *)&data, 1))
+    {
+        pause();
+    }
+}
+
+size_t serial_write(uint16_t port, const char *buffer, size_t length)
+{
+    uart_t *uart = uart_active(port);
+    if (!uart)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            serial_poll_send(port, buffer[i]);
+        }
+        return length;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&uart->lock);
+    size_t space = SERIAL_TX_SIZE - (uart->tx_head - uart->tx_tail);
+    if (length > space)
+    {
+        length = space;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        uart->tx[uart->tx_head++ & (SERIAL_TX_SIZE - 1)] = buffer[i];
+    }
+    uart_transmit(uart);
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return length;
+}
+
+size_t serial_read(uint16_t port, char *buffer, size_t length)
+{
+    uart_t *uart = uart_active(port);
+    if (!uart)
+    {
+        size_t count = 0;
+        while (count < length && (inb(port + PORT_OFFSET_LSR) & LSR_DR))
+        {
+            buffer[count++] = inb(port + PORT_OFFSET_DR);
+        }
+        return count;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&uart->lock);
+    size_t count = 0;
+    while (count < length && uart->rx_tail != uart->rx_head)
+    {
+        buffer[count++] = uart->rx[uart->rx_tail++ & (SERIAL_RX_SIZE - 1)];
+    }
+    spin_unlock_irqrestore(&uart->lock, flags);
+    return count;
+}
+
+void serial_flush(uint16_t port)
+{
+    uart_t *uart = uart_active(port);
+    if (!uart)
+    {
+        return;
+    }
+    // May run in panic() while this processor holds the lock, so go without it
+    while (uart->tx_tail != uart->tx_head)
+    {
+        serial_poll_send(port, uart->tx[uart->tx_tail++ & (SERIAL_TX_SIZE - 1)]);
+    }
+}
+
 int serial_recv_str(uint16_t port, char *buffer)
 {
     int received_bytes = 0;
-    while ((inb(port + PORT_OFFSET_LSR) & 1) == 0); // Wait for the receive buffer has readable data
     do
     {
-        *buffer = inb(port + PORT_OFFSET_DR);
+        *buffer = serial_recv_byte(port);
         received_bytes++;
     } while (*(buffer++));
     return received_bytes;
@@ -71,10 +362,10 @@ int serial_recv_str(uint16_t port, char *buffer)
 int serial_send_str(uint16_t port, char *str)
 {
     int sent_bytes = 0;
-    while ((inb(port + PORT_OFFSET_LSR) & 0x20) == 0); // Wait for the transmit buffer is empty
     do
     {
-        outb(port + PORT_OFFSET_DR, *str);
+        serial_send_byte(port, *str);
+        sent_bytes++;
     } while (*(str++));
     return sent_bytes;
-}
\ No newline at end of file
+}
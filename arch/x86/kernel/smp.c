@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/smp.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Symmetric multiprocessing and per-CPU data
+ *
+ */
+
+#include <stdint.h>
+#include <asm/apic.h>
+#include <asm/cpu.h>
+#include <asm/fpu.h>
+#include <asm/io.h>
+#include <asm/irq_vectors.h>
+#include <asm/msr.h>
+#include <asm/page.h>
+#include <boot/bootboot.h>
+#include <kernel/buddy.h>
+#include <kernel/interrupt.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+
+extern BOOTBOOT bootboot;   // Infomation provided by BOOTBOOT Loader
+
+cpu_t *cpus[MAX_CPUS];
+unsigned int smp_cpu_count;
+
+static cpu_t boot_cpu;
+
+static uint32_t ap_arrived;         // APs that have taken an index
+static uint32_t ap_released;        // Set once the per-CPU blocks are ready
+static uint32_t cpus_online;
+static void (*ap_entry)();          // Set by smp_start()
+
+static void cpu_set_gs(cpu_t *cpu)
+{
+    wrmsr(MSR_GS_BASE, (uintptr_t)cpu);
+}
+
+void smp_early_init()
+{
+    smp_cpu_count = bootboot.numcores;
+    if (smp_cpu_count > MAX_CPUS)
+    {
+        smp_cpu_count = MAX_CPUS;
+    }
+    if (!smp_cpu_count)
+    {
+        smp_cpu_count = 1;
+    }
+
+    boot_cpu.self = &boot_cpu;
+    boot_cpu.id = 0;
+    boot_cpu.apic_id = bootboot.bspid;
+    cpus[0] = &boot_cpu;
+    cpu_set_gs(&boot_cpu);
+    cpus_online = 1;
+}
+
+static void reschedule_interrupt(interrupt_frame_t *frame, void *arg)
+{
+    (void)frame;
+    (void)arg;
+    this_cpu()->need_resched = 1;
+}
+
+void smp_send_reschedule(unsigned int cpu)
+{
+    apic_send_ipi(cpus[cpu]->apic_id, RESCHEDULE_VECTOR);
+}
+
+static uintptr_t stack_alloc()
+{
+    uintptr_t phys = page_alloc(KERNEL_STACK_ORDER);
+    if (!phys)
+    {
+        panic("Out of memory allocating CPU stacks\n");
+    }
+    return (uintptr_t)phys_to_virt(phys) + KERNEL_STACK_SIZE;
+}
+
+void smp_init()
+{
+    irq_register(RESCHEDULE_VECTOR, reschedule_interrupt, NULL);
+    boot_cpu.stack_top = stack_alloc();
+    for (unsigned int id = 1; id < cpu_count(); id++)
+    {
+        cpu_t *cpu = kmalloc(sizeof(cpu_t));
+        if (!cpu)
+        {
+            panic("Out of memory allocating per-CPU data\n");
+        }
+        cpu->self = cpu;
+        cpu->id = id;
+        cpu->apic_id = 0;
+        cpu->package = 0;
+        cpu->core = 0;
+        cpu->thread = 0;
+        cpu->node = 0;
+        cpu->current = NULL;
+        cpu->preempt_count = 0;
+        cpu->need_resched = 0;
+        cpu->irq_depth = 0;
+        cpu->stack_top = stack_alloc();
+        cpus[id] = cpu;
+    }
+
+    __atomic_store_n(&ap_released, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) < cpu_count())
+    {
+        pause();
+    }
+}
+
+int smp_ready()
+{
+    return __atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) == cpu_count();
+}
+
+void smp_start(void (*entry)())
+{
+    __atomic_store_n(&ap_entry, entry, __ATOMIC_RELEASE);
+}
+
+static void ap_main()
+{
+    void (*entry)();
+
+    interrupt_load();
+    fpu_init_cpu();
+    apic_init_ap();
+    __atomic_add_fetch(&cpus_online, 1, __ATOMIC_RELEASE);
+
+    // TLB shootdowns reach the parked APs as interrupts
+    irq_enable();
+    while (!(entry = __atomic_load_n(&ap_entry, __ATOMIC_ACQUIRE)))
+    {
+        pause();
+    }
+    entry();
+
+    for (;;)
+    {
+        hlt();
+    }
+}
+
+void smp_ap_entry()
+{
+    // Still on the loader's 1 KiB stack and page tables, keep this light
+    unsigned int id = __atomic_add_fetch(&ap_arrived, 1, __ATOMIC_RELAXED);
+    while (!__atomic_load_n(&ap_released, __ATOMIC_ACQUIRE))
+    {
+        pause();
+    }
+    if (id >= cpu_count())
+    {
+        for (;;)
+        {
+            hlt();
+        }
+    }
+
+    cpu_t *cpu = cpus[id];
+    paging_init_ap();
+    cpu_set_gs(cpu);
+    call_on_stack(cpu->stack_top, ap_main);
+}
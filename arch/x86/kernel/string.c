@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/string.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Memory and string routines using the x86 string instructions
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/alternative.h>
+#include <asm/cpufeature.h>
+#include <asm/string.h>
+#include <kernel/string.h>
+
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+/* Quadword views of any object, without breaking strict aliasing. The unaligned one for memcmp() */
+typedef uint64_t __attribute__((may_alias)) u64_alias;
+typedef uint64_t __attribute__((may_alias, aligned(1))) u64_alias_unaligned;
+
+void *memcpy_movsb(void *dst, const void *src, size_t n)
+{
+    void *ret = dst;
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+    return ret;
+}
+
+void *memcpy_movsq(void *dst, const void *src, size_t n)
+{
+    void *ret = dst;
+    size_t qwords = n / 8;
+    size_t bytes = n % 8;
+    asm volatile("rep movsq" : "+D"(dst), "+S"(src), "+c"(qwords) : : "memory");
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(bytes) : : "memory");
+    return ret;
+}
+
+void *memset_stosb(void *dst, int c, size_t n)
+{
+    void *ret = dst;
+    asm volatile("rep stosb" : "+D"(dst), "+c"(n) : "a"(c) : "memory");
+    return ret;
+}
+
+void *memset_stosq(void *dst, int c, size_t n)
+{
+    void *ret = dst;
+    uint64_t pattern = (uint8_t)c * ONES;
+    size_t qwords = n / 8;
+    size_t bytes = n % 8;
+    asm volatile("rep stosq" : "+D"(dst), "+c"(qwords) : "a"(pattern) : "memory");
+    asm volatile("rep stosb" : "+D"(dst), "+c"(bytes) : "a"(pattern) : "memory");
+    return ret;
+}
+
+/* The quadword variants are safe before apply_alternatives(), every x86-64 processor runs them well enough */
+void *memcpy(void *dst, const void *src, size_t n)
+{
+    if (static_cpu_has(X86_FEATURE_REP_MOVSB))
+    {
+        void *ret = dst;
+        asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+        return ret;
+    }
+    return memcpy_movsq(dst, src, n);
+}
+
+/* FSRM only speaks for MOVSB, REP STOSB still needs ERMS */
+void *memset(void *dst, int c, size_t n)
+{
+    if (static_cpu_has(X86_FEATURE_ERMS))
+    {
+        void *ret = dst;
+        asm volatile("rep stosb" : "+D"(dst), "+c"(n) : "a"(c) : "memory");
+        return ret;
+    }
+    return memset_stosq(dst, c, n);
+}
+
+/* A forward copy is safe unless dst starts inside src, then the tail is copied first */
+void *memmove(void *dst, const void *src, size_t n)
+{
+    if ((uintptr_t)dst - (uintptr_t)src >= n)
+    {
+        return memcpy(dst, src, n);
+    }
+
+    // Backward string instructions never take the fast path, so the bulk still moves as quadwords
+    size_t qwords = n / 8;
+    size_t bytes = n % 8;
+    uint8_t *d = (uint8_t *)dst + n - 1;
+    const uint8_t *s = (const uint8_t *)src + n - 1;
+    asm volatile(
+        "std\n"
+        "rep movsb\n"
+        "sub rdi, 7\n"
+        "sub rsi, 7\n"
+        "mov rcx, %[qwords]\n"
+        "rep movsq\n"
+        "cld"
+        : "+D"(d), "+S"(s), "+c"(bytes) : [qwords] "r"(qwords) : "memory", "cc");
+    return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n)
+{
+    const uint8_t *x = a;
+    const uint8_t *y = b;
+
+    // Skip equal quadwords, the differing byte is then found one at a time
+    while (n >= 8 && *(const u64_alias_unaligned *)x == *(const u64_alias_unaligned *)y)
+    {
+        x += 8;
+        y += 8;
+        n -= 8;
+    }
+    for (; n; n--, x++, y++)
+    {
+        if (*x != *y)
+        {
+            return *x - *y;
+        }
+    }
+    return 0;
+}
+
+/* Aligned quadword loads never cross into the next page, so reading past the end is harmless */
+size_t strlen(const char *s)
+{
+    const char *p = s;
+    while ((uintptr_t)p & 7)
+    {
+        if (!*p)
+        {
+            return p - s;
+        }
+        p++;
+    }
+
+    const u64_alias *q = (const u64_alias *)p;
+    while (!((*q - ONES) & ~*q & HIGHS))
+    {
+        q++;
+    }
+    p = (const char *)q;
+    while (*p)
+    {
+        p++;
+    }
+    return p - s;
+}
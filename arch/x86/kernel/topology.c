@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/topology.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * CPU topology and NUMA nodes
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <kernel/errno.h>
+#include <kernel/kprintf.h>
+#include <kernel/smp.h>
+#include <kernel/topology.h>
+
+numa_memblk_t numa_memblks[MAX_NUMA_MEMBLKS];
+unsigned int numa_memblk_count;
+
+static uint32_t node_pxm[MAX_NUMA_NODES];
+static unsigned int node_count;
+static uint8_t distances[MAX_NUMA_NODES][MAX_NUMA_NODES];  // 0 where SLIT says nothing
+
+static struct
+{
+    uint32_t apic_id;
+    unsigned int node;
+} apic_nodes[MAX_CPUS];
+static unsigned int apic_node_count;
+
+static int pxm_lookup(uint32_t pxm)
+{
+    for (unsigned int node = 0; node < node_count; node++)
+    {
+        if (node_pxm[node] == pxm)
+        {
+            return node;
+        }
+    }
+    return -ENOENT;
+}
+
+int numa_pxm_to_node(uint32_t pxm)
+{
+    int node = pxm_lookup(pxm);
+    if (node >= 0)
+    {
+        return node;
+    }
+    if (node_count == MAX_NUMA_NODES)
+    {
+        return -ENOSPC;
+    }
+    node_pxm[node_count] = pxm;
+    return node_count++;
+}
+
+void numa_add_memblk(uint32_t pxm, uintptr_t start, uint64_t length)
+{
+    int node = numa_pxm_to_node(pxm);
+    if (node < 0 || !length || numa_memblk_count == MAX_NUMA_MEMBLKS)
+    {
+        return;
+    }
+    numa_memblk_t *blk = &numa_memblks[numa_memblk_count++];
+    blk->start = start;
+    blk->end = start + length;
+    blk->node = node;
+}
+
+void numa_set_apic_node(uint32_t apic_id, uint32_t pxm)
+{
+    int node = numa_pxm_to_node(pxm);
+    if (node < 0 || apic_node_count == MAX_CPUS)
+    {
+        return;
+    }
+    apic_nodes[apic_node_count].apic_id = apic_id;
+    apic_nodes[apic_node_count].node = node;
+    apic_node_count++;
+}
+
+void numa_set_distance(uint32_t from_pxm, uint32_t to_pxm, uint8_t distance)
+{
+    int from = pxm_lookup(from_pxm);
+    int to = pxm_lookup(to_pxm);
+    if (from >= 0 && to >= 0)
+    {
+        distances[from][to] = distance;
+    }
+}
+
+unsigned int numa_node_count()
+{
+    return node_count ? node_count : 1;
+}
+
+uint8_t numa_distance(unsigned int from, unsigned int to)
+{
+    if (from < MAX_NUMA_NODES && to < MAX_NUMA_NODES && distances[from][to])
+    {
+        return distances[from][to];
+    }
+    return from == to ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+}
+
+unsigned int numa_node_of_phys(uintptr_t phys)
+{
+    for (unsigned int i = 0; i < numa_memblk_count; i++)
+    {
+        if (phys >= numa_memblks[i].start && phys < numa_memblks[i].end)
+        {
+            return numa_memblks[i].node;
+        }
+    }
+    return 0;
+}
+
+static unsigned int apic_node(uint32_t apic_id)
+{
+    for (unsigned int i = 0; i < apic_node_count; i++)
+    {
+        if (apic_nodes[i].apic_id == apic_id)
+        {
+            return apic_nodes[i].node;
+        }
+    }
+    return 0;
+}
+
+/* Bits of the APIC ID that number the threads of a core and everything below the package */
+static void apic_id_shifts(unsigned int *smt_shift, unsigned int *package_shift)
+{
+    uint32_t eax, ebx, ecx, edx;
+    *smt_shift = 0;
+    *package_shift = 0;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0xB)
+    {
+        cpuid(0xB, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx)
+        {
+            for (uint32_t level = 0; level < 8; level++)
+            {
+                cpuid(0xB, level, &eax, &ebx, &ecx, &edx);
+                uint32_t type = (ecx >> 8) & 0xFF;
+                if (!type)
+                {
+                    break;
+                }
+                if (type == 1)
+                {
+                    *smt_shift = eax & 0x1F;
+                }
+                *package_shift = eax & 0x1F;
+            }
+            return;
+        }
+    }
+
+    // Only the logical processor count per package is known, threads cannot be told from cores
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (edx & (1 << 28))
+    {
+        uint32_t count = (ebx >> 16) & 0xFF;
+        while ((1U << *package_shift) < count)
+        {
+            (*package_shift)++;
+        }
+    }
+}
+
+void topology_init()
+{
+    unsigned int smt_shift, package_shift;
+    apic_id_shifts(&smt_shift, &package_shift);
+
+    unsigned int packages = 0, cores = 0;
+    for (unsigned int id = 0; id < cpu_count(); id++)
+    {
+        cpu_t *cpu = cpus[id];
+        cpu->thread = cpu->apic_id & ((1U << smt_shift) - 1);
+        cpu->core = (cpu->apic_id & ((1U << package_shift) - 1)) >> smt_shift;
+        cpu->package = cpu->apic_id >> package_shift;
+        cpu->node = apic_node(cpu->apic_id);
+
+        int new_package = 1, new_core = 1;
+        for (unsigned int other = 0; other < id; other++)
+        {
+            if (cpus[other]->package == cpu->package)
+            {
+                new_package = 0;
+                if (cpus[other]->core == cpu->core)
+                {
+                    new_core = 0;
+                }
+            }
+        }
+        packages += new_package;
+        cores += new_core;
+    }
+    kprintf("Topology: %u packages, %u cores, %u threads, %u nodes\n", packages, cores, cpu_count(),
+        numa_node_count());
+
+    if (numa_node_count() < 2)
+    {
+        return;
+    }
+    for (unsigned int node = 0; node < numa_node_count(); node++)
+    {
+        uint64_t memory = 0;
+        for (unsigned int i = 0; i < numa_memblk_count; i++)
+        {
+            if (numa_memblks[i].node == node)
+            {
+                memory += numa_memblks[i].end - numa_memblks[i].start;
+            }
+        }
+        unsigned int cpus_on_node = 0;
+        for (unsigned int id = 0; id < cpu_count(); id++)
+        {
+            cpus_on_node += cpus[id]->node == node;
+        }
+        kprintf("  node %u: %u cpus, %lu MiB, distances", node, cpus_on_node, memory >> 20);
+        for (unsigned int to = 0; to < numa_node_count(); to++)
+        {
+            kprintf(" %u", numa_distance(node, to));
+        }
+        kprintf("\n");
+    }
+}
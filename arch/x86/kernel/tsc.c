@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: MIT
+/*
+ * arch/x86/kernel/tsc.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Time Stamp Counter frequency and conversions
+ *
+ */
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+#include <asm/hpet.h>
+#include <asm/io.h>
+#include <asm/tsc.h>
+#include <kernel/clocksource.h>
+#include <kernel/kprintf.h>
+#include <kernel/time.h>
+
+#define PIT_HZ 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE 0x61           // Bit 0 gates channel 2, bit 5 reads its output
+
+#define CALIBRATE_MS 50
+#define CALIBRATE_ROUNDS 3
+
+uint64_t tsc_khz;
+uint64_t tsc_mult;
+uint64_t tsc_epoch;
+
+static uint64_t tsc_read()
+{
+    return rdtsc_ordered();
+}
+
+static clocksource_t tsc_clocksource = {
+    .name = "tsc",
+    .read = tsc_read,
+    .mask = ~0UL,
+    .shift = TSC_SHIFT,
+};
+
+/* Exact frequency from the crystal ratio in leaf 0x15, 0 where the crystal is not enumerated */
+static uint64_t tsc_khz_from_cpuid()
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x15)
+    {
+        return 0;
+    }
+    cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+    if (!eax || !ebx || !ecx)
+    {
+        return 0;
+    }
+    return (uint64_t)ecx * ebx / eax / 1000;
+}
+
+/* Counts TSC cycles over one run of PIT channel 2 in one-shot mode, polled so no interrupt is needed */
+static uint64_t pit_calibrate_once()
+{
+    uint16_t latch = PIT_HZ * CALIBRATE_MS / 1000;
+
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) & ~0x01);   // Speaker off, gate low
+    outb(PIT_COMMAND, 0xB0);                            // Channel 2, lobyte/hibyte, mode 0
+    outb(PIT_CHANNEL2, latch & 0xFF);
+    outb(PIT_CHANNEL2, latch >> 8);
+
+    uint64_t flags = irq_save();
+    outb(PIT_GATE, inb(PIT_GATE) | 0x01);               // Gate high starts the count
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE) & 0x20))
+    {
+        pause();
+    }
+    uint64_t end = rdtsc();
+    irq_restore(flags);
+
+    return (end - start) / CALIBRATE_MS;
+}
+
+/* Counts TSC cycles against the HPET main counter */
+static uint64_t hpet_calibrate_once()
+{
+    uint64_t ticks = CALIBRATE_MS * NSEC_PER_MSEC * 1000000 / hpet_period_fs;
+
+    uint64_t flags = irq_save();
+    uint64_t hpet_start = hpet_read_counter();
+    uint64_t start = rdtsc();
+    while (hpet_read_counter() - hpet_start < ticks)
+    {
+        pause();
+    }
+    uint64_t end = rdtsc();
+    uint64_t hpet_end = hpet_read_counter();
+    irq_restore(flags);
+
+    uint64_t ns = (hpet_end - hpet_start) * hpet_period_fs / 1000000;
+    return (end - start) * NSEC_PER_MSEC / ns;
+}
+
+/* Takes the fastest run, a slow one was disturbed (e.g. by the host under emulation) */
+static uint64_t tsc_calibrate(uint64_t (*calibrate_once)())
+{
+    uint64_t khz = 0;
+    for (int i = 0; i < CALIBRATE_ROUNDS; i++)
+    {
+        uint64_t round = calibrate_once();
+        if (!khz || round < khz)
+        {
+            khz = round;
+        }
+    }
+    return khz;
+}
+
+void tsc_init()
+{
+    const char *reference = "CPUID";
+    uint64_t khz = tsc_khz_from_cpuid();
+    if (!khz && hpet_available())
+    {
+        reference = "HPET";
+        khz = tsc_calibrate(hpet_calibrate_once);
+    }
+    if (!khz)
+    {
+        reference = "PIT";
+        khz = tsc_calibrate(pit_calibrate_once);
+    }
+
+    tsc_khz = khz ? khz : 1;
+    tsc_mult = (NSEC_PER_MSEC << TSC_SHIFT) / tsc_khz;
+    // ktime may already run on the HPET, the TSC picks it up where it stands
+    tsc_epoch = rdtsc() - ns_to_tsc(ktime_get_ns());
+
+    int invariant = cpu_has(X86_FEATURE_INVARIANT_TSC);
+    kprintf("TSC: %lu.%03lu MHz from %s, %s\n", tsc_khz / 1000, tsc_khz % 1000, reference,
+        invariant ? "invariant" : "not invariant");
+
+    // A TSC that changes rate with power states still beats having nothing
+    tsc_clocksource.mult = tsc_mult;
+    tsc_clocksource.rating = invariant ? 300 : 100;
+    clocksource_register(&tsc_clocksource);
+}
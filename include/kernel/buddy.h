@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/buddy.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Buddy allocator of physical page frames
+ *
+ */
+
+#ifndef BUDDY_H
+#define BUDDY_H
+
+#include <stdint.h>
+#include <asm/page.h>
+#include <kernel/spinlock.h>
+#include <kernel/topology.h>
+
+#define BUDDY_MAX_ORDER 18      // Blocks of 2^0..2^18 pages, 4 KiB up to 1 GiB
+#define PFN_NONE 0xFFFFFFFF     // Terminates free lists
+
+enum page_flags
+{
+    PAGE_RESERVED = 1,  // Never handed out (firmware, kernel, holes)
+    PAGE_FREE = 2       // Head page of a free block
+};
+
+/* Descriptor of a physical page frame, one per page below max_pfn */
+typedef struct
+{
+    uint32_t next;      // Free list links, PFN of the neighbouring blocks
+    uint32_t prev;
+    uint8_t order;      // Order of the block headed by this page
+    uint8_t flags;
+    uint8_t node;       // NUMA node, blocks never merge across nodes
+    uint8_t private;    // Tag of the allocator owning the page, 0 if none
+} page_t;
+
+typedef struct
+{
+    uint32_t head;      // PFN of the first free block
+    uint64_t count;     // Number of free blocks
+} free_area_t;
+
+/* The free memory of one NUMA node */
+typedef struct
+{
+    mcs_lock_t lock;    // Taken by every core allocating pages, so queue waiters
+    unsigned int node;
+    uint64_t managed_pages;     // Pages given to the allocator at boot
+    uint64_t free_pages;
+    free_area_t free_area[BUDDY_MAX_ORDER + 1];
+    uint8_t fallback[MAX_NUMA_NODES];   // Nodes to try in turn, this one first
+    unsigned int fallback_count;
+} zone_t;
+
+extern uintptr_t mem_map_phys;
+extern uint64_t max_pfn;
+
+static inline page_t *pfn_to_page(uint64_t pfn)
+{
+    return (page_t *)phys_to_virt(mem_map_phys) + pfn;
+}
+
+void buddy_init();
+
+/*
+ * Allocates 2^order contiguous pages aligned to their size from the calling processor's node, then
+ * from the nodes of its fallback list. Returns the physical address, 0 on failure
+ */
+uintptr_t page_alloc(unsigned int order);
+
+/* Same, starting at node instead */
+uintptr_t page_alloc_node(unsigned int order, unsigned int node);
+void page_free(uintptr_t phys, unsigned int order);
+
+/*
+ * Replaces the fallback list of node, which is tried after node itself. By default it holds the other
+ * nodes nearest first, as far as the numa_distance key of the configuration allows
+ */
+void buddy_set_fallback(unsigned int node, const unsigned int *nodes, unsigned int count);
+
+uint64_t buddy_free_count(unsigned int order);
+uint64_t buddy_free_pages();
+uint64_t buddy_node_free_pages(unsigned int node);
+void buddy_dump();
+
+#endif/* BUDDY_H */
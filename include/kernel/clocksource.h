@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/clocksource.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Counters backing the kernel clock
+ *
+ */
+
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+
+#include <stdint.h>
+
+/* A free-running counter, readable on every processor */
+typedef struct
+{
+    const char *name;
+    uint64_t (*read)();
+    uint64_t mask;          // Counter width
+    uint64_t mult;          // ns = cycles * mult >> shift
+    uint32_t shift;
+    int rating;             // The best rated registered source drives ktime_get_ns()
+} clocksource_t;
+
+/* Switches ktime_get_ns() to cs if it rates higher than the current source, without a jump in time */
+void clocksource_register(const clocksource_t *cs);
+
+#endif/* CLOCKSOURCE_H */
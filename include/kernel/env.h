@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/env.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Access to the BOOTBOOT environment
+ *
+ */
+
+#ifndef ENV_H
+#define ENV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returns the value of key and stores its length, NULL if the key is not set. The value is not NUL terminated */
+const char *env_get(const char *key, size_t *length);
+
+/* Returns 1 if item is one of the comma separated values of key */
+int env_contains(const char *key, const char *item);
+
+/* Returns the decimal value of key, fallback if the key is not set or not a number */
+uint64_t env_get_number(const char *key, uint64_t fallback);
+
+#endif/* ENV_H */
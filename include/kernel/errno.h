@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/errno.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Error numbers returned by kernel functions, negated
+ *
+ */
+
+#ifndef ERRNO_H
+#define ERRNO_H
+
+#define EPERM 1         // Operation not permitted
+#define ENOENT 2        // No such entry
+#define EIO 5           // I/O error
+#define E2BIG 7         // Argument list too long
+#define EAGAIN 11       // Try again
+#define ENOMEM 12       // Out of memory
+#define EFAULT 14       // Bad address
+#define EBUSY 16        // Resource busy
+#define EEXIST 17       // Already exists
+#define ENODEV 19       // No such device
+#define EINVAL 22       // Invalid argument
+#define ENOSPC 28       // No space left
+#define ENOSYS 38       // Not implemented
+
+#endif/* ERRNO_H */
@@ -36,31 +36,95 @@
 
 typedef uint32_t PIXEL; /* pixel pointer */
 
+#define FB_FLUSH_HZ 60          // Rate of batched flushes once timers run
+#define FB_DIRTY_RECTS 8        // Damage tracked separately before rectangles get merged
+
+/* Damaged area of the screen in pixels, x1 and y1 exclusive */
+typedef struct
+{
+    int x0, y0;
+    int x1, y1;
+} rect_t;
+
+/* Pixels drawn to by the blit engine, pitch in bytes */
+typedef struct
+{
+    uint8_t *pixels;
+    uint32_t pitch;
+} surface_t;
+
+/*
+ * Blit engine specialised for one framebuffer pixel layout. Source images are 0xAARRGGBB whatever the
+ * layout, so the format only matters inside these loops. Coordinates are already clipped.
+ */
+typedef struct
+{
+    const char *name;
+    PIXEL (*from_rgb)(uint32_t rgb);
+    void (*fill_rect)(surface_t *dst, int x, int y, int w, int h, PIXEL pixel);
+    void (*copy_rect)(surface_t *dst, int dx, int dy, int sx, int sy, int w, int h);
+    void (*blit_colorkey)(surface_t *dst, int x, int y, int w, int h, const uint32_t *src, int src_stride, uint32_t key);
+    void (*blit_alpha)(surface_t *dst, int x, int y, int w, int h, const uint32_t *src, int src_stride);
+    void (*glyph)(surface_t *dst, int x, int y, int w, int h, const PIXEL *rows, int stride);
+} fb_ops_t;
+
+extern const fb_ops_t *fb_ops;         // Ops for bootboot.fb_type
+
+/* Selects fb_ops, runs before anything is drawn */
+void fb_ops_init();
+
+/*
+ * Drawing goes to a shadow copy of the framebuffer in normal memory and records the damaged area.
+ * graphics_commit() makes it visible, right away until graphics_start_flush() switches to batching.
+ * Clients keeping their own model, like the terminal grid, draw it from a renderer at flush time.
+ */
 void putpixel(int x, int y, PIXEL pixel);
 
+/* Clip to the screen, src_stride in pixels */
+void fill_rect(int x, int y, int w, int h, PIXEL pixel);
+void copy_rect(int dx, int dy, int sx, int sy, int w, int h);
+void blit_colorkey(int x, int y, int w, int h, const uint32_t *src, int src_stride, uint32_t key);
+void blit_alpha(int x, int y, int w, int h, const uint32_t *src, int src_stride);
+
+/* Blits the glyph from the atlas when it was built for fg and bg, otherwise goes through the font bitmap */
 void drawchar(char c, int cx, int cy, PIXEL fg, PIXEL bg);
 
+/* Expands each glyph from the font bitmap a pixel at a time */
+void drawchar_bitmap(char c, int cx, int cy, PIXEL fg, PIXEL bg);
+
+/* Expands the font into ready-to-store pixel rows for fg and bg, deferred until graphics_init() */
+void glyph_atlas_build(PIXEL fg, PIXEL bg);
+
+/* Moves drawing off the framebuffer into a shadow buffer and builds the glyph atlas, runs after kmalloc_init() */
+void graphics_init();
+
+/* Sets the function drawing deferred output into the back buffer, run at the start of each flush */
+void graphics_set_renderer(void (*render)());
+
+/* Renders, then copies the damaged scanlines to the framebuffer */
+void graphics_flush();
+
+/* Called once a batch of output is done, flushes now or schedules the next batched flush */
+void graphics_commit();
+
+/* Batches flushes at FB_FLUSH_HZ, runs after timers_init() */
+void graphics_start_flush();
+
 /* Converts 24-bit RGB color(like 0xRRGGBB) to 32-bit Pixel format according to the FrameBuffer */
 static inline PIXEL rgb_to_pixel(uint32_t rgb)
 {
-    extern BOOTBOOT bootboot; // Infomation provided by BOOTBOOT Loader
+    return fb_ops->from_rgb(rgb);
+}
 
-    switch (bootboot.fb_type)
+/* Copies count pixels with one string move, the framebuffer takes long bursts best */
+static inline void copy_pixels(void *dst, const void *src, uint64_t count)
+{
+    uint64_t qwords = count / 2;
+    asm volatile("rep movsq" : "+D"(dst), "+S"(src), "+c"(qwords) : : "memory");
+    if (count & 1)
     {
-    default:
-    case FB_ARGB:
-        return (0xFF << 24) | rgb;
-
-    case FB_RGBA:
-        return (rgb << 8) | 0xFF;
-
-    case FB_ABGR:
-        return (0xFF << 24) | ((rgb & 0xFF) << 16) | (rgb & 0xFF00) | ((rgb & 0xFF0000) >> 16);
-
-    case FB_BGRA:
-        return ((rgb & 0xFF) << 24) | ((rgb & 0xFF00) << 8) | ((rgb & 0xFF0000) >> 8) | 0xFF;
+        asm volatile("movsd" : "+D"(dst), "+S"(src) : : "memory");
     }
 }
 
-
 #endif/* GRAPHICS_H */
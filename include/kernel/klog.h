@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/klog.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Deferred binary logging into per-CPU rings
+ *
+ */
+
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/tsc.h>
+#include <kernel/smp.h>
+
+#define KLOG_MAX_ARGS 5
+#define KLOG_RING_ORDER 4               // 64 KiB of records per processor
+#define KLOG_RING_SIZE ((PAGE_SIZE << KLOG_RING_ORDER) / sizeof(klog_record_t))
+#define KLOG_POLL_MS 50                 // klogd drains the rings this often
+#define KLOG_MAGIC 0x31474C4B           // "KLG1", starts the raw stream
+
+/* One event, a cache line. Arguments are raw words, turned into text only when read */
+typedef struct
+{
+    uint64_t tsc;
+    const char *fmt;
+    uint16_t cpu;
+    uint8_t nargs;
+    uint8_t reserved[5];
+    uint64_t args[KLOG_MAX_ARGS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) klog_record_t;
+
+/* Written only by its processor with interrupts off, read by klogd */
+typedef struct
+{
+    klog_record_t *records;
+    uint64_t head;                      // Next record to write
+    uint64_t tail;                      // Next record to read
+    uint64_t dropped;                   // Events lost to a full ring
+} __attribute__((aligned(CACHE_LINE_SIZE))) klog_ring_t;
+
+extern klog_ring_t *klog_rings[MAX_CPUS];
+
+/* Caller keeps the ring to itself, e.g. with interrupts off on the owning processor */
+static inline void klog_ring_write(klog_ring_t *ring, const char *fmt, unsigned int nargs, uint64_t a0,
+    uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4)
+{
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == KLOG_RING_SIZE)
+    {
+        ring->dropped++;
+        return;
+    }
+
+    klog_record_t *record = &ring->records[head & (KLOG_RING_SIZE - 1)];
+    record->tsc = rdtsc();
+    record->fmt = fmt;
+    record->cpu = cpu_id();
+    record->nargs = nargs;
+    record->args[0] = a0;
+    record->args[1] = a1;
+    record->args[2] = a2;
+    record->args[3] = a3;
+    record->args[4] = a4;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void klog_write(const char *fmt, unsigned int nargs, uint64_t a0, uint64_t a1, uint64_t a2,
+    uint64_t a3, uint64_t a4)
+{
+    uint64_t flags = irq_save();
+    klog_ring_t *ring = klog_rings[cpu_id()];
+    if (ring)
+    {
+        klog_ring_write(ring, fmt, nargs, a0, a1, a2, a3, a4);
+    }
+    irq_restore(flags);
+}
+
+#define KLOG_NARGS(...) KLOG_NARGS_(0, ##__VA_ARGS__, 5, 4, 3, 2, 1, 0)
+#define KLOG_NARGS_(_0, _1, _2, _3, _4, _5, n, ...) n
+#define KLOG_CAT(a, b) KLOG_CAT_(a, b)
+#define KLOG_CAT_(a, b) a##b
+
+#define klog_write0(fmt) klog_write(fmt, 0, 0, 0, 0, 0, 0)
+#define klog_write1(fmt, a) klog_write(fmt, 1, (uint64_t)(a), 0, 0, 0, 0)
+#define klog_write2(fmt, a, b) klog_write(fmt, 2, (uint64_t)(a), (uint64_t)(b), 0, 0, 0)
+#define klog_write3(fmt, a, b, c) klog_write(fmt, 3, (uint64_t)(a), (uint64_t)(b), (uint64_t)(c), 0, 0)
+#define klog_write4(fmt, a, b, c, d) \
+    klog_write(fmt, 4, (uint64_t)(a), (uint64_t)(b), (uint64_t)(c), (uint64_t)(d), 0)
+#define klog_write5(fmt, a, b, c, d, e) \
+    klog_write(fmt, 5, (uint64_t)(a), (uint64_t)(b), (uint64_t)(c), (uint64_t)(d), (uint64_t)(e))
+
+/*
+ * Records a kprintf-style event without formatting it: the format must be a literal and %s arguments
+ * must outlive the record. At most KLOG_MAX_ARGS integer or pointer arguments
+ */
+#define klog_fast(fmt, ...) KLOG_CAT(klog_write, KLOG_NARGS(__VA_ARGS__))(fmt, ##__VA_ARGS__)
+
+/*
+ * Allocates the rings and starts klogd, which prints the records to the console, or with klog=raw in
+ * the environment streams them unformatted to COM1 for tools/klog_decode.py. Runs after sched_init()
+ */
+void klog_init();
+
+#endif/* KLOG_H */
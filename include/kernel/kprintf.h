@@ -29,13 +29,72 @@
  */
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifndef KPRINTF_H
 #define KPRINTF_H
 
+#define KPRINTF_CHUNK 128       // Output reaches the sinks in pieces of at most this, long strings go whole
+#define KPRINTF_LOG_SIZE 16384  // Kernel log ring, the last console output for post-mortem reading
+
+/* Receives formatted output. A chain of sinks is fed by one formatting pass */
+typedef struct kprintf_sink
+{
+    void (*write)(struct kprintf_sink *sink, const char *s, size_t length);
+    struct kprintf_sink *next;
+} kprintf_sink_t;
+
+/* Bounded string, keeps the terminating NUL in size and counts what did not fit */
+typedef struct
+{
+    kprintf_sink_t sink;
+    char *buf;
+    size_t size;
+    size_t length;
+} string_sink_t;
+
+/* Overwrites the oldest output once full, size is a power of two */
+typedef struct
+{
+    kprintf_sink_t sink;
+    char *buf;
+    size_t size;
+    uint64_t head;              // Characters written since the start
+} ring_sink_t;
+
+/* Serial port, never waits: what does not fit in its transmit buffer is dropped */
+typedef struct
+{
+    kprintf_sink_t sink;
+    uint16_t port;
+    uint64_t dropped;           // Bytes lost to a full transmit buffer
+} serial_sink_t;
+
+void ring_sink_write(kprintf_sink_t *sink, const char *s, size_t length);
+void serial_sink_write(kprintf_sink_t *sink, const char *s, size_t length);
+
+#define RING_SINK_INIT(buffer, bytes) {.sink = {.write = ring_sink_write}, .buf = buffer, .size = bytes}
+#define SERIAL_SINK_INIT(com) {.sink = {.write = serial_sink_write}, .port = com}
+
+extern ring_sink_t kprintf_log;
+
+/* Adds a sink behind the console, every later kprintf() reaches it too */
+void kprintf_add_console(kprintf_sink_t *sink);
+
+/* Return the number of characters formatted, which for snkprintf may exceed what fit */
 int kprintf(const char *format, ...);
-int skprintf(char *str, const char *format, ...);
 int vkprintf(const char *format, va_list arg);
+int fkprintf(kprintf_sink_t *sink, const char *format, ...);
+int vfkprintf(kprintf_sink_t *sink, const char *format, va_list arg);
+/* Takes each argument from one 64-bit word, as recorded by klog_fast() */
+int wkprintf(kprintf_sink_t *sink, const char *format, const uint64_t *words);
+int wsnkprintf(char *str, size_t size, const char *format, const uint64_t *words);
+int snkprintf(char *str, size_t size, const char *format, ...);
+int vsnkprintf(char *str, size_t size, const char *format, va_list arg);
+
+/* Unbounded, the caller makes sure str is large enough */
+int skprintf(char *str, const char *format, ...);
 int vskprintf(char *str, const char *format, va_list arg);
 
 #endif/* KPRINTF_H */
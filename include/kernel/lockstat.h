@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/lockstat.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Lock contention statistics
+ *
+ */
+
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <stdint.h>
+
+/* Updated by the lock holder, enabled by building with CONFIG_LOCKSTAT (make LOCKSTAT=1) */
+typedef struct lockstat
+{
+    const char *name;
+    struct lockstat *next;      // Registry of locks taken at least once
+    uint32_t registered;
+    uint64_t acquisitions;
+    uint64_t contended;         // Acquisitions that had to wait
+    uint64_t spin_cycles;       // TSC cycles spent waiting
+    uint64_t max_spin_cycles;
+} lockstat_t;
+
+void lockstat_register(lockstat_t *stat);
+
+static inline void lockstat_acquired(lockstat_t *stat, uint64_t spin_cycles, int contended)
+{
+    if (!stat->registered)
+    {
+        lockstat_register(stat);
+    }
+    stat->acquisitions++;
+    if (contended)
+    {
+        stat->contended++;
+        stat->spin_cycles += spin_cycles;
+        if (spin_cycles > stat->max_spin_cycles)
+        {
+            stat->max_spin_cycles = spin_cycles;
+        }
+    }
+}
+
+/* Writes the statistics of every registered lock to the serial port */
+void lockstat_dump();
+
+#endif/* LOCKSTAT_H */
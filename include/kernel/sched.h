@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/sched.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Kernel threads and the per-CPU work-stealing scheduler
+ *
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <asm/preempt.h>
+#include <kernel/smp.h>
+
+#define SCHED_HZ 100            // Scheduler ticks per second
+#define SCHED_SLICE_TICKS 4     // Ticks a thread runs before it is preempted
+
+typedef enum
+{
+    THREAD_RUNNING,
+    THREAD_READY,               // Queued on a run queue
+    THREAD_BLOCKED,
+    THREAD_DEAD
+} thread_state_t;
+
+typedef struct thread
+{
+    uintptr_t sp;               // Must stay first, context_switch() saves the stack pointer here
+    uint32_t state;
+    uint32_t on_cpu;            // Set until the processor that ran it has left its stack
+    uint32_t slice;             // Ticks left before preemption
+    uint32_t id;
+    uintptr_t stack;            // Bottom of the stack, 0 for idle threads which run on the CPU stack
+    const char *name;
+    void *fpu_state;            // Saved SIMD registers, allocated by the first kernel_fpu_begin()
+    uint32_t fpu_depth;         // Nesting of kernel_fpu_begin(), the registers are switched while non-zero
+} thread_t;
+
+static inline thread_t *current_thread()
+{
+    return this_cpu()->current;
+}
+
+/*
+ * Locks are taken with interrupts disabled and the timer only preempts a thread interrupted with
+ * interrupts enabled, so holding a lock already rules out preemption. preempt_disable() is for
+ * sections that touch per-CPU data with interrupts on.
+ */
+static inline void preempt_disable()
+{
+    preempt_count_inc();
+    asm volatile("" : : : "memory");
+}
+
+void preempt_schedule();
+
+static inline void preempt_enable()
+{
+    asm volatile("" : : : "memory");
+    if (preempt_count_dec_and_test() && this_cpu()->need_resched)
+    {
+        preempt_schedule();
+    }
+}
+
+/* Allocates the run queues of every processor, runs on the BSP after smp_init() */
+void sched_init();
+
+/* Turns the calling processor's boot context into its idle thread and starts running threads */
+__attribute__((noreturn)) void sched_start();
+
+/* Creates a thread running fn(arg) and queues it on the calling processor, NULL if out of memory */
+thread_t *thread_create(const char *name, void (*fn)(void *), void *arg);
+
+__attribute__((noreturn)) void thread_exit();
+
+void thread_yield();
+
+/*
+ * Blocking without lost wakeups:
+ *     thread_prepare_block();
+ *     if (!condition) thread_block(); else thread_cancel_block();
+ * The waker makes the condition true, then calls thread_wake().
+ */
+void thread_prepare_block();
+void thread_block();
+void thread_cancel_block();
+
+/* Queues a blocked thread on the calling processor, returns 0 if it was not blocked */
+int thread_wake(thread_t *thread);
+
+/* Gives up the processor to the next runnable thread, never call it with preemption disabled */
+void schedule();
+
+/* Called from the timer interrupt, asks for a reschedule once the slice is used up */
+void sched_tick();
+
+#endif/* SCHED_H */
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/slab.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Slab allocator and kmalloc
+ *
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <kernel/spinlock.h>
+
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SIZE 8192   // Larger requests go straight to the page allocator
+#define KMALLOC_CLASSES 10      // 16 B, 32 B ... 8 KiB
+#define MAGAZINE_SIZE 30        // Objects per magazine, makes a magazine 256 bytes
+
+typedef struct slab
+{
+    struct slab *next;          // Links in the partial list of the cache
+    struct slab *prev;
+    void *freelist;             // Free objects, linked through their first word
+    uint32_t inuse;
+    uint32_t total;
+} __attribute__((aligned(CACHE_LINE_SIZE))) slab_t;
+
+typedef struct magazine
+{
+    struct magazine *next;      // Links in the depot
+    uint64_t rounds;            // Number of objects held
+    void *objs[MAGAZINE_SIZE];
+} magazine_t;
+
+/* Per-CPU front end of a cache, only touched by its own processor */
+typedef struct
+{
+    magazine_t *loaded;
+    magazine_t *previous;
+    uint64_t allocs;
+    uint64_t frees;
+} __attribute__((aligned(CACHE_LINE_SIZE))) kmem_cpu_cache_t;
+
+typedef struct kmem_cache
+{
+    const char *name;
+    size_t size;
+    unsigned int order;         // Each slab is 2^order pages
+    unsigned int id;
+    kmem_cpu_cache_t *cpu;      // NULL if the cache has no magazine layer
+
+    spinlock_t lock;            // Protects everything below
+    slab_t *partial;            // Slabs with free objects
+    uint64_t empty_slabs;
+    uint64_t slabs;
+    uint64_t refills;           // Slabs allocated from the page allocator
+    uint64_t allocs;            // Counted here only if there is no per-CPU layer
+    uint64_t frees;
+    magazine_t *depot_full;
+    magazine_t *depot_empty;
+} kmem_cache_t;
+
+void kmalloc_init();
+
+/* Sets up a cache in caller-provided storage. The per-CPU layer is skipped if percpu is 0 */
+void kmem_cache_init(kmem_cache_t *cache, const char *name, size_t size, int percpu);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+void kmalloc_dump();
+
+#endif/* SLAB_H */
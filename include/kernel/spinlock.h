@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/spinlock.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Ticket spinlocks and MCS queue locks
+ *
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <kernel/lockstat.h>
+
+/* Ticket lock, FIFO fair. Every waiter spins on the same line, so keep critical sections short */
+typedef struct
+{
+    union
+    {
+        uint32_t value;
+        struct
+        {
+            uint16_t owner;     // Ticket being served
+            uint16_t next;      // Next ticket to hand out
+        };
+    };
+#ifdef CONFIG_LOCKSTAT
+    lockstat_t stat;
+#endif
+} spinlock_t;
+
+/* Node of an MCS lock queue, each waiter spins on its own node */
+typedef struct mcs_node
+{
+    struct mcs_node *next;
+    uint32_t locked;
+} __attribute__((aligned(CACHE_LINE_SIZE))) mcs_node_t;
+
+/* MCS queue lock, FIFO fair with no cache-line bouncing between waiters. For contended locks */
+typedef struct
+{
+    mcs_node_t *tail;
+#ifdef CONFIG_LOCKSTAT
+    lockstat_t stat;
+#endif
+} mcs_lock_t;
+
+#ifdef CONFIG_LOCKSTAT
+#define SPINLOCK_INIT(lockname) {.value = 0, .stat = {.name = lockname}}
+#define MCS_LOCK_INIT(lockname) {.tail = NULL, .stat = {.name = lockname}}
+#else
+#define SPINLOCK_INIT(lockname) {.value = 0}
+#define MCS_LOCK_INIT(lockname) {.tail = NULL}
+#endif
+
+#define DEFINE_SPINLOCK(var) spinlock_t var = SPINLOCK_INIT(#var)
+#define DEFINE_MCS_LOCK(var) mcs_lock_t var = MCS_LOCK_INIT(#var)
+
+static inline void spin_lock_init(spinlock_t *lock, const char *name)
+{
+    (void)name;
+    *lock = (spinlock_t)SPINLOCK_INIT(name);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) == ticket)
+    {
+#ifdef CONFIG_LOCKSTAT
+        lockstat_acquired(&lock->stat, 0, 0);
+#endif
+        return;
+    }
+
+#ifdef CONFIG_LOCKSTAT
+    uint64_t start = rdtsc();
+#endif
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+    {
+        pause();
+    }
+#ifdef CONFIG_LOCKSTAT
+    lockstat_acquired(&lock->stat, rdtsc() - start, 1);
+#endif
+}
+
+/* Returns 1 if the lock was taken */
+static inline int spin_trylock(spinlock_t *lock)
+{
+    uint32_t old = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+    if ((old & 0xFFFF) != (old >> 16))
+    {
+        return 0;
+    }
+    if (!__atomic_compare_exchange_n(&lock->value, &old, old + 0x10000, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+#ifdef CONFIG_LOCKSTAT
+    lockstat_acquired(&lock->stat, 0, 0);
+#endif
+    return 1;
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock)
+{
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags)
+{
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline void mcs_lock_init(mcs_lock_t *lock, const char *name)
+{
+    (void)name;
+    *lock = (mcs_lock_t)MCS_LOCK_INIT(name);
+}
+
+/* node must stay valid until the matching mcs_unlock(), usually it lives on the caller's stack */
+static inline void mcs_lock(mcs_lock_t *lock, mcs_node_t *node)
+{
+    node->next = NULL;
+    node->locked = 1;
+
+    mcs_node_t *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (!prev)
+    {
+#ifdef CONFIG_LOCKSTAT
+        lockstat_acquired(&lock->stat, 0, 0);
+#endif
+        return;
+    }
+
+#ifdef CONFIG_LOCKSTAT
+    uint64_t start = rdtsc();
+#endif
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+    {
+        pause();
+    }
+#ifdef CONFIG_LOCKSTAT
+    lockstat_acquired(&lock->stat, rdtsc() - start, 1);
+#endif
+}
+
+static inline void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node)
+{
+    mcs_node_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (!next)
+    {
+        mcs_node_t *expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            return;
+        }
+        // A successor is between swapping the tail and linking itself in
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)))
+        {
+            pause();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t mcs_lock_irqsave(mcs_lock_t *lock, mcs_node_t *node)
+{
+    uint64_t flags = irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t *lock, mcs_node_t *node, uint64_t flags)
+{
+    mcs_unlock(lock, node);
+    irq_restore(flags);
+}
+
+#endif/* SPINLOCK_H */
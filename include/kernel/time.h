@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/time.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Kernel time keeping
+ *
+ */
+
+#ifndef TIME_H
+#define TIME_H
+
+#include <stdint.h>
+
+#define NSEC_PER_USEC 1000UL
+#define NSEC_PER_MSEC 1000000UL
+#define NSEC_PER_SEC 1000000000UL
+
+/* Monotonic nanoseconds since boot, comparable between processors */
+uint64_t ktime_get_ns();
+
+/* Wall clock, nanoseconds since the Unix epoch in UTC */
+uint64_t ktime_get_real_ns();
+
+/* Local time offset in minutes as given by the loader */
+int time_zone();
+
+/* Seeds the wall clock from the loader's boot time, needs a clocksource */
+void time_init();
+
+/*
+ * Periodically moves the ktime base up to the counter, so a narrow clocksource such as a 32-bit HPET
+ * never wraps past it. Runs on the BSP after timers_init()
+ */
+void time_accumulate_start();
+
+#endif/* TIME_H */
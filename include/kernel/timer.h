@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/timer.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Tickless timers on a per-CPU hierarchical timer wheel
+ *
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+typedef struct ktimer
+{
+    struct ktimer *next;
+    struct ktimer **pprev;      // NULL when not pending
+    uint64_t expires;           // In wheel units
+    void (*fn)(void *arg);      // Runs in interrupt context on the arming processor
+    void *arg;
+    unsigned int cpu;           // Processor whose wheel holds it
+    unsigned int idx;           // Bucket in that wheel
+} ktimer_t;
+
+void timer_init(ktimer_t *timer, void (*fn)(void *arg), void *arg);
+
+/*
+ * Arms the timer on the calling processor to run at or after expires (ktime_get_ns() time), moving it if
+ * it is already pending. O(1): far timeouts land in coarser wheel levels, at most 1/8 late.
+ */
+void timer_arm(ktimer_t *timer, uint64_t expires);
+
+/* Returns 1 if the timer was pending, waits for its function if that runs on another processor */
+int timer_cancel(ktimer_t *timer);
+
+static inline int timer_pending(ktimer_t *timer)
+{
+    return __atomic_load_n(&timer->pprev, __ATOMIC_RELAXED) != NULL;
+}
+
+/* Blocks the calling thread for at least ns nanoseconds */
+void sleep_ns(uint64_t ns);
+
+/* Scheduler tick on or off for the calling processor, off while it is idle */
+void timer_tick_start();
+void timer_tick_stop();
+
+/* Called by the clock event device interrupt */
+void timer_interrupt();
+
+/* Allocates the timer wheels, runs on the BSP after smp_init() */
+void timers_init();
+
+#endif/* TIMER_H */
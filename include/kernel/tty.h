@@ -31,12 +31,30 @@
 #ifndef TTY_H
 #define TTY_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <kernel/graphics.h>
 
+#define TTY_MAX_COLS 256
+#define TTY_MAX_ROWS 144
+#define TTY_MAX_ATTRS 256
+
+/* Character cell of the terminal grid */
+typedef struct
+{
+    uint8_t ch;
+    uint8_t attr;               // Colour pair
+} cell_t;
+
 void terminal_init();
 void terminal_setcolor(PIXEL fg, PIXEL bg);
+void terminal_getcolor(PIXEL *fg, PIXEL *bg);
+
+/* Draws every cell again, for when something else drew over the terminal */
+void terminal_redraw();
 void terminal_putchar(char c);
 void terminal_puts(char *s);
+void terminal_write(const char *s, size_t length);
 
 
 #endif/* TTY_H */
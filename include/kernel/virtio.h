@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/virtio.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Legacy virtio over PCI and split virtqueues
+ *
+ */
+
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/pci.h>
+
+#define VIRTIO_VENDOR 0x1AF4
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FAILED 128
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2            // Device writes the buffer
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY 1
+
+#define VIRTIO_MAX_SEGMENTS 16          // Buffers in one chain
+
+typedef struct
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct
+{
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem_t;
+
+typedef struct
+{
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+typedef struct
+{
+    uint16_t io;                        // Base of the legacy register block in BAR 0
+    pci_device_t *pci;
+    uint32_t features;                  // Negotiated
+} virtio_device_t;
+
+typedef struct
+{
+    virtio_device_t *vdev;
+    uint16_t index;
+    uint16_t size;
+    vring_desc_t *desc;
+    vring_avail_t *avail;
+    volatile vring_used_t *used;
+    void **cookies;                     // Per chain head, handed back by virtqueue_get()
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t last_used;
+} virtqueue_t;
+
+/* A physically contiguous piece of a request */
+typedef struct
+{
+    uintptr_t phys;
+    uint32_t len;
+} virtio_buf_t;
+
+/* Resets the device and announces a driver. -ENODEV if BAR 0 is not port I/O */
+int virtio_pci_init(virtio_device_t *vdev, pci_device_t *pci);
+
+/* Accepts the wanted features the device offers and returns them */
+uint32_t virtio_negotiate(virtio_device_t *vdev, uint32_t wanted);
+
+void virtio_driver_ok(virtio_device_t *vdev);
+
+/* Tells the device the driver gave up on it */
+void virtio_fail(virtio_device_t *vdev);
+
+uint8_t virtio_config_read8(virtio_device_t *vdev, uint16_t offset);
+uint16_t virtio_config_read16(virtio_device_t *vdev, uint16_t offset);
+uint32_t virtio_config_read32(virtio_device_t *vdev, uint16_t offset);
+
+/* Allocates the ring of queue index in the size the device asks for. Interrupts are left suppressed */
+int virtqueue_init(virtqueue_t *vq, virtio_device_t *vdev, uint16_t index);
+
+/*
+ * Chains out device-readable buffers followed by in device-writable ones and makes them available.
+ * Returns 0, or -ENOSPC if the ring has too few free descriptors. The caller serializes, and the device
+ * is only told once virtqueue_kick() runs
+ */
+int virtqueue_add(virtqueue_t *vq, const virtio_buf_t *bufs, unsigned int out, unsigned int in, void *cookie);
+
+void virtqueue_kick(virtqueue_t *vq);
+
+/* Takes the next chain the device is done with, returns 0 if there is none */
+int virtqueue_get(virtqueue_t *vq, void **cookie, uint32_t *len);
+
+/* Splits a kernel buffer into physically contiguous pieces, returns their number or -errno */
+int virtio_map(const void *buf, size_t len, virtio_buf_t *bufs, unsigned int max);
+
+#endif/* VIRTIO_H */
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: MIT
+/*
+ * include/kernel/virtio_console.h
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * virtio-console driver with multiple ports for log and trace export
+ *
+ */
+
+#ifndef VIRTIO_CONSOLE_H
+#define VIRTIO_CONSOLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/kprintf.h>
+
+#define VIRTIO_CONSOLE_MAX_PORTS 8
+#define VIRTIO_CONSOLE_NAME_MAX 32
+#define VIRTIO_CONSOLE_STAGING_ORDER 4  // 64 KiB per port for copied writes
+
+/* A buffer sent in place, it must stay untouched until done runs */
+typedef struct virtio_console_req
+{
+    const void *buf;
+    size_t len;
+    void (*done)(struct virtio_console_req *req);
+    void *arg;
+} virtio_console_req_t;
+
+typedef struct
+{
+    kprintf_sink_t sink;
+    int port;
+} virtio_sink_t;
+
+void virtio_sink_write(kprintf_sink_t *sink, const char *s, size_t length);
+
+#define VIRTIO_SINK_INIT(p) {.sink = {.write = virtio_sink_write}, .port = p}
+
+/* Sets up the first virtio-console and the ports the host announces. -ENODEV if there is none */
+int virtio_console_init();
+
+/* Returns the port the host named name, or the console port if name is NULL. -ENOENT if none */
+int virtio_console_find(const char *name);
+
+/* Copies what fits into the port's staging buffer and sends it, returns the length taken */
+size_t virtio_console_write(int port, const char *s, size_t length);
+
+/* Sends req->buf without copying. -ENOSPC if the queue is full, completions are reaped on the next call */
+int virtio_console_submit(int port, virtio_console_req_t *req);
+
+/* Reaps what the device finished with and runs the done callbacks */
+void virtio_console_poll(int port);
+
+/* Waits until the device took everything queued on port, giving up after a while */
+void virtio_console_flush(int port);
+
+#endif/* VIRTIO_CONSOLE_H */
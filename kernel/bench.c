@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/bench.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * In-kernel benchmarks
+ *
+ */
+
+#include <stddef.h>
+#include <kernel/bench.h>
+#include <kernel/env.h>
+#include <kernel/kprintf.h>
+
+typedef struct
+{
+    const char *name;
+    void (*run)();
+} bench_t;
+
+static const bench_t benches[] = {
+    {"sched", bench_sched},
+    {"glyph", bench_glyph},
+    {"klog", bench_klog},
+    {"kprintf", bench_kprintf},
+    {"fpu", bench_fpu},
+    {"memcpy", bench_memcpy},
+};
+
+void bench_run(void *arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        if (env_contains("bench", benches[i].name))
+        {
+            kprintf("bench %s:\n", benches[i].name);
+            benches[i].run();
+        }
+    }
+}
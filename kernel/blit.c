@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/blit.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Blit engine specialised per framebuffer pixel format
+ *
+ */
+
+#include <stdint.h>
+#include <boot/bootboot.h>
+#include <kernel/graphics.h>
+#include <kernel/string.h>
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+extern BOOTBOOT bootboot;               // Infomation provided by BOOTBOOT Loader
+
+/* Format independent, shared by every table */
+
+static inline PIXEL *surface_row(surface_t *surface, int y)
+{
+    return (PIXEL *)(surface->pixels + (uint64_t)y * surface->pitch);
+}
+
+static void fill_rect_any(surface_t *dst, int x, int y, int w, int h, PIXEL pixel)
+{
+    for (int row = 0; row < h; row++)
+    {
+        PIXEL *p = surface_row(dst, y + row) + x;
+        uint64_t count = w;
+        asm volatile("rep stosd" : "+D"(p), "+c"(count) : "a"(pixel) : "memory");
+    }
+}
+
+/* Overlapping areas are fine, rows and pixels are walked away from the destination */
+static void copy_rect_any(surface_t *dst, int dx, int dy, int sx, int sy, int w, int h)
+{
+    if (dy > sy)
+    {
+        for (int row = h - 1; row >= 0; row--)
+        {
+            copy_pixels(surface_row(dst, dy + row) + dx, surface_row(dst, sy + row) + sx, w);
+        }
+    }
+    else if (dy == sy && dx > sx)
+    {
+        for (int row = 0; row < h; row++)
+        {
+            memmove(surface_row(dst, dy + row) + dx, surface_row(dst, sy + row) + sx, (size_t)w * sizeof(PIXEL));
+        }
+    }
+    else
+    {
+        for (int row = 0; row < h; row++)
+        {
+            copy_pixels(surface_row(dst, dy + row) + dx, surface_row(dst, sy + row) + sx, w);
+        }
+    }
+}
+
+/* Rows of stride pixels, stride even so they copy as whole qwords */
+static void glyph_any(surface_t *dst, int x, int y, int w, int h, const PIXEL *rows, int stride)
+{
+    int qwords = w / 2;
+    for (int row = 0; row < h; row++)
+    {
+        uint64_t *d = (uint64_t *)(surface_row(dst, y + row) + x);
+        const uint64_t *s = (const uint64_t *)rows;
+        for (int i = 0; i < qwords; i++)
+        {
+            d[i] = s[i];
+        }
+        if (w & 1)
+        {
+            *(PIXEL *)&d[qwords] = *(const PIXEL *)&s[qwords];
+        }
+        rows += stride;
+    }
+}
+
+/* Specialised by the position of each channel in the pixel */
+
+ALWAYS_INLINE PIXEL pack(uint32_t r, uint32_t g, uint32_t b, int rs, int gs, int bs, int as)
+{
+    return (r << rs) | (g << gs) | (b << bs) | (0xFFU << as);
+}
+
+ALWAYS_INLINE PIXEL argb_to_pixel(uint32_t argb, int rs, int gs, int bs, int as)
+{
+    return pack((argb >> 16) & 0xFF, (argb >> 8) & 0xFF, argb & 0xFF, rs, gs, bs, as);
+}
+
+/* s * alpha + d * (1 - alpha) for 8-bit channels, rounded, without a division */
+ALWAYS_INLINE uint32_t blend(uint32_t s, uint32_t d, uint32_t alpha)
+{
+    uint32_t x = s * alpha + d * (255 - alpha) + 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+ALWAYS_INLINE void blit_colorkey_fmt(surface_t *dst, int x, int y, int w, int h, const uint32_t *src,
+    int src_stride, uint32_t key, int rs, int gs, int bs, int as)
+{
+    for (int row = 0; row < h; row++)
+    {
+        PIXEL *d = surface_row(dst, y + row) + x;
+        for (int i = 0; i < w; i++)
+        {
+            if ((src[i] & 0xFFFFFF) != key)
+            {
+                d[i] = argb_to_pixel(src[i], rs, gs, bs, as);
+            }
+        }
+        src += src_stride;
+    }
+}
+
+ALWAYS_INLINE void blit_alpha_fmt(surface_t *dst, int x, int y, int w, int h, const uint32_t *src,
+    int src_stride, int rs, int gs, int bs, int as)
+{
+    for (int row = 0; row < h; row++)
+    {
+        PIXEL *d = surface_row(dst, y + row) + x;
+        for (int i = 0; i < w; i++)
+        {
+            uint32_t alpha = src[i] >> 24;
+            if (alpha == 0xFF)
+            {
+                d[i] = argb_to_pixel(src[i], rs, gs, bs, as);
+            }
+            else if (alpha)
+            {
+                PIXEL old = d[i];
+                d[i] = pack(
+                    blend((src[i] >> 16) & 0xFF, (old >> rs) & 0xFF, alpha),
+                    blend((src[i] >> 8) & 0xFF, (old >> gs) & 0xFF, alpha),
+                    blend(src[i] & 0xFF, (old >> bs) & 0xFF, alpha),
+                    rs, gs, bs, as);
+            }
+        }
+        src += src_stride;
+    }
+}
+
+/* Instantiates the ops of one format, channel shifts are constants in each copy */
+#define DEFINE_FB_OPS(fmt, rs, gs, bs, as)                                                                  \
+    static PIXEL from_rgb_##fmt(uint32_t rgb)                                                               \
+    {                                                                                                       \
+        return argb_to_pixel(rgb, rs, gs, bs, as);                                                          \
+    }                                                                                                       \
+    static void blit_colorkey_##fmt(surface_t *dst, int x, int y, int w, int h, const uint32_t *src,       \
+        int src_stride, uint32_t key)                                                                       \
+    {                                                                                                       \
+        blit_colorkey_fmt(dst, x, y, w, h, src, src_stride, key, rs, gs, bs, as);                          \
+    }                                                                                                       \
+    static void blit_alpha_##fmt(surface_t *dst, int x, int y, int w, int h, const uint32_t *src,          \
+        int src_stride)                                                                                     \
+    {                                                                                                       \
+        blit_alpha_fmt(dst, x, y, w, h, src, src_stride, rs, gs, bs, as);                                  \
+    }                                                                                                       \
+    static const fb_ops_t fb_ops_##fmt = {                                                                  \
+        .name = #fmt,                                                                                       \
+        .from_rgb = from_rgb_##fmt,                                                                         \
+        .fill_rect = fill_rect_any,                                                                         \
+        .copy_rect = copy_rect_any,                                                                         \
+        .blit_colorkey = blit_colorkey_##fmt,                                                               \
+        .blit_alpha = blit_alpha_##fmt,                                                                     \
+        .glyph = glyph_any,                                                                                 \
+    }
+
+DEFINE_FB_OPS(argb, 16, 8, 0, 24);
+DEFINE_FB_OPS(rgba, 24, 16, 8, 0);
+DEFINE_FB_OPS(abgr, 0, 8, 16, 24);
+DEFINE_FB_OPS(bgra, 8, 16, 24, 0);
+
+const fb_ops_t *fb_ops = &fb_ops_argb;
+
+void fb_ops_init()
+{
+    switch (bootboot.fb_type)
+    {
+    default:
+    case FB_ARGB:
+        fb_ops = &fb_ops_argb;
+        break;
+
+    case FB_RGBA:
+        fb_ops = &fb_ops_rgba;
+        break;
+
+    case FB_ABGR:
+        fb_ops = &fb_ops_abgr;
+        break;
+
+    case FB_BGRA:
+        fb_ops = &fb_ops_bgra;
+        break;
+    }
+}
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/env.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Access to the BOOTBOOT environment
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/env.h>
+
+extern unsigned char environment[4096]; // configuration, UTF-8 text key=value pairs
+
+static int is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char *env_get(const char *key, size_t *length)
+{
+    const char *p = (const char *)environment;
+    const char *end = p + sizeof(environment);
+
+    while (p < end && *p)
+    {
+        const char *line = p;
+        while (p < end && *p && *p != '\n')
+        {
+            p++;
+        }
+        const char *line_end = p;
+        if (p < end && *p == '\n')
+        {
+            p++;
+        }
+
+        while (line < line_end && is_blank(*line))
+        {
+            line++;
+        }
+        const char *k = key;
+        while (*k && line < line_end && *line == *k)
+        {
+            line++;
+            k++;
+        }
+        if (*k || line == line_end || *line != '=')
+        {
+            continue;   // Also skips "//" comments, no key starts with '/'
+        }
+
+        line++;
+        while (line_end > line && is_blank(line_end[-1]))
+        {
+            line_end--;
+        }
+        *length = line_end - line;
+        return line;
+    }
+    return NULL;
+}
+
+int env_contains(const char *key, const char *item)
+{
+    size_t length;
+    const char *value = env_get(key, &length);
+    if (!value)
+    {
+        return 0;
+    }
+
+    const char *end = value + length;
+    while (value < end)
+    {
+        while (value < end && (*value == ',' || is_blank(*value)))
+        {
+            value++;
+        }
+        const char *i = item;
+        while (*i && value < end && *value == *i)
+        {
+            value++;
+            i++;
+        }
+        if (!*i && (value == end || *value == ',' || is_blank(*value)))
+        {
+            return 1;
+        }
+        while (value < end && *value != ',')
+        {
+            value++;
+        }
+    }
+    return 0;
+}
+
+uint64_t env_get_number(const char *key, uint64_t fallback)
+{
+    size_t length;
+    const char *value = env_get(key, &length);
+    if (!value || !length)
+    {
+        return fallback;
+    }
+
+    uint64_t number = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (value[i] < '0' || value[i] > '9')
+        {
+            return fallback;
+        }
+        number = number * 10 + (value[i] - '0');
+    }
+    return number;
+}
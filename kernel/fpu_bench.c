@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/fpu_bench.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Benchmark of kernel FPU sections
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/fpu.h>
+#include <asm/page.h>
+#include <asm/tsc.h>
+#include <kernel/bench.h>
+#include <kernel/buddy.h>
+#include <kernel/kprintf.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+
+#define SECTION_ROUNDS 100000
+#define SUM_ORDER 4                 // 64 KiB, about L2 sized
+#define SUM_ROUNDS 64
+#define SWITCH_THREADS_PER_CPU 2
+#define SWITCH_ROUNDS 10000
+
+/* Defined in fpu_bench.simd.c, only call them inside a section */
+uint64_t fpu_bench_sum_sse2(const uint8_t *buf, size_t len);
+void fpu_bench_park(uint64_t value);
+uint64_t fpu_bench_unpark();
+
+static uint32_t remaining;
+static uint32_t mismatches;
+static thread_t *bench_thread;
+
+static void bench_section()
+{
+    uint64_t start = rdtsc();
+    for (int i = 0; i < SECTION_ROUNDS; i++)
+    {
+        kernel_fpu_begin();
+        kernel_fpu_end();
+    }
+    uint64_t cycles = rdtsc() - start;
+    kprintf("  begin/end: %lu cycles per section\n", cycles / SECTION_ROUNDS);
+}
+
+static uint64_t sum_scalar(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        sum += buf[i];
+    }
+    return sum;
+}
+
+static void bench_sum()
+{
+    size_t len = PAGE_SIZE << SUM_ORDER;
+    uintptr_t phys = page_alloc(SUM_ORDER);
+    if (!phys)
+    {
+        kprintf("  out of memory\n");
+        return;
+    }
+    uint8_t *buf = phys_to_virt(phys);
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[i] = (uint8_t)(i * 7);
+    }
+
+    uint64_t scalar = 0;
+    uint64_t start = rdtsc();
+    for (int round = 0; round < SUM_ROUNDS; round++)
+    {
+        scalar = sum_scalar(buf, len);
+    }
+    uint64_t scalar_ns = tsc_to_ns(rdtsc() - start);
+
+    uint64_t vector = 0;
+    start = rdtsc();
+    for (int round = 0; round < SUM_ROUNDS; round++)
+    {
+        kernel_fpu_begin();
+        vector = fpu_bench_sum_sse2(buf, len);
+        kernel_fpu_end();
+    }
+    uint64_t vector_ns = tsc_to_ns(rdtsc() - start);
+    page_free(phys, SUM_ORDER);
+
+    uint64_t bytes = (uint64_t)len * SUM_ROUNDS;
+    kprintf("  byte sum of %lu KiB: scalar %lu MB/s, sse2 %lu MB/s%s\n", len / 1024,
+        scalar_ns ? bytes * 1000 / scalar_ns : 0, vector_ns ? bytes * 1000 / vector_ns : 0,
+        scalar == vector ? "" : ", MISMATCH");
+}
+
+/* Keeps a value in a vector register across yields inside one section */
+static void switch_worker(void *arg)
+{
+    uint64_t value = (uintptr_t)arg * 0x0101010101010101UL;
+    for (int i = 0; i < SWITCH_ROUNDS; i++)
+    {
+        kernel_fpu_begin();
+        fpu_bench_park(value);
+        thread_yield();
+        if (fpu_bench_unpark() != value)
+        {
+            __atomic_add_fetch(&mismatches, 1, __ATOMIC_RELAXED);
+        }
+        kernel_fpu_end();
+    }
+    if (!__atomic_sub_fetch(&remaining, 1, __ATOMIC_SEQ_CST))
+    {
+        thread_wake(bench_thread);
+    }
+}
+
+static void bench_switch()
+{
+    unsigned int threads = cpu_count() * SWITCH_THREADS_PER_CPU;
+
+    __atomic_store_n(&remaining, threads, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&mismatches, 0, __ATOMIC_SEQ_CST);
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        if (!thread_create("fpu", switch_worker, (void *)(uintptr_t)(i + 1)))
+        {
+            kprintf("  out of memory\n");
+            return;
+        }
+    }
+    do
+    {
+        thread_prepare_block();
+        if (__atomic_load_n(&remaining, __ATOMIC_SEQ_CST))
+        {
+            thread_block();
+        }
+        else
+        {
+            thread_cancel_block();
+        }
+    } while (__atomic_load_n(&remaining, __ATOMIC_SEQ_CST));
+    uint64_t ns = tsc_to_ns(rdtsc() - start);
+
+    kprintf("  yield inside sections: %u threads, %u rounds each in %lu us, %u corrupted\n", threads,
+        SWITCH_ROUNDS, ns / 1000, mismatches);
+}
+
+void bench_fpu()
+{
+    bench_thread = current_thread();
+    bench_section();
+    bench_sum();
+    bench_switch();
+}
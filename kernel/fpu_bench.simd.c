@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/fpu_bench.simd.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * SIMD kernels of the FPU benchmark, built with SSE2
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef long long v2di_t __attribute__((vector_size(16)));
+typedef char v16qi_t __attribute__((vector_size(16)));
+
+/* Sum of len bytes, buf 16-byte aligned and len a multiple of 64 */
+uint64_t fpu_bench_sum_sse2(const uint8_t *buf, size_t len)
+{
+    const v16qi_t *vec = (const v16qi_t *)buf;
+    v16qi_t zero = {0};
+    v2di_t sum0 = {0, 0};
+    v2di_t sum1 = {0, 0};
+
+    // PSADBW against zero adds 8 bytes into each 64-bit lane
+    for (size_t i = 0; i < len / 16; i += 4)
+    {
+        sum0 += __builtin_ia32_psadbw128(vec[i], zero);
+        sum1 += __builtin_ia32_psadbw128(vec[i + 1], zero);
+        sum0 += __builtin_ia32_psadbw128(vec[i + 2], zero);
+        sum1 += __builtin_ia32_psadbw128(vec[i + 3], zero);
+    }
+    sum0 += sum1;
+    return sum0[0] + sum0[1];
+}
+
+/* Parks a value in a register no kernel code touches, to find it again after a switch */
+void fpu_bench_park(uint64_t value)
+{
+    asm volatile("movq xmm9, %0" : : "r"(value));
+}
+
+uint64_t fpu_bench_unpark()
+{
+    uint64_t value;
+    asm volatile("movq %0, xmm9" : "=r"(value));
+    return value;
+}
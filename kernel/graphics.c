@@ -29,28 +29,207 @@
  */
 
 #include <stdint.h>
+#include <asm/page.h>
 #include <boot/bootboot.h>
+#include <kernel/buddy.h>
 #include <kernel/graphics.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
 #include <kernel/psf.h>
+#include <kernel/spinlock.h>
+#include <kernel/time.h>
+#include <kernel/timer.h>
 
 extern BOOTBOOT bootboot;               // Infomation provided by BOOTBOOT Loader
 extern uint8_t fb;                      // linear framebuffer mapped
 
+static uint8_t *backbuffer = &fb;       // Drawn to, the framebuffer itself until graphics_init()
+static int shadowed;                    // backbuffer is a shadow copy which needs flushing
+
+static DEFINE_SPINLOCK(fb_lock);        // Protects the damage list and serializes flushes
+static rect_t dirty[FB_DIRTY_RECTS];
+static int dirty_count;
+
+static ktimer_t flush_timer;
+static int flush_batched;
+static void (*renderer)();
+
+/* Every glyph expanded for one colour pair, rows of width pixels laid out glyph after glyph */
+static struct
+{
+    PIXEL *pixels;
+    uint32_t numglyph;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;            // Pixels per row, even so rows copy as whole qwords
+    PIXEL fg;
+    PIXEL bg;
+    int ready;
+} atlas;
+
+static inline uint64_t rect_area(const rect_t *r)
+{
+    return (uint64_t)(r->x1 - r->x0) * (r->y1 - r->y0);
+}
+
+static inline void rect_union(rect_t *r, const rect_t *other)
+{
+    if (other->x0 < r->x0) r->x0 = other->x0;
+    if (other->y0 < r->y0) r->y0 = other->y0;
+    if (other->x1 > r->x1) r->x1 = other->x1;
+    if (other->y1 > r->y1) r->y1 = other->y1;
+}
+
+/* Overlapping or sharing an edge, so their union covers no undamaged pixels between them */
+static inline int rect_touches(const rect_t *a, const rect_t *b)
+{
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+/* Records damage, merging into a neighbour or, once the list is full, into the one growing least */
+static void mark_dirty(int x0, int y0, int x1, int y1)
+{
+    if (!shadowed)
+    {
+        return;
+    }
+
+    rect_t r = {x0, y0, x1, y1};
+    uint64_t flags = spin_lock_irqsave(&fb_lock);
+    int merge = -1;
+    int best = 0;
+    uint64_t best_growth = UINT64_MAX;
+    for (int i = 0; i < dirty_count; i++)
+    {
+        if (rect_touches(&dirty[i], &r))
+        {
+            merge = i;
+            break;
+        }
+        rect_t merged = dirty[i];
+        rect_union(&merged, &r);
+        uint64_t growth = rect_area(&merged) - rect_area(&dirty[i]);
+        if (growth < best_growth)
+        {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    if (merge < 0 && dirty_count == FB_DIRTY_RECTS)
+    {
+        merge = best;
+    }
+
+    if (merge >= 0)
+    {
+        rect_union(&dirty[merge], &r);
+    }
+    else
+    {
+        dirty[dirty_count++] = r;
+    }
+    spin_unlock_irqrestore(&fb_lock, flags);
+}
+
 void putpixel(int x, int y, PIXEL pixel)
 {
-    *(uint8_t *)(fb + y * bootboot.fb_scanline + x) = pixel;
+    if (x < 0 || y < 0 || x >= (int)bootboot.fb_width || y >= (int)bootboot.fb_height)
+    {
+        return;
+    }
+    *(PIXEL *)(backbuffer + y * bootboot.fb_scanline + x * sizeof(PIXEL)) = pixel;
+    mark_dirty(x, y, x + 1, y + 1);
 }
 
-void drawchar(char c, int cx, int cy, PIXEL fg, PIXEL bg)
+/* Clips the rectangle to the screen, moving the source point (sx, sy) along. Returns 0 if nothing is left */
+static int clip_rect(int *x, int *y, int *w, int *h, int *sx, int *sy)
+{
+    if (*x < 0)
+    {
+        *w += *x;
+        *sx -= *x;
+        *x = 0;
+    }
+    if (*y < 0)
+    {
+        *h += *y;
+        *sy -= *y;
+        *y = 0;
+    }
+    if (*x + *w > (int)bootboot.fb_width)
+    {
+        *w = bootboot.fb_width - *x;
+    }
+    if (*y + *h > (int)bootboot.fb_height)
+    {
+        *h = bootboot.fb_height - *y;
+    }
+    return *w > 0 && *h > 0;
+}
+
+void fill_rect(int x, int y, int w, int h, PIXEL pixel)
+{
+    int sx = 0, sy = 0;
+    if (!clip_rect(&x, &y, &w, &h, &sx, &sy))
+    {
+        return;
+    }
+    surface_t screen = {backbuffer, bootboot.fb_scanline};
+    fb_ops->fill_rect(&screen, x, y, w, h, pixel);
+    mark_dirty(x, y, x + w, y + h);
+}
+
+void copy_rect(int dx, int dy, int sx, int sy, int w, int h)
+{
+    // Clip the source first, then the destination, each moving the other along
+    if (!clip_rect(&sx, &sy, &w, &h, &dx, &dy) || !clip_rect(&dx, &dy, &w, &h, &sx, &sy))
+    {
+        return;
+    }
+    surface_t screen = {backbuffer, bootboot.fb_scanline};
+    fb_ops->copy_rect(&screen, dx, dy, sx, sy, w, h);
+    mark_dirty(dx, dy, dx + w, dy + h);
+}
+
+void blit_colorkey(int x, int y, int w, int h, const uint32_t *src, int src_stride, uint32_t key)
+{
+    int sx = 0, sy = 0;
+    if (!clip_rect(&x, &y, &w, &h, &sx, &sy))
+    {
+        return;
+    }
+    surface_t screen = {backbuffer, bootboot.fb_scanline};
+    fb_ops->blit_colorkey(&screen, x, y, w, h, src + sy * src_stride + sx, src_stride, key);
+    mark_dirty(x, y, x + w, y + h);
+}
+
+void blit_alpha(int x, int y, int w, int h, const uint32_t *src, int src_stride)
+{
+    int sx = 0, sy = 0;
+    if (!clip_rect(&x, &y, &w, &h, &sx, &sy))
+    {
+        return;
+    }
+    surface_t screen = {backbuffer, bootboot.fb_scanline};
+    fb_ops->blit_alpha(&screen, x, y, w, h, src + sy * src_stride + sx, src_stride);
+    mark_dirty(x, y, x + w, y + h);
+}
+
+void drawchar_bitmap(char c, int cx, int cy, PIXEL fg, PIXEL bg)
 {
     PSF_font *font = (PSF_font *)&_binary_font_psf_start;
 
     int bytesperline = (font->width + 7) / 8;
     uint8_t *glyph = (uint8_t *)&_binary_font_psf_start + font->headersize + (c > 0 && c < font->numglyph ? c : 0) * font->bytesperglyph;
 
-    int offs =
-        (cy * font->height * bootboot.fb_scanline) +
-        (cx * (font->width + 1) * sizeof(PIXEL));
+    int px = cx * (font->width + 1);
+    int py = cy * font->height;
+    if (px + font->width > bootboot.fb_width || py + font->height > bootboot.fb_height)
+    {
+        return;
+    }
+
+    int offs = py * bootboot.fb_scanline + px * sizeof(PIXEL);
     /* finally display pixels according to the bitmap */
     int x, y, line, mask;
     for (y = 0; y < font->height; y++)
@@ -61,7 +240,7 @@ void drawchar(char c, int cx, int cy, PIXEL fg, PIXEL bg)
         /* display a row */
         for (x = 0; x < font->width; x++)
         {
-            *((PIXEL *)(&fb + line)) = *((unsigned int *)glyph) & mask ? fg : bg;
+            *((PIXEL *)(backbuffer + line)) = *((unsigned int *)glyph) & mask ? fg : bg;
             /* adjust to the next pixel */
             mask >>= 1;
             line += sizeof(PIXEL);
@@ -70,4 +249,187 @@ void drawchar(char c, int cx, int cy, PIXEL fg, PIXEL bg)
         glyph += bytesperline;
         offs += bootboot.fb_scanline;
     }
-}
\ No newline at end of file
+    mark_dirty(px, py, px + font->width, py + font->height);
+}
+
+void drawchar(char c, int cx, int cy, PIXEL fg, PIXEL bg)
+{
+    if (!atlas.ready || fg != atlas.fg || bg != atlas.bg)
+    {
+        drawchar_bitmap(c, cx, cy, fg, bg);
+        return;
+    }
+
+    uint32_t width = atlas.width;
+    uint32_t height = atlas.height;
+    uint32_t px = cx * (width + 1);
+    uint32_t py = cy * height;
+    if (px + width > bootboot.fb_width || py + height > bootboot.fb_height)
+    {
+        return;
+    }
+
+    uint32_t index = c > 0 && (uint32_t)c < atlas.numglyph ? c : 0;
+    surface_t screen = {backbuffer, bootboot.fb_scanline};
+    fb_ops->glyph(&screen, px, py, width, height, atlas.pixels + index * atlas.stride * height, atlas.stride);
+    mark_dirty(px, py, px + width, py + height);
+}
+
+/* Caller serializes with drawing in the colours being replaced */
+static void glyph_atlas_expand()
+{
+    PSF_font *font = (PSF_font *)&_binary_font_psf_start;
+    uint32_t bytesperline = (font->width + 7) / 8;
+
+    PIXEL *dst = atlas.pixels;
+    for (uint32_t c = 0; c < atlas.numglyph; c++)
+    {
+        uint8_t *glyph = (uint8_t *)&_binary_font_psf_start + font->headersize + c * font->bytesperglyph;
+        for (uint32_t y = 0; y < font->height; y++)
+        {
+            for (uint32_t x = 0; x < font->width; x++)
+            {
+                dst[x] = glyph[x / 8] & (0x80 >> (x % 8)) ? atlas.fg : atlas.bg;
+            }
+            glyph += bytesperline;
+            dst += atlas.stride;
+        }
+    }
+    atlas.ready = 1;
+}
+
+void glyph_atlas_build(PIXEL fg, PIXEL bg)
+{
+    atlas.ready = 0;
+    atlas.fg = fg;
+    atlas.bg = bg;
+    if (atlas.pixels)
+    {
+        glyph_atlas_expand();
+    }
+}
+
+/* Allocates whole pages, both buffers are far bigger than what kmalloc() serves */
+static void *graphics_alloc(uint64_t size)
+{
+    unsigned int order = 0;
+    while ((PAGE_SIZE << order) < size)
+    {
+        order++;
+    }
+    uintptr_t phys = page_alloc(order);
+    return phys ? phys_to_virt(phys) : NULL;
+}
+
+/* Flushes are long runs of stores nobody reads back, which write-combining turns into full bursts */
+static void fb_set_write_combining()
+{
+    size_t size = PAGE_ALIGN(bootboot.fb_size);
+    if (paging_set_memtype((uintptr_t)&fb, size, MEMTYPE_WC) < 0)
+    {
+        kprintf("Framebuffer: keeping the loader's memory type\n");
+        return;
+    }
+    // The direct map may alias it, give both mappings the same type
+    paging_set_memtype((uintptr_t)phys_to_virt(bootboot.fb_ptr & PAGE_MASK), size, MEMTYPE_WC);
+    kprintf("Framebuffer: %lu KiB write-combining, MTRR type %s\n", size >> 10,
+        memtype_name(mtrr_type(bootboot.fb_ptr)));
+}
+
+void graphics_init()
+{
+    fb_set_write_combining();
+
+    PSF_font *font = (PSF_font *)&_binary_font_psf_start;
+    uint32_t stride = (font->width + 1) & ~1;
+    PIXEL *pixels = graphics_alloc((uint64_t)font->numglyph * font->height * stride * sizeof(PIXEL));
+    if (pixels)
+    {
+        atlas.numglyph = font->numglyph;
+        atlas.width = font->width;
+        atlas.height = font->height;
+        atlas.stride = stride;
+        atlas.pixels = pixels;
+        glyph_atlas_expand();
+    }
+
+    uint64_t size = (uint64_t)bootboot.fb_scanline * bootboot.fb_height;
+    uint8_t *shadow = graphics_alloc(size);
+    if (!shadow)
+    {
+        return;                         // Keep drawing straight to the framebuffer
+    }
+
+    copy_pixels(shadow, &fb, size / sizeof(PIXEL));
+    uint64_t flags = spin_lock_irqsave(&fb_lock);
+    backbuffer = shadow;
+    shadowed = 1;
+    spin_unlock_irqrestore(&fb_lock, flags);
+}
+
+void graphics_set_renderer(void (*render)())
+{
+    renderer = render;
+}
+
+void graphics_flush()
+{
+    if (renderer)
+    {
+        renderer();
+    }
+    if (!shadowed)
+    {
+        return;
+    }
+
+    // Copying under the lock keeps two flushes from writing the same pixels out of order
+    uint64_t flags = spin_lock_irqsave(&fb_lock);
+    for (int i = 0; i < dirty_count; i++)
+    {
+        rect_t *r = &dirty[i];
+        uint64_t offs = (uint64_t)r->y0 * bootboot.fb_scanline + r->x0 * sizeof(PIXEL);
+        if (r->x0 == 0 && r->x1 == (int)bootboot.fb_width)
+        {
+            // Full rows are contiguous, padding included
+            copy_pixels(&fb + offs, backbuffer + offs, (uint64_t)(r->y1 - r->y0) * bootboot.fb_scanline / sizeof(PIXEL));
+            continue;
+        }
+        for (int y = r->y0; y < r->y1; y++)
+        {
+            copy_pixels(&fb + offs, backbuffer + offs, r->x1 - r->x0);
+            offs += bootboot.fb_scanline;
+        }
+    }
+    dirty_count = 0;
+    spin_unlock_irqrestore(&fb_lock, flags);
+}
+
+static void flush_timer_fn(void *arg)
+{
+    (void)arg;
+    graphics_flush();
+}
+
+void graphics_commit()
+{
+    if (!shadowed || !__atomic_load_n(&flush_batched, __ATOMIC_ACQUIRE))
+    {
+        graphics_flush();
+        return;
+    }
+
+    // Armed only while output is pending, so an idle screen costs no wakeups
+    uint64_t flags = spin_lock_irqsave(&fb_lock);
+    if (!timer_pending(&flush_timer))
+    {
+        timer_arm(&flush_timer, ktime_get_ns() + NSEC_PER_SEC / FB_FLUSH_HZ);
+    }
+    spin_unlock_irqrestore(&fb_lock, flags);
+}
+
+void graphics_start_flush()
+{
+    timer_init(&flush_timer, flush_timer_fn, NULL);
+    __atomic_store_n(&flush_batched, 1, __ATOMIC_RELEASE);
+}
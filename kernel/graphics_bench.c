@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/graphics_bench.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Benchmark of glyph drawing
+ *
+ */
+
+#include <stdint.h>
+#include <boot/bootboot.h>
+#include <asm/cpu.h>
+#include <asm/tsc.h>
+#include <kernel/bench.h>
+#include <kernel/graphics.h>
+#include <kernel/kprintf.h>
+#include <kernel/psf.h>
+#include <kernel/tty.h>
+
+#define GLYPH_ROUNDS 100000
+
+extern BOOTBOOT bootboot;               // Infomation provided by BOOTBOOT Loader
+
+/* Draws into the shadow buffer only, the flush is left out so both paths are measured alone */
+static void bench_draw(const char *name, void (*draw)(char c, int cx, int cy, PIXEL fg, PIXEL bg))
+{
+    PSF_font *font = (PSF_font *)&_binary_font_psf_start;
+    int columns = bootboot.fb_width / (font->width + 1);
+    int rows = bootboot.fb_height / font->height;
+    PIXEL fg, bg;
+    terminal_getcolor(&fg, &bg);
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < GLYPH_ROUNDS; i++)
+    {
+        draw(' ' + i % 95, i % columns, i / columns % rows, fg, bg);
+    }
+    uint64_t ns = tsc_to_ns(rdtsc() - start);
+
+    kprintf("  %s: %u glyphs in %lu us, %lu glyphs/s\n", name, GLYPH_ROUNDS, ns / 1000,
+        ns ? GLYPH_ROUNDS * 1000000000UL / ns : 0);
+}
+
+void bench_glyph()
+{
+    bench_draw("bitmap", drawchar_bitmap);
+    bench_draw("atlas", drawchar);
+    terminal_redraw();
+}
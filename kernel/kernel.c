@@ -30,22 +30,111 @@
 
 #include <float.h>
 #include <stdint.h>
+#include <asm/alternative.h>
+#include <asm/apic.h>
+#include <asm/cpu.h>
+#include <asm/cpufeature.h>
+#include <asm/fpu.h>
+#include <asm/hpet.h>
 #include <asm/io.h>
+#include <asm/ioapic.h>
+#include <asm/tsc.h>
 #include <boot/bootboot.h>
+#include <kernel/acpi.h>
+#include <kernel/bench.h>
+#include <kernel/buddy.h>
+#include <kernel/env.h>
 #include <kernel/graphics.h>
 #include <kernel/interrupt.h>
+#include <kernel/klog.h>
+#include <kernel/paging.h>
+#include <kernel/pci.h>
+#include <kernel/sched.h>
 #include <kernel/serial.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/time.h>
+#include <kernel/timer.h>
+#include <kernel/topology.h>
 #include <kernel/tty.h>
+#include <kernel/virtio_console.h>
 #include <kernel/kprintf.h>
+#include <kernel/lockstat.h>
 
 extern BOOTBOOT bootboot;               // Infomation provided by BOOTBOOT Loader
 extern unsigned char environment[4096]; // configuration, UTF-8 text key=value pairs
 
+static serial_sink_t com1_console = SERIAL_SINK_INIT(PORT_COM1);
+static virtio_sink_t virtio_console = VIRTIO_SINK_INIT(-1);
+
+static void kernel_main()
+{
+    buddy_dump();
+    kprintf("Hello world! %u cores online\n", cpu_count());
+    lockstat_dump();
+
+    sched_init();
+    timers_init();
+    time_accumulate_start();
+    graphics_start_flush();
+    klog_init();
+    size_t length;
+    if (env_get("bench", &length) && length)
+    {
+        thread_create("bench", bench_run, NULL);
+    }
+    smp_start(sched_start);
+    sched_start();
+}
+
 /* Entry point, called by BOOTBOOT Loader */
 void _start()
 {
+    // BOOTBOOT starts every core here, the APs wait until the BSP has set up the kernel
+    if (cpu_apic_id() != bootboot.bspid)
+    {
+        smp_ap_entry();
+    }
+
+    smp_early_init();
+    cpu_detect();
     interrupt_init();
+    fb_ops_init();
     terminal_init();
-    kprintf("Hello world!");
-    hlt();
-}
\ No newline at end of file
+    apply_alternatives();
+    fpu_init();
+    acpi_init();
+    buddy_init();
+    paging_init();
+    kmalloc_init();
+    graphics_init();
+    uintptr_t hpet = acpi_hpet_address();
+    hpet_init(hpet ? hpet : HPET_DEFAULT_BASE);
+    tsc_init();
+    time_init();
+    apic_init();
+    if (acpi_madt_init() == 0)
+    {
+        ioapic_init(IOAPIC_DEFAULT_BASE, 0);
+    }
+    pci_init();
+    virtio_console_init();
+    // The raw klog stream owns COM1 unless a virtio port takes it, text would corrupt it
+    int com1_free = !env_contains("klog", "raw") || virtio_console_find("trace") >= 0;
+    if (serial_init(PORT_COM1, env_get_number("serial", SERIAL_DEFAULT_BAUD)) == 0 && com1_free)
+    {
+        kprintf_add_console(&com1_console.sink);
+    }
+    virtio_console.port = virtio_console_find("log");
+    if (virtio_console.port < 0)
+    {
+        virtio_console.port = virtio_console_find(NULL);
+    }
+    if (virtio_console.port >= 0)
+    {
+        kprintf_add_console(&virtio_console.sink);
+    }
+    smp_init();
+    topology_init();
+    call_on_stack(this_cpu()->stack_top, kernel_main);
+}
@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/klog.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Deferred binary logging into per-CPU rings
+ *
+ */
+
+#include <stdint.h>
+#include <asm/page.h>
+#include <asm/tsc.h>
+#include <kernel/buddy.h>
+#include <kernel/env.h>
+#include <kernel/errno.h>
+#include <kernel/klog.h>
+#include <kernel/kprintf.h>
+#include <kernel/sched.h>
+#include <kernel/serial.h>
+#include <kernel/slab.h>
+#include <kernel/time.h>
+#include <kernel/timer.h>
+#include <kernel/virtio_console.h>
+
+/* Starts the raw stream, lets the decoder convert timestamps */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t record_size;
+    uint64_t tsc_khz;
+    uint64_t tsc_epoch;         // TSC at ktime 0
+} klog_stream_header_t;
+
+/* Records of one ring on their way to the trace port, sent in place */
+typedef struct
+{
+    virtio_console_req_t req;
+    klog_ring_t *ring;
+    uint64_t end;
+    int busy;
+} klog_batch_t;
+
+klog_ring_t *klog_rings[MAX_CPUS];
+
+static int klog_raw;
+static int trace_port = -ENOENT;        // virtio-console port named "trace", COM1 carries the stream without it
+static klog_batch_t batches[MAX_CPUS];
+
+/* The raw stream must not lose bytes, so wait for the port rather than spinning on it */
+static void klog_send(const void *data, size_t length)
+{
+    if (trace_port >= 0)
+    {
+        static virtio_console_req_t req;    // The device may still hold it if the flush gives up
+        req.buf = data;
+        req.len = length;
+        while (virtio_console_submit(trace_port, &req) < 0)
+        {
+            sleep_ns(NSEC_PER_MSEC);
+        }
+        virtio_console_flush(trace_port);
+        return;
+    }
+
+    const char *p = data;
+    for (;;)
+    {
+        size_t sent = serial_write(PORT_COM1, p, length);
+        p += sent;
+        length -= sent;
+        if (!length)
+        {
+            break;
+        }
+        sleep_ns(NSEC_PER_MSEC);
+    }
+}
+
+static void klog_print(const klog_record_t *record)
+{
+    uint64_t ns = tsc_to_ns(record->tsc - tsc_epoch);
+    char line[256];
+    int length = snkprintf(line, sizeof(line), "[%5lu.%06lu] cpu%u: ", ns / NSEC_PER_SEC,
+        ns % NSEC_PER_SEC / NSEC_PER_USEC, record->cpu);
+    wsnkprintf(line + length, sizeof(line) - length, record->fmt, record->args);
+    kprintf("%s", line);
+}
+
+static void klog_sent(virtio_console_req_t *req)
+{
+    klog_batch_t *batch = req->arg;
+    // Only now may the writer reuse the slots
+    __atomic_store_n(&batch->ring->tail, batch->end, __ATOMIC_RELEASE);
+    __atomic_store_n(&batch->busy, 0, __ATOMIC_RELEASE);
+}
+
+/* Hands the device the records straight from the ring, up to where it wraps */
+static void klog_submit(klog_ring_t *ring, klog_batch_t *batch)
+{
+    if (__atomic_load_n(&batch->busy, __ATOMIC_ACQUIRE))
+    {
+        virtio_console_poll(trace_port);
+        if (__atomic_load_n(&batch->busy, __ATOMIC_ACQUIRE))
+        {
+            return;
+        }
+    }
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail == head)
+    {
+        return;
+    }
+    uint64_t first = tail & (KLOG_RING_SIZE - 1);
+    uint64_t count = head - tail;
+    if (first + count > KLOG_RING_SIZE)
+    {
+        count = KLOG_RING_SIZE - first;
+    }
+
+    batch->ring = ring;
+    batch->end = tail + count;
+    batch->req.buf = &ring->records[first];
+    batch->req.len = count * sizeof(klog_record_t);
+    batch->req.done = klog_sent;
+    batch->req.arg = batch;
+    __atomic_store_n(&batch->busy, 1, __ATOMIC_RELAXED);
+    if (virtio_console_submit(trace_port, &batch->req) < 0)
+    {
+        __atomic_store_n(&batch->busy, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void klog_drain(klog_ring_t *ring)
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (; tail != head; tail++)
+    {
+        klog_record_t *record = &ring->records[tail & (KLOG_RING_SIZE - 1)];
+        if (klog_raw)
+        {
+            klog_send(record, sizeof(*record));
+        }
+        else
+        {
+            klog_print(record);
+        }
+        // Frees the slot, the writer may reuse it from here on
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void klogd(void *arg)
+{
+    (void)arg;
+    if (klog_raw)
+    {
+        klog_stream_header_t header = {KLOG_MAGIC, sizeof(klog_record_t), tsc_khz, tsc_epoch};
+        klog_send(&header, sizeof(header));
+    }
+
+    static uint64_t dropped[MAX_CPUS];  // Already reported
+    for (;;)
+    {
+        for (unsigned int id = 0; id < cpu_count(); id++)
+        {
+            klog_ring_t *ring = klog_rings[id];
+            if (!ring)
+            {
+                continue;
+            }
+            if (klog_raw && trace_port >= 0)
+            {
+                klog_submit(ring, &batches[id]);
+            }
+            else
+            {
+                klog_drain(ring);
+            }
+            uint64_t lost = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+            if (lost != dropped[id] && !klog_raw)
+            {
+                kprintf("klog: cpu%u dropped %lu events\n", id, lost - dropped[id]);
+                dropped[id] = lost;
+            }
+        }
+        sleep_ns(KLOG_POLL_MS * NSEC_PER_MSEC);
+    }
+}
+
+void klog_init()
+{
+    for (unsigned int id = 0; id < cpu_count(); id++)
+    {
+        klog_ring_t *ring = kmalloc(sizeof(klog_ring_t));
+        uintptr_t records = page_alloc(KLOG_RING_ORDER);
+        if (!ring || !records)
+        {
+            kprintf("klog: out of memory, fast logging disabled on cpu%u\n", id);
+            kfree(ring);
+            continue;
+        }
+        ring->records = phys_to_virt(records);
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        __atomic_store_n(&klog_rings[id], ring, __ATOMIC_RELEASE);
+    }
+
+    klog_raw = env_contains("klog", "raw");
+    trace_port = virtio_console_find("trace");
+    thread_create("klogd", klogd, NULL);
+}
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/klog_bench.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Benchmark of deferred logging against formatting
+ *
+ */
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/page.h>
+#include <asm/tsc.h>
+#include <kernel/bench.h>
+#include <kernel/buddy.h>
+#include <kernel/klog.h>
+#include <kernel/kprintf.h>
+
+#define KLOG_BENCH_ROUNDS 64
+
+/* Records into a private ring emptied after every pass, so nothing reaches klogd or gets dropped */
+static uint64_t bench_records(klog_ring_t *ring)
+{
+    uint64_t cycles = 0;
+    for (int round = 0; round < KLOG_BENCH_ROUNDS; round++)
+    {
+        uint64_t flags = irq_save();
+        uint64_t start = rdtsc();
+        for (uint64_t i = 0; i < KLOG_RING_SIZE; i++)
+        {
+            klog_ring_write(ring, "event %lu at %p flags %#x\n", 3, i, (uint64_t)ring, 0x42, 0, 0);
+        }
+        cycles += rdtsc() - start;
+        irq_restore(flags);
+        ring->tail = ring->head;
+    }
+    return cycles;
+}
+
+static uint64_t bench_format()
+{
+    char line[128];
+    uint64_t cycles = 0;
+    for (int round = 0; round < KLOG_BENCH_ROUNDS; round++)
+    {
+        uint64_t flags = irq_save();
+        uint64_t start = rdtsc();
+        for (uint64_t i = 0; i < KLOG_RING_SIZE; i++)
+        {
+            snkprintf(line, sizeof(line), "event %lu at %p flags %#x\n", i, line, 0x42);
+        }
+        cycles += rdtsc() - start;
+        irq_restore(flags);
+    }
+    return cycles;
+}
+
+void bench_klog()
+{
+    uintptr_t records = page_alloc(KLOG_RING_ORDER);
+    if (!records)
+    {
+        kprintf("  out of memory\n");
+        return;
+    }
+    klog_ring_t ring;
+    ring.records = phys_to_virt(records);
+    ring.head = 0;
+    ring.tail = 0;
+    ring.dropped = 0;
+
+    uint64_t events = KLOG_BENCH_ROUNDS * KLOG_RING_SIZE;
+    uint64_t record_ns = tsc_to_ns(bench_records(&ring));
+    uint64_t format_ns = tsc_to_ns(bench_format());
+    kprintf("  klog_fast: %lu events, %lu ns/event\n", events, record_ns / events);
+    kprintf("  snkprintf: %lu events, %lu ns/event\n", events, format_ns / events);
+
+    page_free(records, KLOG_RING_ORDER);
+}
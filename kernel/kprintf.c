@@ -29,18 +29,14 @@
  */
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <kernel/kprintf.h>
+#include <kernel/serial.h>
+#include <kernel/spinlock.h>
+#include <kernel/string.h>
 #include <kernel/tty.h>
 
-enum FORMAT_STATE
-{
-    INTRODUCE,
-    FLAG,
-    WIDTH,
-    PRECISION,
-    SIZE,
-    SPECIFIER,
-};
-
 enum FORMAT_FLAGS
 {
     NONE = 0,
@@ -53,6 +49,7 @@ enum FORMAT_FLAGS
 
 enum FORMAT_SIZE
 {
+    DEFAULT,
     CHAR,
     SHORT,
     LONG,
@@ -63,7 +60,172 @@ enum FORMAT_SIZE
     LONG_DOUBLE,
 };
 
-void print_int(long long value, char **pstr, char type, enum FORMAT_FLAGS flags, int width, int precision)
+/* One formatting pass, collects output into chunks for the sink chain */
+typedef struct
+{
+    kprintf_sink_t *sink;
+    size_t count;               // Characters produced so far, for %n and the return value
+    size_t used;
+    char chunk[KPRINTF_CHUNK];
+} output_t;
+
+/* Arguments of one pass, from a va_list or from raw words recorded by klog_fast() */
+typedef struct
+{
+    va_list *ap;
+    const uint64_t *words;
+} args_t;
+
+#define NEXT_ARG(args, type) ((args)->words ? (type)*(args)->words++ : va_arg(*(args)->ap, type))
+
+static void tty_sink_write(kprintf_sink_t *sink, const char *s, size_t length);
+
+static char log_buf[KPRINTF_LOG_SIZE];
+ring_sink_t kprintf_log = RING_SINK_INIT(log_buf, KPRINTF_LOG_SIZE);
+static kprintf_sink_t tty_sink = {.write = tty_sink_write, .next = &kprintf_log.sink};
+
+static DEFINE_SPINLOCK(console_lock);  // Keeps messages whole, every core prints
+static kprintf_sink_t *console = &tty_sink;
+
+static void tty_sink_write(kprintf_sink_t *sink, const char *s, size_t length)
+{
+    (void)sink;
+    terminal_write(s, length);
+}
+
+static void string_sink_write(kprintf_sink_t *sink, const char *s, size_t length)
+{
+    string_sink_t *str = (string_sink_t *)sink;
+    if (str->length + 1 < str->size)
+    {
+        // Keeps counting past the end like snprintf, only what fits is copied
+        size_t room = str->size - 1 - str->length;
+        memcpy(str->buf + str->length, s, length < room ? length : room);
+    }
+    str->length += length;
+}
+
+void ring_sink_write(kprintf_sink_t *sink, const char *s, size_t length)
+{
+    ring_sink_t *ring = (ring_sink_t *)sink;
+    for (size_t i = 0; i < length; i++)
+    {
+        ring->buf[ring->head++ & (ring->size - 1)] = s[i];
+    }
+}
+
+void serial_sink_write(kprintf_sink_t *sink, const char *s, size_t length)
+{
+    // Runs under console_lock with interrupts off, waiting for the UART here would stall every caller
+    serial_sink_t *serial = (serial_sink_t *)sink;
+    size_t sent = serial_write(serial->port, s, length);
+    if (sent < length)
+    {
+        __atomic_add_fetch(&serial->dropped, length - sent, __ATOMIC_RELAXED);
+    }
+}
+
+static void output_flush(output_t *out)
+{
+    if (out->used)
+    {
+        for (kprintf_sink_t *sink = out->sink; sink; sink = sink->next)
+        {
+            sink->write(sink, out->chunk, out->used);
+        }
+        out->used = 0;
+    }
+}
+
+static inline void output_char(output_t *out, char c)
+{
+    if (out->used == KPRINTF_CHUNK)
+    {
+        output_flush(out);
+    }
+    out->chunk[out->used++] = c;
+    out->count++;
+}
+
+static void output_repeat(output_t *out, char c, int count)
+{
+    while (count-- > 0)
+    {
+        output_char(out, c);
+    }
+}
+
+/* Strings too long for the chunk go straight to the sinks without a copy */
+static void output_string(output_t *out, const char *s, size_t length)
+{
+    if (length >= KPRINTF_CHUNK)
+    {
+        output_flush(out);
+        for (kprintf_sink_t *sink = out->sink; sink; sink = sink->next)
+        {
+            sink->write(sink, s, length);
+        }
+        out->count += length;
+        return;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        output_char(out, s[i]);
+    }
+}
+
+#define INT_FIELD_SIZE 96         // Fields up to this wide are built in one piece
+
+/* "00" to "99", so decimal conversion divides once per two digits */
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Writes the digits of value so they end right before p, returns their start */
+static char *format_digits(char *p, unsigned long long value, int radix, int upper)
+{
+    if (radix == 10)
+    {
+        while (value >= 100)
+        {
+            unsigned long long quotient = value / 100;
+            const char *pair = &digit_pairs[(value - quotient * 100) * 2];
+            value = quotient;
+            *--p = pair[1];
+            *--p = pair[0];
+        }
+        if (value >= 10)
+        {
+            *--p = digit_pairs[value * 2 + 1];
+            *--p = digit_pairs[value * 2];
+        }
+        else
+        {
+            *--p = '0' + value;
+        }
+        return p;
+    }
+
+    // Power of two radix, digits are bit fields
+    const char *charset = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    int shift = radix == 16 ? 4 : 3;
+    do
+    {
+        *--p = charset[value & (radix - 1)];
+        value >>= shift;
+    } while (value);
+    return p;
+}
+
+/*
+ * Builds the field backwards from the last digit, so digits, zeros, prefix and padding land in their
+ * final place and go out in one piece
+ */
+static void print_int(output_t *out, unsigned long long magnitude, int negative, char type,
+    enum FORMAT_FLAGS flags, int width, int precision)
 {
     int radix;
     switch (type)
@@ -85,380 +247,407 @@ void print_int(long long value, char **pstr, char type, enum FORMAT_FLAGS flags,
         return;
     }
 
-    int length = 0;                 // Length of string, includes prefix
+    char field[INT_FIELD_SIZE];
+    char *end = field + INT_FIELD_SIZE;
+    char *p = end;
+    if (magnitude || precision)
+    {
+        p = format_digits(end, magnitude, radix, type == 'X');
+    }
+    int digitcount = end - p;   // Number of digits, don't include prefix
+
+    char prefix[2];
+    int prefixcount = 0;
     if (type == 'd' || type == 'i') // signed demical number
     {
-        if (value < 0)
+        if (negative)
         {
-            *(*pstr)++ = '-';
-            length++;
+            prefix[prefixcount++] = '-';
         }
         else if (flags & PREFIX_SIGN)
         {
-            *(*pstr)++ = '+';
-            length++;
+            prefix[prefixcount++] = '+';
         }
         else if (flags & PREFIX_BLANK)
         {
-            *(*pstr)++ = ' ';
-            length++;
+            prefix[prefixcount++] = ' ';
         }
     }
+    int padding_zero_count = precision > digitcount ? precision - digitcount : 0;
+    if (flags & ALTERNATE && radix == 16 && magnitude)
+    {
+        prefix[prefixcount++] = '0';
+        prefix[prefixcount++] = type;
+    }
+    else if (flags & ALTERNATE && radix == 8 && !padding_zero_count && (!digitcount || *p != '0'))
+    {
+        prefix[prefixcount++] = '0';    // Octal only needs a leading zero
+    }
 
-    if (flags & ALTERNATE && (radix == 8 || radix == 16) && value)
+    // Zeros go between the prefix and the digits, blanks outside
+    int length = prefixcount + padding_zero_count + digitcount;
+    int padding_blank_count = 0;
+    if (length < width)
     {
-        *(*pstr)++ = '0';
-        length++;
-        if (type == 'x')
+        if (flags & ZERO_PADDED && !(flags & LEFT_ALIGN) && precision < 0)
         {
-            *(*pstr)++ = 'x';
-            length++;
+            padding_zero_count += width - length;
         }
-        else if (type == 'X')
+        else
         {
-            *(*pstr)++ = 'X';
-            length++;
+            padding_blank_count = width - length;
         }
-        
     }
-    
-    char *low = *pstr;
 
-    int digitcount = 0; // Number of digits, don't include prefix
-    do
+    int leading_blanks = flags & LEFT_ALIGN ? 0 : padding_blank_count;
+    if (padding_zero_count + prefixcount + leading_blanks > p - field)
     {
-        // The modulo of a negative number is a negative number. This trick makes absolute values unnecessary
-        *(*pstr)++ = (type == 'X' ? "FEDCBA9876543210123456789ABCDEF" : "fedcba9876543210123456789abcdef")[15 + value % radix];
-        value /= radix;
-        digitcount++;
-    } while (value);
-    length += digitcount;
+        // Wider than the field buffer, only the digits were built in place
+        output_repeat(out, ' ', leading_blanks);
+        output_string(out, prefix, prefixcount);
+        output_repeat(out, '0', padding_zero_count);
+        output_string(out, p, digitcount);
+    }
+    else
+    {
+        while (padding_zero_count--)
+        {
+            *--p = '0';
+        }
+        while (prefixcount)
+        {
+            *--p = prefix[--prefixcount];
+        }
+        while (leading_blanks--)
+        {
+            *--p = ' ';
+        }
+        output_string(out, p, end - p);
+    }
+    if (flags & LEFT_ALIGN)
+    {
+        output_repeat(out, ' ', padding_blank_count);
+    }
+}
 
-    // Reverse the string
-    char *i = low, *j = *pstr - 1;
-    while (i < j)
+static int parse_number(const char **pformat)
+{
+    int num = 0;
+    while (**pformat >= '0' && **pformat <= '9')
     {
-        char tmp = *i;
-        *i++ = *j;
-        *j-- = tmp;
+        num = num * 10 + *(*pformat)++ - '0';
     }
+    return num;
+}
 
-    // Add paddings according to width and precision
-    int padding_zero_count;
-    if (digitcount < precision)
+/* Integer argument of the given size, sign extended or not depending on the specifier */
+static unsigned long long fetch_int(args_t *arg, enum FORMAT_SIZE size, int is_signed)
+{
+    switch (size)
     {
-        padding_zero_count = precision - digitcount;
+    // Due to the default type promotion of C, char and short will promote to int.
+    case CHAR:
+        return is_signed ? (long long)(signed char)NEXT_ARG(arg, int) : (unsigned char)NEXT_ARG(arg, int);
+    case SHORT:
+        return is_signed ? (long long)(short)NEXT_ARG(arg, int) : (unsigned short)NEXT_ARG(arg, int);
+    case LONG:
+    case LONG_LONG:
+    case INTMAX:
+    case SIZE_T:
+    case PTRDIFF_T:
+        return NEXT_ARG(arg, unsigned long long);
+    default:
+        return is_signed ? (long long)NEXT_ARG(arg, int) : NEXT_ARG(arg, unsigned int);
     }
-    int padded_length = length + padding_zero_count;
-    int padding_blank_count;
-    if (padded_length < width)
+}
+
+/* Handles one conversion, *pformat points after the '%' and is left after the specifier */
+static void parse_format(output_t *out, const char **pformat, args_t *arg)
+{
+    enum FORMAT_FLAGS flags = NONE;
+    enum FORMAT_SIZE size = DEFAULT;
+    int width = -1;
+    int precision = -1;
+
+    for (;; (*pformat)++)
     {
-        if (flags & ZERO_PADDED && !(flags & LEFT_ALIGN))
+        if (**pformat == '#')
+        {
+            flags |= ALTERNATE;
+        }
+        else if (**pformat == '0')
+        {
+            flags |= ZERO_PADDED;
+        }
+        else if (**pformat == '-')
+        {
+            flags |= LEFT_ALIGN;
+        }
+        else if (**pformat == ' ')
+        {
+            flags |= PREFIX_BLANK;
+        }
+        else if (**pformat == '+')
         {
-            padding_zero_count += width - padded_length;
+            flags |= PREFIX_SIGN;
         }
         else
         {
-            padding_blank_count = width - padded_length;
+            break;
         }
     }
-    int padding_total_count = padding_zero_count + (flags & LEFT_ALIGN ? 0 : padding_blank_count);
-    
-    // Move string to place paddings
-    char *high = *pstr - 1;
-    if (padding_total_count)
+
+    if (**pformat == '*')
     {
-        while (high >= low)
+        width = NEXT_ARG(arg, int);
+        if (width < 0)
         {
-            *(high + padding_total_count + 1) = *high--;
+            flags |= LEFT_ALIGN;
+            width = -width;
         }
+        (*pformat)++;
     }
-    *pstr += padding_total_count;
-    
-    if (padding_blank_count)
+    else if (**pformat >= '0' && **pformat <= '9')
     {
-        if (flags & LEFT_ALIGN)
+        width = parse_number(pformat);
+    }
+
+    if (**pformat == '.')
+    {
+        (*pformat)++;
+        if (**pformat == '*')
         {
-            for (int i = 0; i < padding_blank_count; i++)
-            {
-                *(*pstr)++ = ' ';
-            }
+            precision = NEXT_ARG(arg, int);
+            (*pformat)++;
         }
         else
         {
-            for (int i = 0; i < padding_blank_count; i++)
-            {
-                *(low + i) = ' ';
-            }
+            precision = parse_number(pformat);
         }
     }
-    if (padding_zero_count)
+
+    switch (**pformat)
     {
-        for (int i = 0; i < padding_zero_count; i++)
+    case 'h':
+        size = SHORT;
+        if (*(++*pformat) == 'h')
         {
-            *(low + (flags & LEFT_ALIGN ? 0 : padding_blank_count) + i) = '0';
+            size = CHAR;
+            (*pformat)++;
         }
+        break;
+    case 'l':
+        size = LONG;
+        if (*(++*pformat) == 'l')
+        {
+            size = LONG_LONG;
+            (*pformat)++;
+        }
+        break;
+    case 'L':
+        size = LONG_DOUBLE;
+        (*pformat)++;
+        break;
+    case 'j':
+        size = INTMAX;
+        (*pformat)++;
+        break;
+    case 'z':
+        size = SIZE_T;
+        (*pformat)++;
+        break;
+    case 't':
+        size = PTRDIFF_T;
+        (*pformat)++;
+        break;
+    default:
+        break;
     }
-}
 
-int atoi(char **pstr)
-{
-    while (**pstr == ' ')
+    char specifier = **pformat;
+    if (specifier)
     {
-        *(*pstr)++;
-    };
-
-    int num = 0;
-    int neg;
-    if (**pstr == '-')
+        (*pformat)++;
+    }
+    switch (specifier)
+    {
+    case '%':
+        output_char(out, '%');
+        return;
+    case 'd':
+    case 'i':
     {
-        neg = 1;
-        *pstr++;
+        long long value = fetch_int(arg, size, 1);
+        // Negating in unsigned arithmetic keeps the most negative value intact
+        print_int(out, value < 0 ? -(unsigned long long)value : (unsigned long long)value, value < 0,
+            specifier, flags, width, precision);
+        return;
     }
-    else if (**pstr == '+')
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        print_int(out, fetch_int(arg, size, 0), 0, specifier, flags, width, precision);
+        return;
+    case 'c':
     {
-        neg = 0;
-        *pstr++;
+        char c = NEXT_ARG(arg, int);
+        if (!(flags & LEFT_ALIGN))
+        {
+            output_repeat(out, ' ', width - 1);
+        }
+        output_char(out, c);
+        if (flags & LEFT_ALIGN)
+        {
+            output_repeat(out, ' ', width - 1);
+        }
+        return;
     }
-    else
+    case 's':
     {
-        neg = 0;
+        const char *s = NEXT_ARG(arg, const char *);
+        if (!s)
+        {
+            s = "(null)";
+        }
+        size_t length = 0;
+        while (s[length] && (precision < 0 || length < (size_t)precision))
+        {
+            length++;
+        }
+        if (!(flags & LEFT_ALIGN))
+        {
+            output_repeat(out, ' ', width - (int)length);
+        }
+        output_string(out, s, length);
+        if (flags & LEFT_ALIGN)
+        {
+            output_repeat(out, ' ', width - (int)length);
+        }
+        return;
     }
-
-    while (**pstr >= '0' && **pstr <= '9')
+    case 'p':
+        // %p outputs as %#lx
+        print_int(out, (uintptr_t)NEXT_ARG(arg, void *), 0, 'x', flags | ALTERNATE, width, precision);
+        return;
+    case 'n':
     {
-        num = num * 10 + *(*pstr)++ - '0';
+        void *ptr = NEXT_ARG(arg, void *);
+        switch (size)
+        {
+        case CHAR:
+            *(signed char *)ptr = out->count;
+            return;
+        case SHORT:
+            *(short *)ptr = out->count;
+            return;
+        case LONG:
+        case LONG_LONG:
+        case INTMAX:
+        case SIZE_T:
+        case PTRDIFF_T:
+            *(long long *)ptr = out->count;
+            return;
+        default:
+            *(int *)ptr = out->count;
+            return;
+        }
+    }
+    default:
+        return;
     }
-    if (neg)
+}
+
+/* Copies literal runs in one piece and hands conversions to parse_format() */
+static void format_output(output_t *out, const char *format, args_t *arg)
+{
+    while (*format)
     {
-        num *= -1;
+        const char *run = format;
+        while (*format && *format != '%')
+        {
+            format++;
+        }
+        output_string(out, run, format - run);
+        if (*format == '%')
+        {
+            format++;
+            parse_format(out, &format, arg);
+        }
     }
-    return num;
+    output_flush(out);
 }
 
-void parse_format(char **pstr, const char **pformat, va_list arg, char *low)
+int vfkprintf(kprintf_sink_t *sink, const char *format, va_list arg)
 {
-    enum FORMAT_STATE state = INTRODUCE;
-    enum FORMAT_FLAGS flags = NONE;
-    enum FORMAT_SIZE size = -1;
-    unsigned int width = -1;
-    unsigned int precision = -1;
+    output_t out;
+    out.sink = sink;
+    out.count = 0;
+    out.used = 0;
 
-    do
+    va_list ap;
+    va_copy(ap, arg);
+    args_t args = {.ap = &ap, .words = NULL};
+    format_output(&out, format, &args);
+    va_end(ap);
+    return out.count;
+}
+
+int wkprintf(kprintf_sink_t *sink, const char *format, const uint64_t *words)
+{
+    output_t out;
+    out.sink = sink;
+    out.count = 0;
+    out.used = 0;
+
+    args_t args = {.ap = NULL, .words = words};
+    format_output(&out, format, &args);
+    return out.count;
+}
+
+int fkprintf(kprintf_sink_t *sink, const char *format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    int ret = vfkprintf(sink, format, arg);
+    va_end(arg);
+    return ret;
+}
+
+int wsnkprintf(char *str, size_t size, const char *format, const uint64_t *words)
+{
+    string_sink_t sink = {.sink = {.write = string_sink_write}, .buf = str, .size = size};
+    int ret = wkprintf(&sink.sink, format, words);
+    if (size)
     {
-        if (state <= FLAG)
-        {
-            switch (**pformat)
-            {
-            case '#':
-                flags |= ALTERNATE;
-                state = FLAG;
-                continue;
-            case '0':
-                flags |= ZERO_PADDED;
-                state = FLAG;
-                continue;
-            case '-':
-                flags |= LEFT_ALIGN;
-                state = FLAG;
-                continue;
-            case ' ':
-                flags |= PREFIX_BLANK;
-                state = FLAG;
-                continue;
-            case '+':
-                flags |= PREFIX_SIGN;
-                state = FLAG;
-                continue;
-            default:
-                state = WIDTH;
-                break;
-            }
-        }
-        if (state <= WIDTH)
-        {
-            if (**pformat == '*')
-            {
-                width = va_arg(arg, int);
-            }
-            else
-            {
-                width = atoi(pformat);
-            }
-            state = WIDTH;
-        }
-        if (state < PRECISION)
-        {
-            if (**pformat == '.')
-            {
-                state = PRECISION;
-                continue;
-            }
-        }
-        if (state == PRECISION)
-        {
-            if (**pformat == '*')
-            {
-                precision = va_arg(arg, int);
-            }
-            else
-            {
-                precision = atoi(pformat);
-            }
-            state = SIZE;
-        }
-        if (state <= SIZE)
-        {
-            switch (**pformat)
-            {
-            case 'h':
-                if (*(*pformat + 1) == 'h')
-                {
-                    size = CHAR;
-                }
-                else
-                {
-                    size = SHORT;
-                }
-                state = SPECIFIER;
-                continue;
-            case 'l':
-                if (*(*pformat + 1) == 'l')
-                {
-                    size = LONG_LONG;
-                    *(*pformat)++;
-                }
-                else
-                {
-                    size = LONG;
-                }
-                state = SPECIFIER;
-                continue;
-            case 'L':
-                size = LONG_DOUBLE;
-                state = SPECIFIER;
-                continue;
-            case 'J':
-                size = INTMAX;
-                state = SPECIFIER;
-                continue;
-            case 'z':
-                size = SIZE_T;
-                state = SPECIFIER;
-                continue;
-            case 't':
-                size = PTRDIFF_T;
-                state = SPECIFIER;
-                continue;
-            default:
-                state = SPECIFIER;
-                break;
-            }
-        }
-        if (state <= SPECIFIER)
-        {
-            switch (**pformat)
-            {
-            case '%':
-                *pstr++;
-                *(*pstr)++ = '%';
-                return;
-            case 'd':
-            case 'i':
-            case 'o':
-            case 'u':
-            case 'x':
-            case 'X':
-                switch (size)
-                {
-                // Due to the default type promotion of C, char and short will promote to int.
-                case CHAR:
-                    char hhdata = va_arg(arg, int);
-                    print_int(hhdata, pstr, **pformat, flags, width, precision);
-                    return;
-                case SHORT:
-                    short hdata = va_arg(arg, int);
-                    print_int(hdata, pstr, **pformat, flags, width, precision);
-                    return;
-                case LONG:
-                    long ldata = va_arg(arg, long);
-                    print_int(ldata, pstr, **pformat, flags, width, precision);
-                    return;
-                case LONG_LONG:
-                    long long lldata = va_arg(arg, long long);
-                    print_int(lldata, pstr, **pformat, flags, width, precision);
-                    return;
-                default:
-                    int idata = va_arg(arg, int);
-                    print_int(idata, pstr, **pformat, flags, width, precision);
-                    return;
-                }
-            case 'c':
-                char c = va_arg(arg, int);
-                *(*pstr)++ = c;
-                return;
-            case 's':
-                char *s = va_arg(arg, char *);
-                while (*s)
-                {
-                    *(*pstr)++ = *s++;
-                }
-                return;
-            case 'p':
-                void *ptr = va_arg(arg, void*);
-                // %p outputs as %#x or %#lx
-                print_int(ptr, pstr, 'x', flags | ALTERNATE, width, precision);
-                return;
-            case 'n':
-                switch (size)
-                {
-                // Due to the default type promotion of C, char and short will promote to int.
-                case CHAR:
-                    char *hhptr = va_arg(arg, int*);
-                    *hhptr = *pstr - low + 1;
-                    return;
-                case SHORT:
-                    short *hptr = va_arg(arg, int*);
-                    *hptr = *pstr - low + 1;
-                    return;
-                case LONG:
-                    long *lptr = va_arg(arg, long*);
-                    *lptr = *pstr - low + 1;
-                    return;
-                case LONG_LONG:
-                    long long *llptr = va_arg(arg, long long*);
-                    *llptr = *pstr - low + 1;
-                    return;
-                default:
-                    int *iptr = va_arg(arg, int*);
-                    *iptr = *pstr - low + 1;
-                    return;
-                }
-            default:
-                break;
-            }
-        }
-    } while (*(*pformat)++);
+        str[sink.length < size ? sink.length : size - 1] = '\0';
+    }
+    return ret;
 }
 
-int vskprintf(char *str, const char *format, va_list arg)
+int vsnkprintf(char *str, size_t size, const char *format, va_list arg)
 {
-    char *low = str;
-    do
+    string_sink_t sink = {.sink = {.write = string_sink_write}, .buf = str, .size = size};
+    int ret = vfkprintf(&sink.sink, format, arg);
+    if (size)
     {
-        if (*format == '%')
-        {
-            format++;
-            parse_format(&str, &format, arg, low);
-        }
-        else
-        {
-            *str++ = *format;
-        }
+        str[sink.length < size ? sink.length : size - 1] = '\0';
+    }
+    return ret;
+}
 
-    } while (*format++);
-    *str = '\0';
-    return str - low;
+int snkprintf(char *str, size_t size, const char *format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    int ret = vsnkprintf(str, size, format, arg);
+    va_end(arg);
+    return ret;
+}
+
+int vskprintf(char *str, const char *format, va_list arg)
+{
+    return vsnkprintf(str, SIZE_MAX, format, arg);
 }
 
 int skprintf(char *str, const char *format, ...)
@@ -470,19 +659,32 @@ int skprintf(char *str, const char *format, ...)
     return ret;
 }
 
+void kprintf_add_console(kprintf_sink_t *sink)
+{
+    uint64_t flags = spin_lock_irqsave(&console_lock);
+    kprintf_sink_t **tail = &console;
+    while (*tail)
+    {
+        tail = &(*tail)->next;
+    }
+    sink->next = NULL;
+    *tail = sink;
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
 int vkprintf(const char *format, va_list arg)
 {
-    char buffer[1024];
-    int ret = vskprintf(buffer, format, arg);
-    terminal_puts(buffer);
+    uint64_t flags = spin_lock_irqsave(&console_lock);
+    int ret = vfkprintf(console, format, arg);
+    spin_unlock_irqrestore(&console_lock, flags);
     return ret;
 }
 
 int kprintf(const char *format, ...)
 {
     va_list arg;
-    va_start(arg, *format);
+    va_start(arg, format);
     int ret = vkprintf(format, arg);
     va_end(arg);
     return ret;
-}
\ No newline at end of file
+}
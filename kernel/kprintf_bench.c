@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/kprintf_bench.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Benchmark of kprintf integer formatting
+ *
+ */
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/tsc.h>
+#include <kernel/bench.h>
+#include <kernel/kprintf.h>
+
+#define KPRINTF_BENCH_CALLS 20000
+
+static char line[160];
+
+static void format_decimal(uint64_t i)
+{
+    snkprintf(line, sizeof(line), "%lu %d %u", i * 2654435761UL, -(int)i, (unsigned int)i);
+}
+
+static void format_padded(uint64_t i)
+{
+    snkprintf(line, sizeof(line), "%08lx|%-10u|%+6d|%#o", i * 0x9E3779B97F4A7C15UL, (unsigned int)i, (int)i, (unsigned int)i);
+}
+
+/* Sixteen bytes of a hex dump line, the pattern diagnostics repeat the most */
+static void format_hexdump(uint64_t i)
+{
+    const uint8_t *b = (const uint8_t *)&line[i % 16];
+    snkprintf(line, sizeof(line), "%016lx: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
+        (uint64_t)b, b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+}
+
+static void bench_format(const char *name, void (*format)(uint64_t i))
+{
+    uint64_t flags = irq_save();
+    uint64_t start = rdtsc();
+    for (uint64_t i = 0; i < KPRINTF_BENCH_CALLS; i++)
+    {
+        format(i);
+    }
+    uint64_t ns = tsc_to_ns(rdtsc() - start);
+    irq_restore(flags);
+
+    kprintf("  %s: %u calls, %lu ns/call\n", name, KPRINTF_BENCH_CALLS, ns / KPRINTF_BENCH_CALLS);
+}
+
+void bench_kprintf()
+{
+    bench_format("decimal", format_decimal);
+    bench_format("padded", format_padded);
+    bench_format("hexdump", format_hexdump);
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/lockstat.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Lock contention statistics
+ *
+ */
+
+#include <stdint.h>
+#include <kernel/kprintf.h>
+#include <kernel/lockstat.h>
+#include <kernel/serial.h>
+
+static lockstat_t *lockstat_list;
+
+void lockstat_register(lockstat_t *stat)
+{
+    // Runs with the lock held, so a lock is never registered twice
+    stat->registered = 1;
+    stat->next = __atomic_load_n(&lockstat_list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&lockstat_list, &stat->next, stat, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void lockstat_dump()
+{
+#ifdef CONFIG_LOCKSTAT
+    serial_sink_t com1 = SERIAL_SINK_INIT(PORT_COM1);
+    fkprintf(&com1.sink, "lock: acquisitions contended spin-cycles max-spin-cycles\n");
+    for (lockstat_t *stat = __atomic_load_n(&lockstat_list, __ATOMIC_ACQUIRE); stat; stat = stat->next)
+    {
+        fkprintf(&com1.sink, "%s: %lu %lu %lu %lu\n", stat->name ? stat->name : "?",
+            stat->acquisitions, stat->contended, stat->spin_cycles, stat->max_spin_cycles);
+    }
+#endif
+}
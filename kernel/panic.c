@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/panic.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Halts the system on unrecoverable errors
+ *
+ */
+
+#include <stdarg.h>
+#include <kernel/graphics.h>
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+#include <kernel/serial.h>
+
+void panic(const char *format, ...)
+{
+    va_list arg;
+    va_start(arg, format);
+    serial_flush(PORT_COM1);            // Makes room, the serial sink drops what does not fit
+    kprintf("Kernel panic: ");
+    vkprintf(format, arg);
+    va_end(arg);
+    graphics_flush();                   // No timer will run the batched flush any more
+    serial_flush(PORT_COM1);            // Nor will the UART interrupt drain the queue
+
+    for (;;)
+    {
+        asm volatile("cli;hlt");
+    }
+}
@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/sched.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Kernel threads and the per-CPU work-stealing scheduler
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/fpu.h>
+#include <asm/page.h>
+#include <kernel/buddy.h>
+#include <kernel/panic.h>
+#include <kernel/sched.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/timer.h>
+
+#define RUNQUEUE_ORDER 3
+#define RUNQUEUE_SIZE ((PAGE_SIZE << RUNQUEUE_ORDER) / sizeof(thread_t *))
+
+/*
+ * Chase-Lev style deque. Only the owning processor pushes, at the bottom. The owner takes from the
+ * top like the thieves so its own threads run round-robin; every take is a CAS on top, and bottom
+ * is never written by anyone else, so there is no lock and no shared line between owner and idle
+ * thieves until there is work to steal.
+ */
+typedef struct runqueue
+{
+    int64_t top __attribute__((aligned(CACHE_LINE_SIZE)));
+    int64_t bottom __attribute__((aligned(CACHE_LINE_SIZE)));
+    thread_t **slots;
+} runqueue_t;
+
+/* Defined in switch.S, saves the callee-saved registers of prev and returns prev on next's stack */
+thread_t *context_switch(thread_t *prev, thread_t *next);
+void thread_entry();
+
+static uint32_t next_thread_id;
+static uint64_t idle_mask[MAX_CPUS / 64];    // Processors halted in sched_idle()
+
+/* Interrupts must be off, the owner can be interrupted by a wakeup pushing to the same queue */
+static void rq_push(runqueue_t *rq, thread_t *thread)
+{
+    int64_t bottom = rq->bottom;
+    if (bottom - __atomic_load_n(&rq->top, __ATOMIC_ACQUIRE) >= (int64_t)RUNQUEUE_SIZE)
+    {
+        panic("Run queue overflow\n");
+    }
+    __atomic_store_n(&rq->slots[bottom & (RUNQUEUE_SIZE - 1)], thread, __ATOMIC_RELAXED);
+    __atomic_store_n(&rq->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+/* Used by the owner and by thieves alike */
+static thread_t *rq_take(runqueue_t *rq)
+{
+    int64_t top = __atomic_load_n(&rq->top, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        if (top >= __atomic_load_n(&rq->bottom, __ATOMIC_ACQUIRE))
+        {
+            return NULL;
+        }
+        // The slot can only be reused after top has moved past it, and then the CAS fails
+        thread_t *thread = __atomic_load_n(&rq->slots[top & (RUNQUEUE_SIZE - 1)], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&rq->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+        {
+            return thread;
+        }
+    }
+}
+
+static thread_t *sched_pick(cpu_t *cpu)
+{
+    thread_t *next = rq_take(cpu->rq);
+    if (next)
+    {
+        return next;
+    }
+
+    unsigned int count = cpu_count();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned int victim = (cpu->steal_next + i) % count;
+        if (victim == cpu->id)
+        {
+            continue;
+        }
+        next = rq_take(cpus[victim]->rq);
+        if (next)
+        {
+            cpu->steal_next = victim;   // Busy processors tend to stay busy, try it first next time
+            return next;
+        }
+    }
+    return NULL;
+}
+
+/* Returns 1 if any run queue has a thread this processor could run or steal */
+static int sched_has_work()
+{
+    for (unsigned int id = 0; id < cpu_count(); id++)
+    {
+        runqueue_t *rq = cpus[id]->rq;
+        if (__atomic_load_n(&rq->bottom, __ATOMIC_ACQUIRE) > __atomic_load_n(&rq->top, __ATOMIC_ACQUIRE))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Wakes one halted processor to pick up a thread just queued here */
+static void sched_kick_idle()
+{
+    // Pairs with the barrier in sched_idle(): either it sees the new thread or we see its bit
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    unsigned int self = cpu_id();
+    for (unsigned int word = 0; word < MAX_CPUS / 64; word++)
+    {
+        uint64_t mask = __atomic_load_n(&idle_mask[word], __ATOMIC_RELAXED);
+        while (mask)
+        {
+            unsigned int id = word * 64 + __builtin_ctzll(mask);
+            uint64_t bit = 1UL << (id % 64);
+            mask &= mask - 1;
+            if (id != self && (__atomic_fetch_and(&idle_mask[word], ~bit, __ATOMIC_ACQ_REL) & bit))
+            {
+                smp_send_reschedule(id);
+                return;
+            }
+        }
+    }
+}
+
+/* Halts until an interrupt unless there is work somewhere */
+static void sched_idle(cpu_t *cpu)
+{
+    unsigned int word = cpu->id / 64;
+    uint64_t bit = 1UL << (cpu->id % 64);
+
+    irq_disable();
+    __atomic_fetch_or(&idle_mask[word], bit, __ATOMIC_SEQ_CST);
+    if (!sched_has_work() && !cpu->need_resched)
+    {
+        safe_halt();
+    }
+    __atomic_fetch_and(&idle_mask[word], ~bit, __ATOMIC_RELAXED);
+    irq_enable();
+}
+
+/* Runs on the next thread's stack right after a switch */
+static void finish_switch(thread_t *prev)
+{
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    if (prev->state == THREAD_DEAD)
+    {
+        fpu_release(prev);
+        page_free(virt_to_phys((void *)prev->stack), KERNEL_STACK_ORDER);
+        kfree(prev);
+    }
+}
+
+void schedule()
+{
+    if (preempt_count())
+    {
+        panic("schedule() with preemption disabled\n");
+    }
+
+    uint64_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    thread_t *prev = cpu->current;
+    cpu->need_resched = 0;
+
+    if (prev != cpu->idle && __atomic_load_n(&prev->state, __ATOMIC_ACQUIRE) == THREAD_RUNNING)
+    {
+        prev->state = THREAD_READY;
+        rq_push(cpu->rq, prev);
+    }
+
+    thread_t *next = sched_pick(cpu);
+    if (next && next != prev && __atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE))
+    {
+        // Still switching away on another processor, which may itself wait for prev. Requeue it
+        // and go idle, that completes our switch and cannot deadlock
+        rq_push(cpu->rq, next);
+        next = cpu->idle;
+    }
+    if (!next)
+    {
+        next = cpu->idle;
+    }
+
+    next->state = THREAD_RUNNING;
+    next->slice = SCHED_SLICE_TICKS;
+    if (next != prev)
+    {
+        // Idle processors take no ticks
+        if (next == cpu->idle)
+        {
+            timer_tick_stop();
+        }
+        else if (prev == cpu->idle)
+        {
+            timer_tick_start();
+        }
+        next->on_cpu = 1;
+        cpu->current = next;
+        cpu->nr_switches++;
+        fpu_switch(prev, next);
+        prev = context_switch(prev, next);
+        finish_switch(prev);
+    }
+    irq_restore(flags);
+}
+
+void preempt_schedule()
+{
+    schedule();
+}
+
+void sched_tick()
+{
+    thread_t *current = current_thread();
+    if (current && current != this_cpu()->idle && current->slice && !--current->slice)
+    {
+        this_cpu()->need_resched = 1;
+    }
+}
+
+/* First code of every thread, reached from thread_entry in switch.S */
+__attribute__((noreturn)) void thread_start(thread_t *prev, void (*fn)(void *), void *arg)
+{
+    finish_switch(prev);
+    irq_enable();
+    fn(arg);
+    thread_exit();
+}
+
+thread_t *thread_create(const char *name, void (*fn)(void *), void *arg)
+{
+    thread_t *thread = kmalloc(sizeof(thread_t));
+    if (!thread)
+    {
+        return NULL;
+    }
+    uintptr_t stack = page_alloc(KERNEL_STACK_ORDER);
+    if (!stack)
+    {
+        kfree(thread);
+        return NULL;
+    }
+
+    thread->stack = (uintptr_t)phys_to_virt(stack);
+    thread->name = name;
+    thread->id = __atomic_add_fetch(&next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->on_cpu = 0;
+    thread->slice = SCHED_SLICE_TICKS;
+    thread->fpu_state = NULL;
+    thread->fpu_depth = 0;
+
+    // The frame context_switch() pops: r15, r14, r13, r12, rbx, rbp, return address
+    uint64_t *sp = (uint64_t *)(thread->stack + KERNEL_STACK_SIZE);
+    *--sp = 0;
+    *--sp = 0;                      // Keeps the call in thread_entry 16-byte aligned
+    *--sp = (uint64_t)thread_entry;
+    *--sp = 0;                      // rbp
+    *--sp = 0;                      // rbx
+    *--sp = (uint64_t)fn;           // r12
+    *--sp = (uint64_t)arg;          // r13
+    *--sp = 0;                      // r14
+    *--sp = 0;                      // r15
+    thread->sp = (uintptr_t)sp;
+
+    thread->state = THREAD_READY;
+    uint64_t flags = irq_save();
+    rq_push(this_cpu()->rq, thread);
+    sched_kick_idle();
+    irq_restore(flags);
+    return thread;
+}
+
+void thread_exit()
+{
+    irq_save();
+    current_thread()->state = THREAD_DEAD;
+    schedule();
+    panic("Dead thread scheduled\n");
+}
+
+void thread_yield()
+{
+    schedule();
+}
+
+void thread_prepare_block()
+{
+    __atomic_store_n(&current_thread()->state, THREAD_BLOCKED, __ATOMIC_SEQ_CST);
+}
+
+void thread_block()
+{
+    schedule();
+}
+
+void thread_cancel_block()
+{
+    uint32_t expected = THREAD_BLOCKED;
+    if (!__atomic_compare_exchange_n(&current_thread()->state, &expected, THREAD_RUNNING, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        // Already woken and queued, the queue entry must be consumed
+        schedule();
+    }
+}
+
+int thread_wake(thread_t *thread)
+{
+    uint32_t expected = THREAD_BLOCKED;
+    if (!__atomic_compare_exchange_n(&thread->state, &expected, THREAD_READY, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    uint64_t flags = irq_save();
+    rq_push(this_cpu()->rq, thread);
+    sched_kick_idle();
+    irq_restore(flags);
+    return 1;
+}
+
+void sched_init()
+{
+    for (unsigned int id = 0; id < cpu_count(); id++)
+    {
+        runqueue_t *rq = kmalloc(sizeof(runqueue_t));
+        uintptr_t slots = page_alloc(RUNQUEUE_ORDER);
+        if (!rq || !slots)
+        {
+            panic("Out of memory allocating run queues\n");
+        }
+        rq->top = 0;
+        rq->bottom = 0;
+        rq->slots = phys_to_virt(slots);
+
+        cpu_t *cpu = cpus[id];
+        cpu->rq = rq;
+        cpu->current = NULL;
+        cpu->idle = NULL;
+        cpu->preempt_count = 0;
+        cpu->need_resched = 0;
+        cpu->steal_next = id;
+        cpu->nr_switches = 0;
+    }
+}
+
+void sched_start()
+{
+    thread_t *idle = kmalloc(sizeof(thread_t));
+    if (!idle)
+    {
+        panic("Out of memory allocating the idle thread\n");
+    }
+    idle->stack = 0;
+    idle->name = "idle";
+    idle->id = 0;
+    idle->state = THREAD_RUNNING;
+    idle->on_cpu = 1;
+    idle->slice = 0;
+    idle->fpu_state = NULL;
+    idle->fpu_depth = 0;
+
+    cpu_t *cpu = this_cpu();
+    cpu->idle = idle;
+    cpu->current = idle;
+
+    for (;;)
+    {
+        schedule();
+        sched_idle(cpu);
+    }
+}
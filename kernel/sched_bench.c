@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/sched_bench.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Scheduler benchmark
+ *
+ */
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/tsc.h>
+#include <kernel/bench.h>
+#include <kernel/kprintf.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+
+#define YIELD_THREADS_PER_CPU 2
+#define YIELD_ROUNDS 20000
+#define WAKE_ROUNDS 10000
+
+static uint32_t remaining;
+static thread_t *bench_thread;
+
+/* Blocks the benchmark thread until every worker has called worker_done() */
+static void wait_workers()
+{
+    thread_prepare_block();
+    if (__atomic_load_n(&remaining, __ATOMIC_SEQ_CST))
+    {
+        thread_block();
+    }
+    else
+    {
+        thread_cancel_block();
+    }
+}
+
+static void worker_done()
+{
+    if (!__atomic_sub_fetch(&remaining, 1, __ATOMIC_SEQ_CST))
+    {
+        thread_wake(bench_thread);
+    }
+}
+
+static uint64_t total_switches()
+{
+    uint64_t switches = 0;
+    for (unsigned int id = 0; id < cpu_count(); id++)
+    {
+        switches += __atomic_load_n(&cpus[id]->nr_switches, __ATOMIC_RELAXED);
+    }
+    return switches;
+}
+
+static void yield_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < YIELD_ROUNDS; i++)
+    {
+        thread_yield();
+    }
+    worker_done();
+}
+
+static void bench_yield()
+{
+    unsigned int threads = cpu_count() * YIELD_THREADS_PER_CPU;
+
+    __atomic_store_n(&remaining, threads, __ATOMIC_SEQ_CST);
+    uint64_t switches = total_switches();
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        if (!thread_create("yield", yield_worker, NULL))
+        {
+            kprintf("  out of memory\n");
+            return;
+        }
+    }
+    do
+    {
+        wait_workers();
+    } while (__atomic_load_n(&remaining, __ATOMIC_SEQ_CST));
+    uint64_t ns = tsc_to_ns(rdtsc() - start);
+    switches = total_switches() - switches;
+
+    kprintf("  yield: %u threads on %u cpus, %lu switches in %lu us, %lu switches/s\n",
+        threads, cpu_count(), switches, ns / 1000, ns ? switches * 1000000000 / ns : 0);
+}
+
+static struct
+{
+    thread_t *sleeper;
+    uint64_t stamp;             // TSC at the wakeup
+    uint32_t armed;             // Sleeper is blocked or about to be
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} wake;
+
+static void wake_sleeper(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < WAKE_ROUNDS; i++)
+    {
+        thread_prepare_block();
+        __atomic_store_n(&wake.armed, 1, __ATOMIC_RELEASE);
+        thread_block();     // The wakeup only comes after armed, no need to recheck
+        uint64_t latency = rdtsc() - __atomic_load_n(&wake.stamp, __ATOMIC_ACQUIRE);
+
+        wake.total += latency;
+        if (latency < wake.min)
+        {
+            wake.min = latency;
+        }
+        if (latency > wake.max)
+        {
+            wake.max = latency;
+        }
+    }
+    worker_done();
+}
+
+static void wake_waker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < WAKE_ROUNDS; i++)
+    {
+        while (!__atomic_load_n(&wake.armed, __ATOMIC_ACQUIRE))
+        {
+            thread_yield();
+        }
+        __atomic_store_n(&wake.armed, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&wake.stamp, rdtsc(), __ATOMIC_RELEASE);
+        thread_wake(wake.sleeper);
+    }
+    worker_done();
+}
+
+static void bench_wakeup()
+{
+    wake.armed = 0;
+    wake.total = 0;
+    wake.min = UINT64_MAX;
+    wake.max = 0;
+
+    __atomic_store_n(&remaining, 2, __ATOMIC_SEQ_CST);
+    wake.sleeper = thread_create("sleeper", wake_sleeper, NULL);
+    if (!wake.sleeper || !thread_create("waker", wake_waker, NULL))
+    {
+        kprintf("  out of memory\n");
+        return;
+    }
+    do
+    {
+        wait_workers();
+    } while (__atomic_load_n(&remaining, __ATOMIC_SEQ_CST));
+
+    kprintf("  wakeup-to-run latency over %u wakeups: min %lu ns, avg %lu ns, max %lu ns\n", WAKE_ROUNDS,
+        tsc_to_ns(wake.min), tsc_to_ns(wake.total / WAKE_ROUNDS), tsc_to_ns(wake.max));
+}
+
+void bench_sched()
+{
+    bench_thread = current_thread();
+    bench_yield();
+    bench_wakeup();
+}
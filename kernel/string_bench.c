@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/string_bench.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Benchmark of the memory routines
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpufeature.h>
+#include <asm/page.h>
+#include <asm/string.h>
+#include <asm/tsc.h>
+#include <kernel/bench.h>
+#include <kernel/buddy.h>
+#include <kernel/kprintf.h>
+#include <kernel/string.h>
+
+#define STRING_BENCH_ORDER 10           // 4 MiB, the largest size measured
+#define STRING_BENCH_BYTES (16UL << 20) // Copied per size and variant
+#define STRING_BENCH_MIN_ROUNDS 16
+
+typedef void *(*copy_fn_t)(void *dst, const void *src, size_t n);
+typedef void *(*set_fn_t)(void *dst, int c, size_t n);
+
+/* What the kernel used before, kept as the baseline */
+static void *memcpy_bytes(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    for (size_t i = 0; i < n; i++)
+    {
+        d[i] = s[i];
+    }
+    return dst;
+}
+
+static void *memset_bytes(void *dst, int c, size_t n)
+{
+    uint8_t *d = dst;
+    for (size_t i = 0; i < n; i++)
+    {
+        d[i] = c;
+    }
+    return dst;
+}
+
+static uint64_t rounds_for(size_t size)
+{
+    uint64_t rounds = STRING_BENCH_BYTES / size;
+    return rounds < STRING_BENCH_MIN_ROUNDS ? STRING_BENCH_MIN_ROUNDS : rounds;
+}
+
+/* Prints cycles per call and MB/s */
+static void report(const char *name, size_t size, uint64_t rounds, uint64_t cycles)
+{
+    uint64_t ns = tsc_to_ns(cycles);
+    kprintf(" %s %lu/%lu", name, cycles / rounds, ns ? size * rounds * 1000 / ns : 0);
+}
+
+static void bench_copy(const char *name, copy_fn_t copy, uint8_t *dst, const uint8_t *src, size_t size)
+{
+    uint64_t rounds = rounds_for(size);
+    uint64_t start = rdtsc();
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        copy(dst, src, size);
+    }
+    report(name, size, rounds, rdtsc() - start);
+}
+
+static void bench_set(const char *name, set_fn_t set, uint8_t *dst, size_t size)
+{
+    uint64_t rounds = rounds_for(size);
+    uint64_t start = rdtsc();
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        set(dst, 0x5A, size);
+    }
+    report(name, size, rounds, rdtsc() - start);
+}
+
+void bench_memcpy()
+{
+    size_t max = PAGE_SIZE << STRING_BENCH_ORDER;
+    uintptr_t src_phys = page_alloc(STRING_BENCH_ORDER);
+    uintptr_t dst_phys = page_alloc(STRING_BENCH_ORDER);
+    if (!src_phys || !dst_phys)
+    {
+        kprintf("  out of memory\n");
+        if (src_phys)
+        {
+            page_free(src_phys, STRING_BENCH_ORDER);
+        }
+        return;
+    }
+    uint8_t *src = phys_to_virt(src_phys);
+    uint8_t *dst = phys_to_virt(dst_phys);
+    memset(src, 0xA5, max);
+
+    kprintf("  erms %u, fsrm %u, cycles per call/MB/s\n", cpu_has(X86_FEATURE_ERMS), cpu_has(X86_FEATURE_FSRM));
+    for (size_t size = 8; size <= max; size *= 8)
+    {
+        kprintf("  %8lu B copy:", size);
+        bench_copy("movsb", memcpy_movsb, dst, src, size);
+        bench_copy("movsq", memcpy_movsq, dst, src, size);
+        bench_copy("bytes", memcpy_bytes, dst, src, size);
+        kprintf("\n  %8lu B set: ", size);
+        bench_set("stosb", memset_stosb, dst, size);
+        bench_set("stosq", memset_stosq, dst, size);
+        bench_set("bytes", memset_bytes, dst, size);
+        kprintf("\n");
+    }
+    if (memcmp(dst, src, max) == 0 || memcmp(src, src + 1, max - 1) != 0)
+    {
+        kprintf("  memcmp is wrong\n");
+    }
+
+    page_free(dst_phys, STRING_BENCH_ORDER);
+    page_free(src_phys, STRING_BENCH_ORDER);
+}
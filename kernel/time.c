@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/time.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Kernel time keeping
+ *
+ */
+
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <boot/bootboot.h>
+#include <kernel/clocksource.h>
+#include <kernel/kprintf.h>
+#include <kernel/spinlock.h>
+#include <kernel/time.h>
+#include <kernel/timer.h>
+
+extern BOOTBOOT bootboot;   // Infomation provided by BOOTBOOT Loader
+
+/* Folds are at most 1/8 late on the timer wheel, a quarter of the wrap keeps them well inside half */
+#define ACCUMULATE_FRACTION 4
+#define ACCUMULATE_MAX_NS (60 * NSEC_PER_SEC)
+
+static DEFINE_SPINLOCK(clocksource_lock);   // Serialises the writers of the fields below
+static uint32_t clocksource_seq;            // Odd while they change
+static const clocksource_t *clocksource;
+static uint64_t base_cycles;    // Counter value at base_ns
+static uint64_t base_ns;
+static uint64_t boot_real_ns;   // Wall clock at ktime 0
+
+static ktimer_t accumulate_timer;
+
+static inline uint64_t cycles_to_ns(const clocksource_t *cs, uint64_t cycles)
+{
+    return ((unsigned __int128)cycles * cs->mult) >> cs->shift;
+}
+
+uint64_t ktime_get_ns()
+{
+    uint32_t seq;
+    uint64_t ns;
+    do
+    {
+        seq = __atomic_load_n(&clocksource_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            pause();
+            continue;
+        }
+        const clocksource_t *cs = __atomic_load_n(&clocksource, __ATOMIC_RELAXED);
+        if (!cs)
+        {
+            return 0;
+        }
+        uint64_t cycles = (cs->read() - __atomic_load_n(&base_cycles, __ATOMIC_RELAXED)) & cs->mask;
+        ns = __atomic_load_n(&base_ns, __ATOMIC_RELAXED) + cycles_to_ns(cs, cycles);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&clocksource_seq, __ATOMIC_RELAXED));
+    return ns;
+}
+
+/* Caller holds clocksource_lock, moves the base to the current counter value */
+static void clocksource_rebase(const clocksource_t *cs)
+{
+    uint64_t now = ktime_get_ns();
+    uint64_t cycles = cs->read();
+
+    __atomic_store_n(&clocksource_seq, clocksource_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&base_cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_store_n(&base_ns, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&clocksource, cs, __ATOMIC_RELAXED);
+    __atomic_store_n(&clocksource_seq, clocksource_seq + 1, __ATOMIC_RELEASE);
+}
+
+void clocksource_register(const clocksource_t *cs)
+{
+    uint64_t flags = spin_lock_irqsave(&clocksource_lock);
+    if (clocksource && clocksource->rating >= cs->rating)
+    {
+        spin_unlock_irqrestore(&clocksource_lock, flags);
+        return;
+    }
+    clocksource_rebase(cs);
+    spin_unlock_irqrestore(&clocksource_lock, flags);
+    kprintf("Clocksource: %s\n", cs->name);
+}
+
+/* Period that keeps a narrow counter from wrapping between two folds, 0 for a 64-bit counter */
+static uint64_t accumulate_interval()
+{
+    const clocksource_t *cs = __atomic_load_n(&clocksource, __ATOMIC_ACQUIRE);
+    if (cs->mask == ~0UL)
+    {
+        return 0;
+    }
+    uint64_t interval = cycles_to_ns(cs, cs->mask) / ACCUMULATE_FRACTION;
+    return interval < ACCUMULATE_MAX_NS ? interval : ACCUMULATE_MAX_NS;
+}
+
+static void accumulate_fn(void *arg)
+{
+    (void)arg;
+    uint64_t flags = spin_lock_irqsave(&clocksource_lock);
+    clocksource_rebase(clocksource);
+    spin_unlock_irqrestore(&clocksource_lock, flags);
+
+    // The source may have changed to one that never wraps
+    uint64_t interval = accumulate_interval();
+    if (interval)
+    {
+        timer_arm(&accumulate_timer, ktime_get_ns() + interval);
+    }
+}
+
+void time_accumulate_start()
+{
+    if (!__atomic_load_n(&clocksource, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    timer_init(&accumulate_timer, accumulate_fn, NULL);
+    uint64_t interval = accumulate_interval();
+    if (interval)
+    {
+        kprintf("Time: folding the %s counter every %lu ms\n", clocksource->name, interval / NSEC_PER_MSEC);
+        timer_arm(&accumulate_timer, ktime_get_ns() + interval);
+    }
+}
+
+uint64_t ktime_get_real_ns()
+{
+    return boot_real_ns + ktime_get_ns();
+}
+
+int time_zone()
+{
+    return bootboot.timezone;
+}
+
+static unsigned int bcd(uint8_t value)
+{
+    return (value >> 4) * 10 + (value & 0xF);
+}
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static int64_t days_from_civil(int64_t year, unsigned int month, unsigned int day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned int year_of_era = year - era * 400;
+    unsigned int day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+void time_init()
+{
+    // yyyymmddhhiiss in BCD, UTC
+    unsigned int year = bcd(bootboot.datetime[0]) * 100 + bcd(bootboot.datetime[1]);
+    unsigned int month = bcd(bootboot.datetime[2]);
+    unsigned int day = bcd(bootboot.datetime[3]);
+    unsigned int hour = bcd(bootboot.datetime[4]);
+    unsigned int minute = bcd(bootboot.datetime[5]);
+    unsigned int second = bcd(bootboot.datetime[6]);
+
+    if (month < 1 || month > 12 || day < 1 || day > 31)
+    {
+        kprintf("Time: no valid boot time from the loader\n");
+        return;
+    }
+
+    int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    boot_real_ns = seconds * NSEC_PER_SEC - ktime_get_ns();
+    kprintf("Time: %04u-%02u-%02u %02u:%02u:%02u UTC, time zone %+d min\n",
+        year, month, day, hour, minute, second, time_zone());
+}
@@ -0,0 +1,443 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/timer.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Tickless timers on a per-CPU hierarchical timer wheel
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <kernel/clockevent.h>
+#include <kernel/panic.h>
+#include <kernel/sched.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/time.h>
+#include <kernel/timer.h>
+
+/*
+ * Non-cascading wheel: level n has 64 buckets of 8^n units each. A timer goes into the level whose
+ * range covers its timeout, rounded up to that level's granularity, and is never moved again. Arming
+ * and cancelling are a list insert/unlink plus a bitmap update.
+ */
+#define TIMER_UNIT_SHIFT 20             // One wheel unit is 2^20 ns, about 1 ms
+#define LVL_CLK_SHIFT 3
+#define LVL_BITS 6
+#define LVL_SIZE (1UL << LVL_BITS)
+#define LVL_MASK (LVL_SIZE - 1)
+#define LVL_DEPTH 8
+#define WHEEL_SIZE (LVL_SIZE * LVL_DEPTH)
+
+#define LVL_SHIFT(n) ((n) * LVL_CLK_SHIFT)
+#define LVL_GRAN(n) (1UL << LVL_SHIFT(n))
+#define LVL_START(n) ((LVL_SIZE - 1) << (((n) - 1) * LVL_CLK_SHIFT))
+#define WHEEL_TIMEOUT_CUTOFF LVL_START(LVL_DEPTH)
+#define WHEEL_TIMEOUT_MAX (WHEEL_TIMEOUT_CUTOFF - LVL_GRAN(LVL_DEPTH - 1))
+
+#define TICK_NS (NSEC_PER_SEC / SCHED_HZ)
+#define EXPIRES_NEVER UINT64_MAX
+
+typedef struct timer_base
+{
+    spinlock_t lock;
+    uint64_t clk;                       // Next wheel unit to process
+    uint64_t next_expiry;               // Earliest pending bucket, may be early after a cancel
+    uint64_t programmed;                // Time the clock event device is set to
+    uint64_t next_tick;
+    int tick_stopped;
+    ktimer_t *running;
+    uint64_t pending_map[LVL_DEPTH];    // Non-empty buckets of each level
+    ktimer_t *vectors[WHEEL_SIZE];
+} timer_base_t;
+
+static timer_base_t *timer_bases[MAX_CPUS];
+static const clock_event_t *clockevent;
+
+void clockevent_register(const clock_event_t *device)
+{
+    clockevent = device;
+}
+
+static unsigned int calc_index(uint64_t expires, unsigned int lvl, uint64_t *bucket_expiry)
+{
+    // Round up so a truncated expiry never fires early
+    expires = (expires + LVL_GRAN(lvl)) >> LVL_SHIFT(lvl);
+    *bucket_expiry = expires << LVL_SHIFT(lvl);
+    return lvl * LVL_SIZE + (expires & LVL_MASK);
+}
+
+static unsigned int calc_wheel_index(uint64_t expires, uint64_t clk, uint64_t *bucket_expiry)
+{
+    if ((int64_t)(expires - clk) < 0)
+    {
+        *bucket_expiry = clk;
+        return clk & LVL_MASK;
+    }
+
+    uint64_t delta = expires - clk;
+    for (unsigned int lvl = 0; lvl < LVL_DEPTH - 1; lvl++)
+    {
+        if (delta < LVL_START(lvl + 1))
+        {
+            return calc_index(expires, lvl, bucket_expiry);
+        }
+    }
+    if (delta >= WHEEL_TIMEOUT_CUTOFF)
+    {
+        expires = clk + WHEEL_TIMEOUT_MAX;
+    }
+    return calc_index(expires, LVL_DEPTH - 1, bucket_expiry);
+}
+
+static void enqueue_timer(timer_base_t *base, ktimer_t *timer, unsigned int idx)
+{
+    ktimer_t **head = &base->vectors[idx];
+    timer->next = *head;
+    if (*head)
+    {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->idx = idx;
+    __atomic_store_n(&timer->pprev, head, __ATOMIC_RELAXED);
+    base->pending_map[idx / LVL_SIZE] |= 1UL << (idx % LVL_SIZE);
+}
+
+static void detach_timer(timer_base_t *base, ktimer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    __atomic_store_n(&timer->pprev, NULL, __ATOMIC_RELAXED);
+    if (!base->vectors[timer->idx])
+    {
+        base->pending_map[timer->idx / LVL_SIZE] &= ~(1UL << (timer->idx % LVL_SIZE));
+    }
+}
+
+/* Earliest time a pending bucket is collected, one bitmap scan per level */
+static uint64_t next_expiry(timer_base_t *base)
+{
+    uint64_t next = EXPIRES_NEVER;
+    for (unsigned int lvl = 0; lvl < LVL_DEPTH; lvl++)
+    {
+        uint64_t map = base->pending_map[lvl];
+        if (!map)
+        {
+            continue;
+        }
+        // A level is collected at multiples of its granularity, the first one at or after clk
+        uint64_t lvl_clk = (base->clk + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl);
+        unsigned int pos = lvl_clk & LVL_MASK;
+        uint64_t rotated = pos ? (map >> pos) | (map << (LVL_SIZE - pos)) : map;
+        uint64_t expiry = (lvl_clk + __builtin_ctzll(rotated)) << LVL_SHIFT(lvl);
+        if (expiry < next)
+        {
+            next = expiry;
+        }
+    }
+    return next;
+}
+
+/* Sets the clock event device to the next timer, or the next tick if that comes first */
+static void timer_reprogram(timer_base_t *base)
+{
+    uint64_t next = base->next_expiry;
+    next = next == EXPIRES_NEVER ? EXPIRES_NEVER : next << TIMER_UNIT_SHIFT;
+    if (!base->tick_stopped && base->next_tick < next)
+    {
+        next = base->next_tick;
+    }
+    if (next == base->programmed || !clockevent)
+    {
+        return;
+    }
+    base->programmed = next;
+    if (next == EXPIRES_NEVER)
+    {
+        clockevent->stop();
+    }
+    else
+    {
+        clockevent->set_next(next);
+    }
+}
+
+/* Moves an idle wheel up to now so new timers get the finest level that fits */
+static void forward_timer_base(timer_base_t *base, uint64_t now)
+{
+    uint64_t target = now < base->next_expiry ? now : base->next_expiry;
+    if (target > base->clk)
+    {
+        base->clk = target;
+    }
+}
+
+void timer_init(ktimer_t *timer, void (*fn)(void *arg), void *arg)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->cpu = 0;
+    timer->idx = 0;
+}
+
+/* Locks the wheel the timer is on, following it if it moves meanwhile */
+static timer_base_t *lock_timer_base(ktimer_t *timer, uint64_t *flags)
+{
+    for (;;)
+    {
+        timer_base_t *base = timer_bases[__atomic_load_n(&timer->cpu, __ATOMIC_RELAXED)];
+        *flags = spin_lock_irqsave(&base->lock);
+        if (base == timer_bases[timer->cpu])
+        {
+            return base;
+        }
+        spin_unlock_irqrestore(&base->lock, *flags);
+    }
+}
+
+void timer_arm(ktimer_t *timer, uint64_t expires)
+{
+    uint64_t flags;
+    timer_base_t *base = lock_timer_base(timer, &flags);
+    if (timer->pprev)
+    {
+        detach_timer(base, timer);
+    }
+
+    timer_base_t *local = timer_bases[cpu_id()];
+    if (base != local)
+    {
+        spin_unlock(&base->lock);
+        spin_lock(&local->lock);
+        base = local;
+        __atomic_store_n(&timer->cpu, cpu_id(), __ATOMIC_RELAXED);
+    }
+
+    forward_timer_base(base, ktime_get_ns() >> TIMER_UNIT_SHIFT);
+    uint64_t bucket_expiry;
+    timer->expires = expires >> TIMER_UNIT_SHIFT;     // calc_index() rounds up from here
+    enqueue_timer(base, timer, calc_wheel_index(timer->expires, base->clk, &bucket_expiry));
+    if (bucket_expiry < base->next_expiry)
+    {
+        base->next_expiry = bucket_expiry;
+        timer_reprogram(base);
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+int timer_cancel(ktimer_t *timer)
+{
+    uint64_t flags;
+    timer_base_t *base = lock_timer_base(timer, &flags);
+    int pending = timer->pprev != NULL;
+    if (pending)
+    {
+        detach_timer(base, timer);
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+
+    // The function may still be running on the wheel's processor, but never wait for ourselves
+    if (base != timer_bases[cpu_id()])
+    {
+        while (__atomic_load_n(&base->running, __ATOMIC_ACQUIRE) == timer)
+        {
+            pause();
+        }
+    }
+    return pending;
+}
+
+/* Runs every bucket due at base->clk, called with the lock held and interrupts disabled */
+static void expire_timers(timer_base_t *base)
+{
+    ktimer_t *expired[LVL_DEPTH];
+    unsigned int levels = 0;
+    uint64_t clk = base->clk;
+
+    for (unsigned int lvl = 0; lvl < LVL_DEPTH; lvl++)
+    {
+        unsigned int idx = lvl * LVL_SIZE + (clk & LVL_MASK);
+        if (base->vectors[idx])
+        {
+            expired[levels++] = base->vectors[idx];
+            base->vectors[idx]->pprev = &expired[levels - 1];
+            base->vectors[idx] = NULL;
+            base->pending_map[lvl] &= ~(1UL << (clk & LVL_MASK));
+        }
+        // Higher levels are only due when this one wraps around a full granule
+        if (clk & ((1UL << LVL_CLK_SHIFT) - 1))
+        {
+            break;
+        }
+        clk >>= LVL_CLK_SHIFT;
+    }
+
+    for (unsigned int i = 0; i < levels; i++)
+    {
+        while (expired[i])
+        {
+            ktimer_t *timer = expired[i];
+            expired[i] = timer->next;
+            if (timer->next)
+            {
+                timer->next->pprev = &expired[i];
+            }
+            __atomic_store_n(&timer->pprev, NULL, __ATOMIC_RELAXED);
+
+            if (timer->expires > base->clk)
+            {
+                // Beyond the wheel's range when armed and clamped, it goes around again
+                uint64_t bucket_expiry;
+                enqueue_timer(base, timer, calc_wheel_index(timer->expires, base->clk, &bucket_expiry));
+                continue;
+            }
+
+            __atomic_store_n(&base->running, timer, __ATOMIC_RELAXED);
+            spin_unlock(&base->lock);
+            timer->fn(timer->arg);
+            spin_lock(&base->lock);
+            __atomic_store_n(&base->running, NULL, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+void timer_interrupt()
+{
+    timer_base_t *base = timer_bases[cpu_id()];
+    uint64_t now_ns = ktime_get_ns();
+    uint64_t now = now_ns >> TIMER_UNIT_SHIFT;
+
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    base->programmed = EXPIRES_NEVER;   // One-shot, it has fired
+
+    if (!base->tick_stopped && now_ns >= base->next_tick)
+    {
+        base->next_tick = now_ns + TICK_NS;
+        spin_unlock(&base->lock);
+        sched_tick();
+        spin_lock(&base->lock);
+    }
+
+    while (base->clk <= now)
+    {
+        if (base->next_expiry > now)
+        {
+            base->clk = now + 1;        // Nothing due, skip the empty units
+            break;
+        }
+        if (base->next_expiry > base->clk)
+        {
+            base->clk = base->next_expiry;
+        }
+        expire_timers(base);
+        base->clk++;
+        base->next_expiry = next_expiry(base);
+    }
+
+    timer_reprogram(base);
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+void timer_tick_start()
+{
+    timer_base_t *base = timer_bases[cpu_id()];
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    if (base->tick_stopped)
+    {
+        base->tick_stopped = 0;
+        base->next_tick = ktime_get_ns() + TICK_NS;
+        timer_reprogram(base);
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+void timer_tick_stop()
+{
+    timer_base_t *base = timer_bases[cpu_id()];
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    if (!base->tick_stopped)
+    {
+        base->tick_stopped = 1;
+        timer_reprogram(base);
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+static void sleep_wakeup(void *arg)
+{
+    thread_wake(arg);
+}
+
+void sleep_ns(uint64_t ns)
+{
+    ktimer_t timer;
+    timer_init(&timer, sleep_wakeup, current_thread());
+
+    uint64_t expires = ktime_get_ns() + ns;
+    while (ktime_get_ns() < expires)
+    {
+        thread_prepare_block();
+        timer_arm(&timer, expires);
+        thread_block();
+    }
+    timer_cancel(&timer);
+}
+
+void timers_init()
+{
+    uint64_t now = ktime_get_ns() >> TIMER_UNIT_SHIFT;
+    for (unsigned int id = 0; id < cpu_count(); id++)
+    {
+        timer_base_t *base = kmalloc(sizeof(timer_base_t));
+        if (!base)
+        {
+            panic("Out of memory allocating timer wheels\n");
+        }
+        spin_lock_init(&base->lock, "timer");
+        base->clk = now;
+        base->next_expiry = EXPIRES_NEVER;
+        base->programmed = EXPIRES_NEVER;
+        base->next_tick = 0;
+        base->tick_stopped = 1;         // Processors start out idle
+        base->running = NULL;
+        for (unsigned int lvl = 0; lvl < LVL_DEPTH; lvl++)
+        {
+            base->pending_map[lvl] = 0;
+        }
+        for (unsigned int idx = 0; idx < WHEEL_SIZE; idx++)
+        {
+            base->vectors[idx] = NULL;
+        }
+        timer_bases[id] = base;
+    }
+}
@@ -30,13 +30,16 @@
 
 #include <kernel/graphics.h>
 #include <kernel/psf.h>
+#include <kernel/spinlock.h>
 #include <kernel/tty.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <boot/bootboot.h>
 
 size_t cursor_x;
-size_t cursor_y;
+size_t cursor_y;                        // Screen row, the bottom one once the screen has filled
+
+static DEFINE_SPINLOCK(terminal_lock); // Protects the grid and the cursor, every core prints
 
 size_t terminal_width;
 size_t Terminal_height;
@@ -44,46 +47,210 @@ size_t Terminal_height;
 PIXEL terminal_fgcolor;
 PIXEL terminal_bgcolor;
 
+/* Rows of the grid form a ring, screen row y is grid row (top + y) % Terminal_height */
+static cell_t grid[TTY_MAX_ROWS * TTY_MAX_COLS];
+static cell_t shown[TTY_MAX_ROWS * TTY_MAX_COLS];      // What is on screen, by screen position
+static uint8_t row_dirty[TTY_MAX_ROWS];                 // By grid row, cells written since the render
+static size_t top;
+static int scrolled;                    // The ring turned since the render, every screen row moved
+
+/* Colour pairs referenced by cells */
+static struct
+{
+    PIXEL fg;
+    PIXEL bg;
+} attrs[TTY_MAX_ATTRS];
+static unsigned int attr_count;
+static uint8_t terminal_attr;
+
 extern BOOTBOOT bootboot; // Infomation provided by BOOTBOOT Loader
-extern uint8_t fb;        // linear framebuffer mapped
+
+static inline cell_t *grid_row(size_t y)
+{
+    return &grid[(top + y) % Terminal_height * TTY_MAX_COLS];
+}
+
+/* Caller holds terminal_lock */
+static void terminal_render_locked()
+{
+    for (size_t y = 0; y < Terminal_height; y++)
+    {
+        size_t row = (top + y) % Terminal_height;
+        if (!scrolled && !row_dirty[row])
+        {
+            continue;
+        }
+        row_dirty[row] = 0;
+
+        cell_t *cells = &grid[row * TTY_MAX_COLS];
+        cell_t *screen = &shown[y * TTY_MAX_COLS];
+        for (size_t x = 0; x < terminal_width; x++)
+        {
+            if (cells[x].ch == screen[x].ch && cells[x].attr == screen[x].attr)
+            {
+                continue;
+            }
+            screen[x] = cells[x];
+            drawchar(cells[x].ch, x, y, attrs[cells[x].attr].fg, attrs[cells[x].attr].bg);
+        }
+    }
+    scrolled = 0;
+}
+
+/* Drawn when the screen gets flushed, so however many lines scrolled in between cost one render */
+static void terminal_render()
+{
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
+    terminal_render_locked();
+    spin_unlock_irqrestore(&terminal_lock, flags);
+}
 
 void terminal_init()
 {
     cursor_x = 0;
     cursor_y = 0;
 
-    terminal_setcolor(rgb_to_pixel(0xAAAAAA), rgb_to_pixel(0x000000));
-
     PSF_font *font = (PSF_font *)&_binary_font_psf_start;
     terminal_width = bootboot.fb_width / (font->width + 1);
     Terminal_height = bootboot.fb_height / font->height;
+    if (terminal_width > TTY_MAX_COLS)
+    {
+        terminal_width = TTY_MAX_COLS;
+    }
+    if (Terminal_height > TTY_MAX_ROWS)
+    {
+        Terminal_height = TTY_MAX_ROWS;
+    }
+
+    terminal_setcolor(rgb_to_pixel(0xAAAAAA), rgb_to_pixel(0x000000));
+
+    // The screen is taken as blank, blanks in the default colours are never drawn
+    for (size_t i = 0; i < TTY_MAX_ROWS * TTY_MAX_COLS; i++)
+    {
+        grid[i].ch = ' ';
+        grid[i].attr = terminal_attr;
+        shown[i] = grid[i];
+    }
+    graphics_set_renderer(terminal_render);
+}
+
+void terminal_redraw()
+{
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
+    for (size_t i = 0; i < TTY_MAX_ROWS * TTY_MAX_COLS; i++)
+    {
+        shown[i].ch = 0;                // Matches no cell, the terminal never stores NUL
+    }
+    scrolled = 1;
+    spin_unlock_irqrestore(&terminal_lock, flags);
+    graphics_commit();
 }
 
 void terminal_setcolor(PIXEL fg, PIXEL bg)
 {
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
     terminal_fgcolor = fg;
     terminal_bgcolor = bg;
+
+    unsigned int attr = 0;
+    while (attr < attr_count && (attrs[attr].fg != fg || attrs[attr].bg != bg))
+    {
+        attr++;
+    }
+    if (attr == attr_count)
+    {
+        if (attr_count < TTY_MAX_ATTRS)
+        {
+            attr_count++;
+        }
+        else
+        {
+            attr = TTY_MAX_ATTRS - 1;   // Out of pairs, recolours the cells of the last one
+            terminal_render_locked();
+        }
+        attrs[attr].fg = fg;
+        attrs[attr].bg = bg;
+    }
+    terminal_attr = attr;
+
+    glyph_atlas_build(fg, bg);
+    spin_unlock_irqrestore(&terminal_lock, flags);
 }
 
-void terminal_putchar(char c)
+void terminal_getcolor(PIXEL *fg, PIXEL *bg)
+{
+    *fg = terminal_fgcolor;
+    *bg = terminal_bgcolor;
+}
+
+/* Turns the ring by a row and blanks the new bottom one, caller holds terminal_lock */
+static void terminal_scroll()
+{
+    top = (top + 1) % Terminal_height;
+    cell_t *cells = grid_row(Terminal_height - 1);
+    for (size_t x = 0; x < terminal_width; x++)
+    {
+        cells[x].ch = ' ';
+        cells[x].attr = terminal_attr;
+    }
+    scrolled = 1;
+}
+
+/* Caller holds terminal_lock */
+static void terminal_putchar_locked(char c)
 {
+    if (c == '\0')
+    {
+        return;
+    }
     if (c != '\n')
     {
-        drawchar(c, cursor_x, cursor_y, terminal_fgcolor, terminal_bgcolor);
+        cell_t *cell = &grid_row(cursor_y)[cursor_x];
+        cell->ch = c;
+        cell->attr = terminal_attr;
+        row_dirty[(top + cursor_y) % Terminal_height] = 1;
     }
     cursor_x++;
     if (cursor_x == terminal_width || c == '\n')
     {
         cursor_x = 0;
-        cursor_y += 1;
+        if (cursor_y + 1 < Terminal_height)
+        {
+            cursor_y += 1;
+        }
+        else
+        {
+            terminal_scroll();
+        }
+    }
+}
+void terminal_putchar(char c)
+{
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
+    terminal_putchar_locked(c);
+    spin_unlock_irqrestore(&terminal_lock, flags);
+    graphics_commit();
+}
+
+void terminal_write(const char *s, size_t length)
+{
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
+    for (size_t i = 0; i < length; i++)
+    {
+        terminal_putchar_locked(s[i]);
     }
+    spin_unlock_irqrestore(&terminal_lock, flags);
+    graphics_commit();
 }
 
 void terminal_puts(char *s)
 {
+    uint64_t flags = spin_lock_irqsave(&terminal_lock);
     while (*s)
     {
-        terminal_putchar(*s);
+        terminal_putchar_locked(*s);
         s++;
     }
+    spin_unlock_irqrestore(&terminal_lock, flags);
+    graphics_commit();
 }
\ No newline at end of file
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/virtio.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Legacy virtio over PCI and split virtqueues
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/io.h>
+#include <asm/page.h>
+#include <kernel/buddy.h>
+#include <kernel/errno.h>
+#include <kernel/paging.h>
+#include <kernel/slab.h>
+#include <kernel/virtio.h>
+
+/* Legacy register block */
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_SIZE 0x0C
+#define VIRTIO_PCI_QUEUE_SELECT 0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+#define VIRTIO_PCI_CONFIG 0x14          // Device specific, while MSI-X is off
+
+#define VRING_ALIGN 4096
+
+static size_t vring_size(uint16_t size)
+{
+    size_t avail_end = sizeof(vring_desc_t) * size + sizeof(uint16_t) * (3 + size);
+    avail_end = (avail_end + VRING_ALIGN - 1) & ~(size_t)(VRING_ALIGN - 1);
+    return avail_end + sizeof(uint16_t) * 3 + sizeof(vring_used_elem_t) * size;
+}
+
+int virtio_pci_init(virtio_device_t *vdev, pci_device_t *pci)
+{
+    if (!pci->bars[0].io)
+    {
+        return -ENODEV;
+    }
+    vdev->pci = pci;
+    vdev->io = pci->bars[0].base;
+    vdev->features = 0;
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    outb(vdev->io + VIRTIO_PCI_STATUS, 0);
+    outb(vdev->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(vdev->io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    return 0;
+}
+
+uint32_t virtio_negotiate(virtio_device_t *vdev, uint32_t wanted)
+{
+    vdev->features = inl(vdev->io + VIRTIO_PCI_HOST_FEATURES) & wanted;
+    outl(vdev->io + VIRTIO_PCI_GUEST_FEATURES, vdev->features);
+    return vdev->features;
+}
+
+void virtio_driver_ok(virtio_device_t *vdev)
+{
+    outb(vdev->io + VIRTIO_PCI_STATUS, inb(vdev->io + VIRTIO_PCI_STATUS) | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_device_t *vdev)
+{
+    outb(vdev->io + VIRTIO_PCI_STATUS, inb(vdev->io + VIRTIO_PCI_STATUS) | VIRTIO_STATUS_FAILED);
+}
+
+uint8_t virtio_config_read8(virtio_device_t *vdev, uint16_t offset)
+{
+    return inb(vdev->io + VIRTIO_PCI_CONFIG + offset);
+}
+
+uint16_t virtio_config_read16(virtio_device_t *vdev, uint16_t offset)
+{
+    return inw(vdev->io + VIRTIO_PCI_CONFIG + offset);
+}
+
+uint32_t virtio_config_read32(virtio_device_t *vdev, uint16_t offset)
+{
+    return inl(vdev->io + VIRTIO_PCI_CONFIG + offset);
+}
+
+int virtqueue_init(virtqueue_t *vq, virtio_device_t *vdev, uint16_t index)
+{
+    outw(vdev->io + VIRTIO_PCI_QUEUE_SELECT, index);
+    uint16_t size = inw(vdev->io + VIRTIO_PCI_QUEUE_SIZE);
+    if (!size)
+    {
+        return -ENOENT;
+    }
+
+    size_t bytes = vring_size(size);
+    unsigned int order = 0;
+    while ((PAGE_SIZE << order) < bytes)
+    {
+        order++;
+    }
+    uintptr_t phys = page_alloc(order);
+    vq->cookies = kmalloc(sizeof(void *) * size);
+    if (!phys || !vq->cookies)
+    {
+        if (phys)
+        {
+            page_free(phys, order);
+        }
+        kfree(vq->cookies);
+        return -ENOMEM;
+    }
+
+    uint64_t *ring = phys_to_virt(phys);
+    for (size_t i = 0; i < (PAGE_SIZE << order) / sizeof(uint64_t); i++)
+    {
+        ring[i] = 0;
+    }
+    vq->vdev = vdev;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (vring_desc_t *)ring;
+    vq->avail = (vring_avail_t *)(vq->desc + size);
+    vq->used = (vring_used_t *)((uintptr_t)ring + vring_size(size) - sizeof(uint16_t) * 3 -
+        sizeof(vring_used_elem_t) * size);
+    for (uint16_t i = 0; i < size; i++)
+    {
+        vq->desc[i].next = i + 1;
+    }
+    vq->free_head = 0;
+    vq->num_free = size;
+    vq->last_used = 0;
+    vq->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;  // Completions are polled
+
+    outl(vdev->io + VIRTIO_PCI_QUEUE_PFN, phys / VRING_ALIGN);
+    return 0;
+}
+
+int virtqueue_add(virtqueue_t *vq, const virtio_buf_t *bufs, unsigned int out, unsigned int in, void *cookie)
+{
+    unsigned int count = out + in;
+    if (!count || count > vq->num_free)
+    {
+        return -ENOSPC;
+    }
+
+    uint16_t head = vq->free_head;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        vring_desc_t *desc = &vq->desc[vq->free_head];
+        desc->addr = bufs[i].phys;
+        desc->len = bufs[i].len;
+        desc->flags = (i < count - 1 ? VRING_DESC_F_NEXT : 0) | (i >= out ? VRING_DESC_F_WRITE : 0);
+        vq->free_head = desc->next;
+    }
+    vq->num_free -= count;
+    vq->cookies[head] = cookie;
+
+    // The device may look at the ring entry as soon as the index moves past it
+    vq->avail->ring[vq->avail->idx % vq->size] = head;
+    __atomic_store_n(&vq->avail->idx, vq->avail->idx + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void virtqueue_kick(virtqueue_t *vq)
+{
+    // The index store must be visible before the device's suppression flag is read
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!(vq->used->flags & VRING_USED_F_NO_NOTIFY))
+    {
+        outw(vq->vdev->io + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+    }
+}
+
+int virtqueue_get(virtqueue_t *vq, void **cookie, uint32_t *len)
+{
+    if (vq->last_used == __atomic_load_n(&vq->used->idx, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    volatile vring_used_elem_t *elem = &vq->used->ring[vq->last_used % vq->size];
+    uint16_t head = elem->id;
+    if (len)
+    {
+        *len = elem->len;
+    }
+    *cookie = vq->cookies[head];
+    vq->last_used++;
+
+    // Returns the chain to the free list
+    uint16_t id = head;
+    vq->num_free++;
+    while (vq->desc[id].flags & VRING_DESC_F_NEXT)
+    {
+        id = vq->desc[id].next;
+        vq->num_free++;
+    }
+    vq->desc[id].next = vq->free_head;
+    vq->free_head = head;
+    return 1;
+}
+
+int virtio_map(const void *buf, size_t len, virtio_buf_t *bufs, unsigned int max)
+{
+    uintptr_t virt = (uintptr_t)buf;
+    unsigned int count = 0;
+    while (len)
+    {
+        uintptr_t phys;
+        if (paging_translate(virt, &phys) < 0)
+        {
+            return -EFAULT;
+        }
+        size_t chunk = PAGE_SIZE - (virt & ~PAGE_MASK);
+        if (chunk > len)
+        {
+            chunk = len;
+        }
+
+        if (count && bufs[count - 1].phys + bufs[count - 1].len == phys)
+        {
+            bufs[count - 1].len += chunk;   // Still contiguous, e.g. in the direct map
+        }
+        else if (count == max)
+        {
+            return -E2BIG;
+        }
+        else
+        {
+            bufs[count].phys = phys;
+            bufs[count].len = chunk;
+            count++;
+        }
+        virt += chunk;
+        len -= chunk;
+    }
+    return count;
+}
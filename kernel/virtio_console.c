@@ -0,0 +1,523 @@
+// SPDX-License-Identifier: MIT
+/*
+ * kernel/virtio_console.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * virtio-console driver with multiple ports for log and trace export
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/page.h>
+#include <kernel/buddy.h>
+#include <kernel/errno.h>
+#include <kernel/kprintf.h>
+#include <kernel/slab.h>
+#include <kernel/spinlock.h>
+#include <kernel/string.h>
+#include <kernel/time.h>
+#include <kernel/virtio.h>
+#include <kernel/virtio_console.h>
+
+#define VIRTIO_CONSOLE_DEVICE 0x1003    // Transitional device, legacy interface
+
+#define VIRTIO_CONSOLE_F_MULTIPORT (1 << 1)
+
+/* Device configuration */
+#define VIRTIO_CONSOLE_MAX_NR_PORTS 4
+
+/* Control events */
+#define VIRTIO_CONSOLE_DEVICE_READY 0
+#define VIRTIO_CONSOLE_DEVICE_ADD 1
+#define VIRTIO_CONSOLE_DEVICE_REMOVE 2
+#define VIRTIO_CONSOLE_PORT_READY 3
+#define VIRTIO_CONSOLE_CONSOLE_PORT 4
+#define VIRTIO_CONSOLE_PORT_OPEN 6
+#define VIRTIO_CONSOLE_PORT_NAME 7
+
+#define CONTROL_QUEUE_RX 2
+#define CONTROL_QUEUE_TX 3
+#define CONTROL_BUF_SIZE 128
+#define CONTROL_RX_BUFS 16
+
+#define CONTROL_TIMEOUT_MS 200
+#define CONTROL_QUIET_MS 10             // Announcements are over once the device is quiet this long
+#define FLUSH_TIMEOUT_MS 100
+
+#define STAGING_SIZE (PAGE_SIZE << VIRTIO_CONSOLE_STAGING_ORDER)
+
+typedef struct
+{
+    uint32_t id;
+    uint16_t event;
+    uint16_t value;
+} virtio_console_control_t;
+
+/* A chain sent from the staging ring, its cookie in the queue */
+typedef struct
+{
+    uint64_t end;                       // staging_head after the chain
+    int done;
+} staged_chain_t;
+
+typedef struct
+{
+    int present;
+    int console;
+    int host_connected;
+    char name[VIRTIO_CONSOLE_NAME_MAX];
+    spinlock_t lock;
+    virtqueue_t tx;
+    char *staging;
+    uint64_t staging_head, staging_tail;
+    staged_chain_t *staged;             // Chains sent from staging, in submission order
+    uint16_t staged_head, staged_tail;
+} vcon_port_t;
+
+static virtio_device_t vcon;
+static vcon_port_t ports[VIRTIO_CONSOLE_MAX_PORTS];
+static unsigned int nports;
+static virtqueue_t control_rx, control_tx;
+static char *control_bufs;              // CONTROL_RX_BUFS receive buffers, then one to send from
+
+static inline uint16_t port_tx_queue(unsigned int id)
+{
+    return id ? 3 + 2 * id : 1;
+}
+
+static vcon_port_t *port_get(int id)
+{
+    if (id < 0 || (unsigned int)id >= nports || !__atomic_load_n(&ports[id].present, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &ports[id];
+}
+
+static int port_setup(unsigned int id)
+{
+    vcon_port_t *port = &ports[id];
+    spin_lock_init(&port->lock, "vcon port");
+    int ret = virtqueue_init(&port->tx, &vcon, port_tx_queue(id));
+    if (ret < 0)
+    {
+        return ret;
+    }
+    uintptr_t staging = page_alloc(VIRTIO_CONSOLE_STAGING_ORDER);
+    port->staged = kmalloc(sizeof(staged_chain_t) * port->tx.size);
+    if (!staging || !port->staged)
+    {
+        return -ENOMEM;
+    }
+    port->staging = phys_to_virt(staging);
+    return 0;
+}
+
+static int control_send(uint32_t id, uint16_t event, uint16_t value)
+{
+    virtio_console_control_t *msg = (virtio_console_control_t *)(control_bufs + CONTROL_RX_BUFS * CONTROL_BUF_SIZE);
+    msg->id = id;
+    msg->event = event;
+    msg->value = value;
+    virtio_buf_t buf = {virt_to_phys(msg), sizeof(*msg)};
+    int ret = virtqueue_add(&control_tx, &buf, 1, 0, NULL);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    virtqueue_kick(&control_tx);
+
+    // The message buffer is reused, so wait until the device has read it
+    uint64_t deadline = ktime_get_ns() + CONTROL_TIMEOUT_MS * NSEC_PER_MSEC;
+    void *cookie;
+    while (!virtqueue_get(&control_tx, &cookie, NULL))
+    {
+        if (ktime_get_ns() > deadline)
+        {
+            return -EIO;
+        }
+        pause();
+    }
+    return 0;
+}
+
+static void control_post(char *buf)
+{
+    virtio_buf_t vbuf = {virt_to_phys(buf), CONTROL_BUF_SIZE};
+    virtqueue_add(&control_rx, &vbuf, 0, 1, buf);
+}
+
+static void control_handle(virtio_console_control_t *msg, uint32_t len)
+{
+    if (msg->id >= nports)
+    {
+        return;
+    }
+    vcon_port_t *port = &ports[msg->id];
+    switch (msg->event)
+    {
+    case VIRTIO_CONSOLE_DEVICE_ADD:
+        if (port->staging)
+        {
+            __atomic_store_n(&port->present, 1, __ATOMIC_RELEASE);
+            control_send(msg->id, VIRTIO_CONSOLE_PORT_READY, 1);
+            control_send(msg->id, VIRTIO_CONSOLE_PORT_OPEN, 1);
+        }
+        else
+        {
+            control_send(msg->id, VIRTIO_CONSOLE_PORT_READY, 0);
+        }
+        break;
+
+    case VIRTIO_CONSOLE_DEVICE_REMOVE:
+        __atomic_store_n(&port->present, 0, __ATOMIC_RELEASE);
+        break;
+
+    case VIRTIO_CONSOLE_CONSOLE_PORT:
+        port->console = 1;
+        break;
+
+    case VIRTIO_CONSOLE_PORT_OPEN:
+        port->host_connected = msg->value;
+        break;
+
+    case VIRTIO_CONSOLE_PORT_NAME:
+    {
+        // The name follows the message, not NUL terminated
+        const char *name = (const char *)(msg + 1);
+        size_t length = len - sizeof(*msg);
+        if (length >= VIRTIO_CONSOLE_NAME_MAX)
+        {
+            length = VIRTIO_CONSOLE_NAME_MAX - 1;
+        }
+        for (size_t i = 0; i < length; i++)
+        {
+            port->name[i] = name[i];
+        }
+        port->name[length] = '\0';
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+/* Ports are announced over the control queue, hotplug after boot is not followed */
+static void control_poll()
+{
+    uint64_t now = ktime_get_ns();
+    uint64_t deadline = now + CONTROL_TIMEOUT_MS * NSEC_PER_MSEC;
+    uint64_t quiet = now + CONTROL_QUIET_MS * NSEC_PER_MSEC;
+    while (now < deadline && now < quiet)
+    {
+        void *cookie;
+        uint32_t len;
+        if (virtqueue_get(&control_rx, &cookie, &len))
+        {
+            if (len >= sizeof(virtio_console_control_t))
+            {
+                control_handle(cookie, len);
+            }
+            control_post(cookie);
+            virtqueue_kick(&control_rx);
+            quiet = ktime_get_ns() + CONTROL_QUIET_MS * NSEC_PER_MSEC;
+        }
+        else
+        {
+            pause();
+        }
+        now = ktime_get_ns();
+    }
+}
+
+static int control_init()
+{
+    uintptr_t page = page_alloc(0);
+    if (!page)
+    {
+        return -ENOMEM;
+    }
+    control_bufs = phys_to_virt(page);
+    int ret = virtqueue_init(&control_rx, &vcon, CONTROL_QUEUE_RX);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = virtqueue_init(&control_tx, &vcon, CONTROL_QUEUE_TX);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    for (int i = 0; i < CONTROL_RX_BUFS && i < control_rx.size; i++)
+    {
+        control_post(control_bufs + i * CONTROL_BUF_SIZE);
+    }
+    return 0;
+}
+
+int virtio_console_init()
+{
+    pci_device_t *pci = pci_find(VIRTIO_VENDOR, VIRTIO_CONSOLE_DEVICE, NULL);
+    if (!pci || virtio_pci_init(&vcon, pci) < 0)
+    {
+        return -ENODEV;
+    }
+
+    int multiport = virtio_negotiate(&vcon, VIRTIO_CONSOLE_F_MULTIPORT) & VIRTIO_CONSOLE_F_MULTIPORT;
+    nports = multiport ? virtio_config_read32(&vcon, VIRTIO_CONSOLE_MAX_NR_PORTS) : 1;
+    if (nports > VIRTIO_CONSOLE_MAX_PORTS)
+    {
+        nports = VIRTIO_CONSOLE_MAX_PORTS;
+    }
+    // Receiving is not supported, so only the transmit queue of each port is set up
+    for (unsigned int id = 0; id < nports; id++)
+    {
+        if (port_setup(id) < 0)
+        {
+            kprintf("virtio-console: port %u unavailable\n", id);
+        }
+    }
+    if (multiport && control_init() < 0)
+    {
+        virtio_fail(&vcon);
+        return -ENOMEM;
+    }
+    virtio_driver_ok(&vcon);
+
+    if (multiport)
+    {
+        virtqueue_kick(&control_rx);
+        control_send(0, VIRTIO_CONSOLE_DEVICE_READY, 1);
+        control_poll();
+    }
+    else if (ports[0].staging)
+    {
+        ports[0].console = 1;
+        ports[0].host_connected = 1;
+        __atomic_store_n(&ports[0].present, 1, __ATOMIC_RELEASE);
+    }
+
+    for (unsigned int id = 0; id < nports; id++)
+    {
+        if (ports[id].present)
+        {
+            kprintf("virtio-console: port %u%s%s%s\n", id, ports[id].name[0] ? " " : "", ports[id].name,
+                ports[id].console ? " (console)" : "");
+        }
+    }
+    return 0;
+}
+
+int virtio_console_find(const char *name)
+{
+    for (unsigned int id = 0; id < nports; id++)
+    {
+        if (!port_get(id))
+        {
+            continue;
+        }
+        if (!name)
+        {
+            if (ports[id].console)
+            {
+                return id;
+            }
+            continue;
+        }
+        const char *a = ports[id].name;
+        const char *b = name;
+        while (*a && *a == *b)
+        {
+            a++;
+            b++;
+        }
+        if (*a == *b)
+        {
+            return id;
+        }
+    }
+    return -ENOENT;
+}
+
+static void port_reap(vcon_port_t *port)
+{
+    for (;;)
+    {
+        void *cookie;
+        uint64_t irq = spin_lock_irqsave(&port->lock);
+        int got = virtqueue_get(&port->tx, &cookie, NULL);
+        staged_chain_t *chain = cookie;
+        if (got && chain >= port->staged && chain < port->staged + port->tx.size)
+        {
+            // Buffers may come back out of order, staging is only released up to the oldest chain in flight
+            chain->done = 1;
+            while (port->staged_tail != port->staged_head && port->staged[port->staged_tail % port->tx.size].done)
+            {
+                chain = &port->staged[port->staged_tail++ % port->tx.size];
+                port->staging_tail = chain->end;
+                chain->done = 0;
+            }
+            cookie = NULL;
+        }
+        spin_unlock_irqrestore(&port->lock, irq);
+
+        if (!got)
+        {
+            break;
+        }
+        virtio_console_req_t *req = cookie;
+        if (req && req->done)
+        {
+            req->done(req);
+        }
+    }
+}
+
+size_t virtio_console_write(int id, const char *s, size_t length)
+{
+    vcon_port_t *port = port_get(id);
+    if (!port)
+    {
+        return 0;
+    }
+    port_reap(port);
+
+    uint64_t irq = spin_lock_irqsave(&port->lock);
+    size_t space = STAGING_SIZE - (port->staging_head - port->staging_tail);
+    if (length > space)
+    {
+        length = space;
+    }
+    // Completed chains wait here behind an older one still in flight, they can outnumber the descriptors
+    if (!length || (uint16_t)(port->staged_head - port->staged_tail) >= port->tx.size)
+    {
+        spin_unlock_irqrestore(&port->lock, irq);
+        return 0;
+    }
+
+    size_t offset = port->staging_head % STAGING_SIZE;
+    size_t first = length < STAGING_SIZE - offset ? length : STAGING_SIZE - offset;
+    memcpy(port->staging + offset, s, first);
+    memcpy(port->staging, s + first, length - first);
+    virtio_buf_t bufs[2] = {
+        {virt_to_phys(port->staging) + offset, first},
+        {virt_to_phys(port->staging), length - first},
+    };
+    staged_chain_t *chain = &port->staged[port->staged_head % port->tx.size];
+    if (virtqueue_add(&port->tx, bufs, first < length ? 2 : 1, 0, chain) < 0)
+    {
+        spin_unlock_irqrestore(&port->lock, irq);
+        return 0;
+    }
+    port->staging_head += length;
+    chain->end = port->staging_head;
+    chain->done = 0;
+    port->staged_head++;
+    virtqueue_kick(&port->tx);
+    spin_unlock_irqrestore(&port->lock, irq);
+    return length;
+}
+
+int virtio_console_submit(int id, virtio_console_req_t *req)
+{
+    vcon_port_t *port = port_get(id);
+    if (!port)
+    {
+        return -ENODEV;
+    }
+    virtio_buf_t bufs[VIRTIO_MAX_SEGMENTS];
+    int count = virtio_map(req->buf, req->len, bufs, VIRTIO_MAX_SEGMENTS);
+    if (count < 0)
+    {
+        return count;
+    }
+    port_reap(port);
+
+    uint64_t irq = spin_lock_irqsave(&port->lock);
+    int ret = virtqueue_add(&port->tx, bufs, count, 0, req);
+    if (ret == 0)
+    {
+        virtqueue_kick(&port->tx);
+    }
+    spin_unlock_irqrestore(&port->lock, irq);
+    return ret;
+}
+
+void virtio_console_poll(int id)
+{
+    vcon_port_t *port = port_get(id);
+    if (port)
+    {
+        port_reap(port);
+    }
+}
+
+void virtio_console_flush(int id)
+{
+    vcon_port_t *port = port_get(id);
+    if (!port)
+    {
+        return;
+    }
+    uint64_t deadline = ktime_get_ns() + FLUSH_TIMEOUT_MS * NSEC_PER_MSEC;
+    for (;;)
+    {
+        port_reap(port);
+        if (__atomic_load_n(&port->tx.num_free, __ATOMIC_RELAXED) == port->tx.size || ktime_get_ns() > deadline)
+        {
+            break;
+        }
+        pause();
+    }
+}
+
+void virtio_sink_write(kprintf_sink_t *sink, const char *s, size_t length)
+{
+    int id = ((virtio_sink_t *)sink)->port;
+    uint64_t deadline = 0;
+    for (size_t sent = 0; sent < length && port_get(id); )
+    {
+        size_t n = virtio_console_write(id, s + sent, length - sent);
+        if (n)
+        {
+            sent += n;
+            deadline = 0;
+            continue;
+        }
+        // Drops the rest rather than hang the console if the host stopped reading
+        uint64_t now = ktime_get_ns();
+        if (!deadline)
+        {
+            deadline = now + FLUSH_TIMEOUT_MS * NSEC_PER_MSEC;
+        }
+        else if (now > deadline)
+        {
+            break;
+        }
+        pause();
+    }
+}
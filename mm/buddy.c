@@ -0,0 +1,416 @@
+// SPDX-License-Identifier: MIT
+/*
+ * mm/buddy.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Buddy allocator of physical page frames
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <asm/page.h>
+#include <boot/bootboot.h>
+#include <kernel/buddy.h>
+#include <kernel/env.h>
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+#include <kernel/smp.h>
+#include <kernel/topology.h>
+
+#define LOW_MEMORY_LIMIT 0x100000   // The first 1 MiB is left to the firmware and AP trampolines
+
+extern BOOTBOOT bootboot;   // Infomation provided by BOOTBOOT Loader
+
+uintptr_t mem_map_phys;     // Physical address of the page descriptor array
+uint64_t max_pfn;           // Page descriptors cover [0, max_pfn)
+
+static zone_t zones[MAX_NUMA_NODES];
+static unsigned int zone_count;
+static unsigned int boot_node;      // Holds low memory, serves everything until the direct map exists
+
+static void free_list_push(zone_t *zone, unsigned int order, uint64_t pfn)
+{
+    free_area_t *area = &zone->free_area[order];
+    page_t *page = pfn_to_page(pfn);
+
+    page->prev = PFN_NONE;
+    page->next = area->head;
+    if (area->head != PFN_NONE)
+    {
+        pfn_to_page(area->head)->prev = pfn;
+    }
+    area->head = pfn;
+    area->count++;
+
+    page->order = order;
+    page->flags = PAGE_FREE;
+}
+
+static void free_list_remove(zone_t *zone, unsigned int order, uint64_t pfn)
+{
+    free_area_t *area = &zone->free_area[order];
+    page_t *page = pfn_to_page(pfn);
+
+    if (page->prev != PFN_NONE)
+    {
+        pfn_to_page(page->prev)->next = page->next;
+    }
+    else
+    {
+        area->head = page->next;
+    }
+    if (page->next != PFN_NONE)
+    {
+        pfn_to_page(page->next)->prev = page->prev;
+    }
+    area->count--;
+
+    page->flags = 0;
+}
+
+/* Returns a block to the free lists, merging it with its buddies as far as possible */
+static void buddy_free_block(zone_t *zone, uint64_t pfn, unsigned int order)
+{
+    zone->free_pages += 1UL << order;
+
+    while (order < BUDDY_MAX_ORDER)
+    {
+        uint64_t buddy = pfn ^ (1UL << order);
+        if (buddy >= max_pfn)
+        {
+            break;
+        }
+        page_t *page = pfn_to_page(buddy);
+        if (!(page->flags & PAGE_FREE) || page->order != order || page->node != zone->node)
+        {
+            break;
+        }
+        free_list_remove(zone, order, buddy);
+        pfn &= ~(1UL << order);
+        order++;
+    }
+    free_list_push(zone, order, pfn);
+}
+
+/* Releases [start, end) to the allocator as the largest naturally aligned blocks */
+static void buddy_add_range(uint64_t start, uint64_t end)
+{
+    while (start < end)
+    {
+        unsigned int order = BUDDY_MAX_ORDER;
+        zone_t *zone = &zones[pfn_to_page(start)->node];
+        // A block must not span two nodes either
+        while (order && ((start & ((1UL << order) - 1)) || start + (1UL << order) > end ||
+            pfn_to_page(start + (1UL << order) - 1)->node != zone->node))
+        {
+            order--;
+        }
+        zone->managed_pages += 1UL << order;
+        buddy_free_block(zone, start, order);
+        start += 1UL << order;
+    }
+}
+
+/* Nearest nodes first, ties in node order, leaving out those further than the numa_distance key */
+static void buddy_default_fallback(zone_t *zone)
+{
+    uint64_t limit = env_get_number("numa_distance", 0);
+    unsigned int count = 0;
+    zone->fallback[count++] = zone->node;
+    for (unsigned int i = 1; i < zone_count; i++)
+    {
+        unsigned int best = MAX_NUMA_NODES;
+        for (unsigned int node = 0; node < zone_count; node++)
+        {
+            int taken = 0;
+            for (unsigned int j = 0; j < count; j++)
+            {
+                taken |= zone->fallback[j] == node;
+            }
+            if (!taken && (best == MAX_NUMA_NODES ||
+                numa_distance(zone->node, node) < numa_distance(zone->node, best)))
+            {
+                best = node;
+            }
+        }
+        if (limit && numa_distance(zone->node, best) > limit)
+        {
+            break;
+        }
+        zone->fallback[count++] = best;
+    }
+    zone->fallback_count = count;
+}
+
+void buddy_init()
+{
+    zone_count = numa_node_count();
+    for (unsigned int node = 0; node < zone_count; node++)
+    {
+        mcs_lock_init(&zones[node].lock, "zone");
+        zones[node].node = node;
+        for (unsigned int order = 0; order <= BUDDY_MAX_ORDER; order++)
+        {
+            zones[node].free_area[order].head = PFN_NONE;
+        }
+    }
+
+    MMapEnt *mmap_end = (MMapEnt *)((uint8_t *)&bootboot + bootboot.size);
+
+    for (MMapEnt *ent = &bootboot.mmap; ent < mmap_end; ent++)
+    {
+        if (MMapEnt_IsFree(ent) && (MMapEnt_Ptr(ent) + MMapEnt_Size(ent)) >> PAGE_SHIFT > max_pfn)
+        {
+            max_pfn = (MMapEnt_Ptr(ent) + MMapEnt_Size(ent)) >> PAGE_SHIFT;
+        }
+    }
+
+    // Carve the descriptor array out of the first free region large enough to hold it
+    uint64_t mem_map_size = PAGE_ALIGN(max_pfn * sizeof(page_t));
+    for (MMapEnt *ent = &bootboot.mmap; ent < mmap_end && !mem_map_phys; ent++)
+    {
+        uint64_t start = PAGE_ALIGN(MMapEnt_Ptr(ent));
+        uint64_t end = (MMapEnt_Ptr(ent) + MMapEnt_Size(ent)) & PAGE_MASK;
+        if (start < LOW_MEMORY_LIMIT)
+        {
+            start = LOW_MEMORY_LIMIT;
+        }
+        if (MMapEnt_IsFree(ent) && start < end && end - start >= mem_map_size)
+        {
+            mem_map_phys = start;
+        }
+    }
+    if (!mem_map_phys)
+    {
+        panic("No room for %lu page descriptors\n", max_pfn);
+    }
+
+    page_t *mem_map = pfn_to_page(0);
+    for (uint64_t pfn = 0; pfn < max_pfn; pfn++)
+    {
+        mem_map[pfn] = (page_t){.next = PFN_NONE, .prev = PFN_NONE, .order = 0, .flags = PAGE_RESERVED};
+    }
+    // Memory SRAT does not cover stays on node 0
+    for (unsigned int i = 0; i < numa_memblk_count; i++)
+    {
+        uint64_t end = numa_memblks[i].end >> PAGE_SHIFT;
+        for (uint64_t pfn = numa_memblks[i].start >> PAGE_SHIFT; pfn < end && pfn < max_pfn; pfn++)
+        {
+            mem_map[pfn].node = numa_memblks[i].node;
+        }
+    }
+    boot_node = numa_node_of_phys(LOW_MEMORY_LIMIT);
+
+    // Walk the map backwards so low memory ends up at the head of the free lists. Early
+    // allocations then stay inside the loader's identity map until paging_init() replaces it
+    uint64_t mem_map_start = mem_map_phys >> PAGE_SHIFT;
+    uint64_t mem_map_end = (mem_map_phys + mem_map_size) >> PAGE_SHIFT;
+    for (MMapEnt *ent = mmap_end - 1; ent >= &bootboot.mmap; ent--)
+    {
+        if (!MMapEnt_IsFree(ent))
+        {
+            continue;
+        }
+        uint64_t start = PAGE_ALIGN(MMapEnt_Ptr(ent)) >> PAGE_SHIFT;
+        uint64_t end = (MMapEnt_Ptr(ent) + MMapEnt_Size(ent)) >> PAGE_SHIFT;
+        if (start < LOW_MEMORY_LIMIT >> PAGE_SHIFT)
+        {
+            start = LOW_MEMORY_LIMIT >> PAGE_SHIFT;
+        }
+        if (start >= end)
+        {
+            continue;
+        }
+
+        // Skip the pages holding the descriptor array
+        if (start < mem_map_end && end > mem_map_start)
+        {
+            if (start < mem_map_start)
+            {
+                buddy_add_range(start, mem_map_start);
+            }
+            if (end > mem_map_end)
+            {
+                buddy_add_range(mem_map_end, end);
+            }
+        }
+        else
+        {
+            buddy_add_range(start, end);
+        }
+    }
+
+    for (unsigned int node = 0; node < zone_count; node++)
+    {
+        buddy_default_fallback(&zones[node]);
+    }
+}
+
+static uintptr_t zone_alloc(zone_t *zone, unsigned int order)
+{
+    mcs_node_t node;
+    uint64_t flags = mcs_lock_irqsave(&zone->lock, &node);
+    unsigned int current = order;
+    while (current <= BUDDY_MAX_ORDER && zone->free_area[current].head == PFN_NONE)
+    {
+        current++;
+    }
+    if (current > BUDDY_MAX_ORDER)
+    {
+        mcs_unlock_irqrestore(&zone->lock, &node, flags);
+        return 0;
+    }
+
+    uint64_t pfn = zone->free_area[current].head;
+    free_list_remove(zone, current, pfn);
+
+    // Split the block, returning the upper halves to the free lists
+    while (current > order)
+    {
+        current--;
+        free_list_push(zone, current, pfn + (1UL << current));
+    }
+
+    page_t *page = pfn_to_page(pfn);
+    page->order = order;
+    page->flags = 0;
+    page->private = 0;
+    zone->free_pages -= 1UL << order;
+    mcs_unlock_irqrestore(&zone->lock, &node, flags);
+    return pfn << PAGE_SHIFT;
+}
+
+uintptr_t page_alloc_node(unsigned int order, unsigned int node)
+{
+    zone_t *zone = &zones[node < zone_count ? node : 0];
+    for (unsigned int i = 0; i < zone->fallback_count; i++)
+    {
+        uintptr_t phys = zone_alloc(&zones[zone->fallback[i]], order);
+        if (phys)
+        {
+            return phys;
+        }
+    }
+    return 0;
+}
+
+uintptr_t page_alloc(unsigned int order)
+{
+    // Before paging_init() only low memory is reachable, wherever the caller runs
+    return page_alloc_node(order, direct_map_offset ? cpu_node(cpu_id()) : boot_node);
+}
+
+void page_free(uintptr_t phys, unsigned int order)
+{
+    uint64_t pfn = phys >> PAGE_SHIFT;
+    page_t *page = pfn_to_page(pfn);
+
+    if (pfn >= max_pfn || (phys & ~PAGE_MASK) || page->flags || page->order != order)
+    {
+        panic("Bad page_free(%p, %u)\n", phys, order);
+    }
+
+    zone_t *zone = &zones[page->node];
+    mcs_node_t node;
+    uint64_t flags = mcs_lock_irqsave(&zone->lock, &node);
+    buddy_free_block(zone, pfn, order);
+    mcs_unlock_irqrestore(&zone->lock, &node, flags);
+}
+
+void buddy_set_fallback(unsigned int node, const unsigned int *nodes, unsigned int count)
+{
+    if (node >= zone_count)
+    {
+        return;
+    }
+    // Readers go through the list without a lock, so the count shrinks first and grows last
+    zone_t *zone = &zones[node];
+    __atomic_store_n(&zone->fallback_count, 1, __ATOMIC_RELEASE);
+    unsigned int used = 1;
+    for (unsigned int i = 0; i < count && used < MAX_NUMA_NODES; i++)
+    {
+        if (nodes[i] < zone_count && nodes[i] != node)
+        {
+            zone->fallback[used++] = nodes[i];
+        }
+    }
+    __atomic_store_n(&zone->fallback_count, used, __ATOMIC_RELEASE);
+}
+
+uint64_t buddy_free_count(unsigned int order)
+{
+    uint64_t count = 0;
+    for (unsigned int node = 0; node < zone_count && order <= BUDDY_MAX_ORDER; node++)
+    {
+        count += zones[node].free_area[order].count;
+    }
+    return count;
+}
+
+uint64_t buddy_free_pages()
+{
+    uint64_t pages = 0;
+    for (unsigned int node = 0; node < zone_count; node++)
+    {
+        pages += zones[node].free_pages;
+    }
+    return pages;
+}
+
+uint64_t buddy_node_free_pages(unsigned int node)
+{
+    return node < zone_count ? zones[node].free_pages : 0;
+}
+
+void buddy_dump()
+{
+    uint64_t managed = 0;
+    for (unsigned int node = 0; node < zone_count; node++)
+    {
+        managed += zones[node].managed_pages;
+    }
+    kprintf("Physical memory: %lu KiB free of %lu KiB\n", buddy_free_pages() * 4, managed * 4);
+    for (unsigned int order = 0; order <= BUDDY_MAX_ORDER; order++)
+    {
+        if (buddy_free_count(order))
+        {
+            kprintf("  order %u (%lu KiB): %lu free\n", order, (PAGE_SIZE << order) / 1024, buddy_free_count(order));
+        }
+    }
+    if (zone_count < 2)
+    {
+        return;
+    }
+    for (unsigned int node = 0; node < zone_count; node++)
+    {
+        kprintf("  node %u: %lu KiB free of %lu KiB, falls back to", node, zones[node].free_pages * 4,
+            zones[node].managed_pages * 4);
+        for (unsigned int i = 1; i < zones[node].fallback_count; i++)
+        {
+            kprintf(" %u", zones[node].fallback[i]);
+        }
+        kprintf(zones[node].fallback_count > 1 ? "\n" : " nothing\n");
+    }
+}
@@ -0,0 +1,441 @@
+// SPDX-License-Identifier: MIT
+/*
+ * mm/slab.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Slab allocator with per-CPU magazines, and kmalloc built on it
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <asm/cpu.h>
+#include <asm/page.h>
+#include <kernel/buddy.h>
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+
+#define KMEM_MAX_CACHES 32
+#define SLAB_MAX_ORDER 5
+
+static kmem_cache_t *caches[KMEM_MAX_CACHES]; // Indexed by cache id, pages of a slab are tagged with id + 1
+static unsigned int cache_count;
+static DEFINE_SPINLOCK(cache_list_lock);
+
+static kmem_cache_t magazine_cache;
+static kmem_cache_t kmalloc_caches[KMALLOC_CLASSES];
+
+static const char *kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+    "kmalloc-512", "kmalloc-1k", "kmalloc-2k", "kmalloc-4k", "kmalloc-8k"
+};
+
+static inline uintptr_t slab_bytes(kmem_cache_t *cache)
+{
+    return PAGE_SIZE << cache->order;
+}
+
+static inline unsigned int kmalloc_index(size_t size)
+{
+    if (size <= KMALLOC_MIN_SIZE)
+    {
+        return 0;
+    }
+    return 64 - __builtin_clzl(size - 1) - 4;
+}
+
+static void partial_add(kmem_cache_t *cache, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if (cache->partial)
+    {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+static void partial_remove(kmem_cache_t *cache, slab_t *slab)
+{
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        cache->partial = slab->next;
+    }
+    if (slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+}
+
+static slab_t *slab_create(kmem_cache_t *cache)
+{
+    uintptr_t phys = page_alloc(cache->order);
+    if (!phys)
+    {
+        return NULL;
+    }
+    for (uint64_t i = 0; i < (1UL << cache->order); i++)
+    {
+        pfn_to_page((phys >> PAGE_SHIFT) + i)->private = cache->id + 1;
+    }
+
+    // The header takes the first cache line, objects follow it
+    slab_t *slab = phys_to_virt(phys);
+    uint8_t *objs = (uint8_t *)(slab + 1);
+    slab->inuse = 0;
+    slab->total = (slab_bytes(cache) - sizeof(slab_t)) / cache->size;
+    slab->freelist = NULL;
+    for (uint32_t i = slab->total; i-- > 0;)
+    {
+        void **obj = (void **)(objs + i * cache->size);
+        *obj = slab->freelist;
+        slab->freelist = obj;
+    }
+
+    cache->slabs++;
+    cache->refills++;
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab)
+{
+    uintptr_t phys = virt_to_phys(slab);
+    for (uint64_t i = 0; i < (1UL << cache->order); i++)
+    {
+        pfn_to_page((phys >> PAGE_SHIFT) + i)->private = 0;
+    }
+    page_free(phys, cache->order);
+    cache->slabs--;
+}
+
+static void *slab_alloc_locked(kmem_cache_t *cache)
+{
+    slab_t *slab = cache->partial;
+    if (!slab)
+    {
+        slab = slab_create(cache);
+        if (!slab)
+        {
+            return NULL;
+        }
+        partial_add(cache, slab);
+        cache->empty_slabs++;
+    }
+
+    if (!slab->inuse)
+    {
+        cache->empty_slabs--;
+    }
+    void **obj = slab->freelist;
+    slab->freelist = *obj;
+    if (++slab->inuse == slab->total)
+    {
+        partial_remove(cache, slab);
+    }
+    return obj;
+}
+
+static void slab_free_locked(kmem_cache_t *cache, void *obj)
+{
+    // Slabs are naturally aligned blocks from the buddy allocator
+    slab_t *slab = (slab_t *)((uintptr_t)obj & ~(slab_bytes(cache) - 1));
+
+    if (slab->inuse == slab->total)
+    {
+        partial_add(cache, slab);
+    }
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+    if (--slab->inuse)
+    {
+        return;
+    }
+
+    // Keep a single empty slab around to absorb alloc/free ping-pong
+    if (cache->empty_slabs)
+    {
+        partial_remove(cache, slab);
+        slab_destroy(cache, slab);
+    }
+    else
+    {
+        cache->empty_slabs++;
+    }
+}
+
+void kmem_cache_init(kmem_cache_t *cache, const char *name, size_t size, int percpu)
+{
+    cache->name = name;
+    cache->size = size < sizeof(void *) ? sizeof(void *) : (size + 7) & ~7UL;
+    spin_lock_init(&cache->lock, name);
+    cache->partial = NULL;
+    cache->empty_slabs = 0;
+    cache->slabs = 0;
+    cache->refills = 0;
+    cache->allocs = 0;
+    cache->frees = 0;
+    cache->depot_full = NULL;
+    cache->depot_empty = NULL;
+
+    // Smallest slab that wastes no more than an eighth of itself
+    cache->order = 0;
+    while (cache->order < SLAB_MAX_ORDER)
+    {
+        uintptr_t usable = slab_bytes(cache) - sizeof(slab_t);
+        if (usable >= cache->size && (usable % cache->size + sizeof(slab_t)) * 8 <= slab_bytes(cache))
+        {
+            break;
+        }
+        cache->order++;
+    }
+
+    cache->cpu = NULL;
+    if (percpu)
+    {
+        size_t bytes = cpu_count() * sizeof(kmem_cpu_cache_t);
+        unsigned int order = 0;
+        while ((PAGE_SIZE << order) < bytes)
+        {
+            order++;
+        }
+        uintptr_t phys = page_alloc(order);
+        if (!phys)
+        {
+            panic("Out of memory creating cache %s\n", name);
+        }
+        cache->cpu = phys_to_virt(phys);
+        for (unsigned int i = 0; i < cpu_count(); i++)
+        {
+            cache->cpu[i] = (kmem_cpu_cache_t){.loaded = NULL, .previous = NULL, .allocs = 0, .frees = 0};
+        }
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache_list_lock);
+    if (cache_count == KMEM_MAX_CACHES)
+    {
+        panic("Too many slab caches\n");
+    }
+    cache->id = cache_count;
+    caches[cache_count++] = cache;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+    void *obj;
+
+    if (!cache->cpu)
+    {
+        uint64_t flags = spin_lock_irqsave(&cache->lock);
+        obj = slab_alloc_locked(cache);
+        if (obj)
+        {
+            cache->allocs++;
+        }
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return obj;
+    }
+
+    // Interrupts stay off so nothing else on this processor touches its magazines
+    uint64_t flags = irq_save();
+    kmem_cpu_cache_t *cc = &cache->cpu[cpu_id()];
+    for (;;)
+    {
+        if (cc->loaded && cc->loaded->rounds)
+        {
+            obj = cc->loaded->objs[--cc->loaded->rounds];
+            break;
+        }
+        if (cc->previous && cc->previous->rounds)
+        {
+            magazine_t *tmp = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = tmp;
+            continue;
+        }
+
+        // Both magazines are empty, trade one for a full magazine from the depot
+        spin_lock(&cache->lock);
+        magazine_t *full = cache->depot_full;
+        if (full)
+        {
+            cache->depot_full = full->next;
+            if (cc->previous)
+            {
+                cc->previous->next = cache->depot_empty;
+                cache->depot_empty = cc->previous;
+            }
+            cc->previous = cc->loaded;
+            cc->loaded = full;
+            spin_unlock(&cache->lock);
+            continue;
+        }
+        obj = slab_alloc_locked(cache);
+        spin_unlock(&cache->lock);
+        break;
+    }
+    if (obj)
+    {
+        cc->allocs++;
+    }
+    irq_restore(flags);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+    if (!cache->cpu)
+    {
+        uint64_t flags = spin_lock_irqsave(&cache->lock);
+        slab_free_locked(cache, obj);
+        cache->frees++;
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    kmem_cpu_cache_t *cc = &cache->cpu[cpu_id()];
+    cc->frees++;
+    for (;;)
+    {
+        if (cc->loaded && cc->loaded->rounds < MAGAZINE_SIZE)
+        {
+            cc->loaded->objs[cc->loaded->rounds++] = obj;
+            break;
+        }
+        if (cc->previous && !cc->previous->rounds)
+        {
+            magazine_t *tmp = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = tmp;
+            continue;
+        }
+
+        // Both magazines are full, trade one for an empty magazine from the depot
+        spin_lock(&cache->lock);
+        magazine_t *empty = cache->depot_empty;
+        if (empty)
+        {
+            cache->depot_empty = empty->next;
+            if (cc->previous)
+            {
+                cc->previous->next = cache->depot_full;
+                cache->depot_full = cc->previous;
+            }
+            cc->previous = cc->loaded;
+            cc->loaded = empty;
+            spin_unlock(&cache->lock);
+            continue;
+        }
+        spin_unlock(&cache->lock);
+
+        empty = kmem_cache_alloc(&magazine_cache);
+        spin_lock(&cache->lock);
+        if (!empty)
+        {
+            slab_free_locked(cache, obj);
+            spin_unlock(&cache->lock);
+            break;
+        }
+        empty->rounds = 0;
+        empty->next = cache->depot_empty;
+        cache->depot_empty = empty;
+        spin_unlock(&cache->lock);
+    }
+    irq_restore(flags);
+}
+
+void kmalloc_init()
+{
+    kmem_cache_init(&magazine_cache, "magazine", sizeof(magazine_t), 0);
+    for (unsigned int i = 0; i < KMALLOC_CLASSES; i++)
+    {
+        kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i], KMALLOC_MIN_SIZE << i, 1);
+    }
+}
+
+void *kmalloc(size_t size)
+{
+    if (!size)
+    {
+        return NULL;
+    }
+    if (size > KMALLOC_MAX_SIZE)
+    {
+        unsigned int order = 0;
+        while ((PAGE_SIZE << order) < size)
+        {
+            order++;
+        }
+        uintptr_t phys = order <= BUDDY_MAX_ORDER ? page_alloc(order) : 0;
+        return phys ? phys_to_virt(phys) : NULL;
+    }
+    return kmem_cache_alloc(&kmalloc_caches[kmalloc_index(size)]);
+}
+
+void kfree(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    uintptr_t phys = virt_to_phys(ptr);
+    page_t *page = pfn_to_page(phys >> PAGE_SHIFT);
+    if (page->private)
+    {
+        kmem_cache_free(caches[page->private - 1], ptr);
+    }
+    else
+    {
+        page_free(phys, page->order);
+    }
+}
+
+void kmalloc_dump()
+{
+    kprintf("cache: allocs frees refills slabs bytes-in-use\n");
+    for (unsigned int i = 0; i < cache_count; i++)
+    {
+        kmem_cache_t *cache = caches[i];
+        uint64_t allocs = cache->allocs;
+        uint64_t frees = cache->frees;
+        if (cache->cpu)
+        {
+            for (unsigned int cpu = 0; cpu < cpu_count(); cpu++)
+            {
+                allocs += cache->cpu[cpu].allocs;
+                frees += cache->cpu[cpu].frees;
+            }
+        }
+        kprintf("%s: %lu %lu %lu %lu %lu\n", cache->name, allocs, frees, cache->refills, cache->slabs, (allocs - frees) * cache->size);
+    }
+}
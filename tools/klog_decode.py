@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+#
+# tools/klog_decode.py
+#
+# Copyright (c) 2024 CharaDrinkingTea
+#
+# Decodes the raw klog stream the kernel writes to COM1 with klog=raw, taking the format strings
+# and %s arguments from the kernel ELF.
+#
+# usage: klog_decode.py kernel.bin serial.log
+#        qemu ... -serial file:serial.log
+
+import re
+import struct
+import sys
+
+KLOG_MAGIC = 0x31474C4B
+HEADER = struct.Struct("<IIQQ")
+RECORD = struct.Struct("<QQHB5x5Q")
+
+CONVERSION = re.compile(r"%([#0\- +]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXcspn%])")
+
+
+class Image:
+    """Loadable segments of the kernel ELF, to read strings by virtual address"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[4] != 2:
+            sys.exit(f"{path}: not an ELF64 file")
+        phoff, = struct.unpack_from("<Q", data, 0x20)
+        phentsize, phnum = struct.unpack_from("<HH", data, 0x36)
+        self.segments = []
+        for i in range(phnum):
+            p_type, _, offset, vaddr, _, filesz, _, _ = struct.unpack_from("<IIQQQQQQ", data, phoff + i * phentsize)
+            if p_type == 1:
+                self.segments.append((vaddr, data[offset:offset + filesz]))
+
+    def string(self, address):
+        for vaddr, blob in self.segments:
+            if vaddr <= address < vaddr + len(blob):
+                start = address - vaddr
+                end = blob.find(b"\0", start)
+                return blob[start:end if end >= 0 else len(blob)].decode("utf-8", "replace")
+        return None
+
+
+def to_signed(value, bits):
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def format_record(image, fmt, words):
+    """Mirrors the kernel formatter, every argument is one 64-bit word"""
+    words = iter(words)
+
+    def convert(match):
+        flags, width, precision, size, spec = match.groups()
+        if spec == "%":
+            return "%"
+        if width == "*":
+            width = str(to_signed(next(words, 0), 32))
+        if precision == "*":
+            precision = str(to_signed(next(words, 0), 32))
+        word = next(words, 0)
+        bits = {"hh": 8, "h": 16, None: 32}.get(size, 64)
+        python = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+        if spec in "di":
+            return (python + "d") % to_signed(word, bits)
+        if spec in "ouxX":
+            return (python + spec) % (word & ((1 << bits) - 1))
+        if spec == "c":
+            return (python + "c") % chr(word & 0xFF)
+        if spec == "s":
+            text = image.string(word)
+            return (python + "s") % (text if text is not None else f"<{word:#x}>")
+        if spec == "p":
+            return (python.replace("%", "%#", 1) + "x") % word
+        return ""
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: klog_decode.py kernel.bin serial.log")
+    image = Image(sys.argv[1])
+    with open(sys.argv[2], "rb") as f:
+        stream = f.read()
+
+    # The stream may follow other serial output, start at the last header
+    magic = struct.pack("<I", KLOG_MAGIC)
+    start = stream.rfind(magic)
+    if start < 0:
+        sys.exit("no klog stream found")
+    _, record_size, tsc_khz, tsc_epoch = HEADER.unpack_from(stream, start)
+    if record_size != RECORD.size:
+        sys.exit(f"record size {record_size}, expected {RECORD.size}")
+
+    for offset in range(start + HEADER.size, len(stream) - record_size + 1, record_size):
+        tsc, fmt_address, cpu, nargs, *args = RECORD.unpack_from(stream, offset)
+        fmt = image.string(fmt_address)
+        if fmt is None:
+            text = f"<format at {fmt_address:#x} not in the image>\n"
+        else:
+            text = format_record(image, fmt, args[:nargs])
+        us = (tsc - tsc_epoch) * 1000 // tsc_khz
+        sys.stdout.write(f"[{us // 1000000:5d}.{us % 1000000:06d}] cpu{cpu}: {text}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: MIT
+/*
+ * tools/kprintf_test.c
+ *
+ * Copyright (c) 2024 CharaDrinkingTea
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Host conformance test and benchmark of kernel/kprintf.c against libc snprintf
+ *
+ */
+
+/*
+ * Built for the host by "make test-kprintf" and "make bench-kprintf", linked against kernel/kprintf.c
+ * compiled for the host. Every output goes through snkprintf(), so only the string sink is exercised.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int snkprintf(char *str, size_t size, const char *format, ...);
+
+#define BENCH_CALLS 2000000
+
+/* Console sinks kprintf.c links against, never reached through snkprintf() */
+void terminal_write(const char *s, size_t length)
+{
+    fwrite(s, 1, length, stdout);
+}
+
+size_t serial_write(uint16_t port, const char *buffer, size_t length)
+{
+    (void)port;
+    fwrite(buffer, 1, length, stdout);
+    return length;
+}
+
+static unsigned int total;
+static unsigned int failures;
+
+static void check(const char *format, const char *expected, int expected_length, const char *got, int got_length)
+{
+    total++;
+    if (strcmp(expected, got) || expected_length != got_length)
+    {
+        if (failures < 20)
+        {
+            printf("FAIL \"%s\": libc [%s] %d, kernel [%s] %d\n", format, expected, expected_length, got,
+                got_length);
+        }
+        failures++;
+    }
+}
+
+#define CHECK(format, ...) \
+    do \
+    { \
+        char expected[256], got[256]; \
+        int expected_length = snprintf(expected, sizeof(expected), format, __VA_ARGS__); \
+        int got_length = snkprintf(got, sizeof(got), format, __VA_ARGS__); \
+        check(format, expected, expected_length, got, got_length); \
+    } while (0)
+
+static const char *const flag_sets[] = {"", "-", "0", "+", " ", "#", "-+", "0#", "+0", "- ", "#-", "0 "};
+static const char *const widths[] = {"", "1", "5", "12", "30", "120"};
+static const char *const precisions[] = {"", ".0", ".1", ".5", ".20"};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static void test_integers()
+{
+    static const char *const conversions[] = {"d", "i", "u", "x", "X", "o", "ld", "lu", "lx", "hhd", "hd", "hhx"};
+    static const long long values[] = {
+        0, 1, -1, 7, 9, 10, 99, 100, 255, -128, 12345, -99999, INT_MAX, INT_MIN, UINT_MAX, LLONG_MAX, LLONG_MIN,
+        -1234567890123LL,
+    };
+
+    for (unsigned int f = 0; f < COUNT(flag_sets); f++)
+        for (unsigned int w = 0; w < COUNT(widths); w++)
+            for (unsigned int p = 0; p < COUNT(precisions); p++)
+                for (unsigned int c = 0; c < COUNT(conversions); c++)
+                    for (unsigned int v = 0; v < COUNT(values); v++)
+                    {
+                        char format[32];
+                        snprintf(format, sizeof(format), "[%%%s%s%s%s]", flag_sets[f], widths[w], precisions[p],
+                            conversions[c]);
+                        if (conversions[c][0] == 'l')
+                        {
+                            CHECK(format, (long)values[v]);
+                        }
+                        else
+                        {
+                            CHECK(format, (int)values[v]);
+                        }
+                    }
+}
+
+static void test_strings()
+{
+    static const char *const values[] = {"", "a", "abc", "a string longer than twenty characters"};
+
+    // Only '-' is defined for %s and %c
+    for (unsigned int f = 0; f < 2; f++)
+        for (unsigned int w = 0; w < COUNT(widths); w++)
+        {
+            char format[32];
+            for (unsigned int p = 0; p < COUNT(precisions); p++)
+                for (unsigned int v = 0; v < COUNT(values); v++)
+                {
+                    snprintf(format, sizeof(format), "[%%%s%s%ss]", flag_sets[f], widths[w], precisions[p]);
+                    CHECK(format, values[v]);
+                }
+            snprintf(format, sizeof(format), "[%%%s%sc]", flag_sets[f], widths[w]);
+            CHECK(format, 'x');
+        }
+}
+
+static void test_misc()
+{
+    CHECK("%p %p", (void *)0x1234, (void *)0xffff800000001000UL);
+    CHECK("%%|%zu|%*d|%-*d|%.*d", (size_t)42, 6, 1, 6, 1, 3, 7);
+    CHECK("%03lu.%02u", 5UL, 7u);
+    CHECK("%s", "a string long enough to cross the 128 character chunk the formatter hands to its sinks, "
+        "so that the chunk boundary is covered as well");
+
+    // Truncation keeps the NUL and still returns the full length
+    char small[8];
+    int length = snkprintf(small, sizeof(small), "%s", "hello world");
+    check("truncation", "hello w", 11, small, length);
+}
+
+static double seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef int (*format_fn_t)(char *str, size_t size, const char *format, ...);
+
+/* The padded and hex dump formats of bench=kprintf in the kernel, ns per call */
+static double bench_format(format_fn_t format, int hexdump)
+{
+    char line[160];
+    double start = seconds();
+    for (uint64_t i = 0; i < BENCH_CALLS; i++)
+    {
+        if (hexdump)
+        {
+            const uint8_t *b = (const uint8_t *)&line[i % 16];
+            format(line, sizeof(line),
+                "%016lx: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
+                (unsigned long)(uintptr_t)b, b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10],
+                b[11], b[12], b[13], b[14], b[15]);
+        }
+        else
+        {
+            format(line, sizeof(line), "%08lx|%-10u|%+6d|%#o", (unsigned long)(i * 0x9E3779B97F4A7C15UL),
+                (unsigned int)i, (int)i, (unsigned int)i);
+        }
+    }
+    return (seconds() - start) * 1e9 / BENCH_CALLS;
+}
+
+static void bench(const char *name, int hexdump)
+{
+    double kernel = bench_format(snkprintf, hexdump);
+    double libc = bench_format(snprintf, hexdump);
+    printf("%s: kernel %.1f ns/call, libc %.1f ns/call\n", name, kernel, libc);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+    {
+        bench("padded", 0);
+        bench("hexdump", 1);
+        return 0;
+    }
+
+    test_integers();
+    test_strings();
+    test_misc();
+    printf("kprintf: %u of %u cases differ from libc snprintf\n", failures, total);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}